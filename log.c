@@ -1,23 +1,195 @@
 #include "log.h"
+#ifdef __SSE2__
+#include <emmintrin.h>     // 结构化记录的字符串转义
+#endif
 
 /* -------------------------- private prototypes ---------------------------- */
 #define TS_LOG  0
 #define TS_FILE 1
-static char* _timeStr(int type);                                    // 返回一个存储当前本地时间的静态字符串指针
-
-typedef int status;
-#define FILE_NOTEXIST   0
-#define FILE_NOTWRITE   2
-#define FILE_CANWRITE   1
-static status _GetFileStatus(const char* path);                     // 获取文件状态
+static char* _timeStr(int type);                                    // 返回一个存储当前本地时间的字符串指针, 每个线程一份
 
 #define MAX_PATH_LENGTH     255
 static char* _logPath(const char* dir, const char* name);           // 获取一个临时的 path 字串, 不要 free
 
 static void _mkdir(const char* path, mode_t mode);                  // 根据路径依次创建文件夹, 直到文件的最底层
-static void _logFileShrink(LogPtr log);                                    // 若 日志文件 已达上限, 则清空文件
+static bool _dirHas(const char* dir, size_t len);                   // 目录缓存: dir 的前 len 个字符是否是已确认存在的目录
+static void _dirAdd(const char* dir, size_t len);                   // 目录缓存: 记下一个已存在的目录
+static void _dirClear();                                            // 目录缓存: 清空, 目录可能已被删除时调用
+static LogPtr _logCreate(const char* name, const char* path, bool mutetype, bool lazy); // logCreate / logCreateLazy
+static bool _logOpen(LogPtr log);                                   // 创建目录并打开 log->path
+static void _logOpenLazy(LogPtr log);                               // 延迟打开的日志在第一次写入 (或设置需要文件的模式) 时打开文件
+static void _logFileShrink(LogPtr log);                                    // 若 日志文件 已达上限, 则清空文件或请求轮转
+static int  _logPin(LogPtr log, int* slot);                         // 登记为当前文件的写入者并返回其文件描述符, 轮转时等登记的写入者退出后才关闭旧文件
+static void _logUnpin(LogPtr log, int slot);                        // 写完后注销 _logPin 的登记
+static void _logWrite(LogPtr log, const char* buf, size_t len);    // 写入当前文件并累加文件大小
+struct LogMap;
+static struct LogMap* _lmCreate(const char* path, size_t chunk, size_t maxsize); // 打开文件并建立映射, 会先修复上次未正常关闭留下的尾部
+static void   _lmDestroy(struct LogMap* m);                         // 解除映射, 截掉预分配未使用的部分, 关闭文件
+static size_t _lmWrite(struct LogMap* m, const char* rec, size_t len); // 拷贝一条记录到映射中, 返回写入的字节数
+static size_t _lmSize(struct LogMap* m);                            // 当前文件的逻辑大小
+static int    _lmSwap(LogPtr log);                                  // 重新打开 log->path 并切换到新文件, 用于轮转和清空
+static void   _lmGrow(struct LogMap* m, size_t cap);                // 映射范围小于 cap 时, 把当前文件按 cap 重新映射
+static void   _lmLimit(struct LogMap* m, size_t maxsize);           // 大小限制改为 maxsize 后, 映射范围不够时重新映射
+static void _svcRotate(LogPtr log);                                 // 请求后台线程轮转日志文件
+static void _svcFinish(LogPtr log);                                 // 在调用者线程中完成日志未处理的轮转请求, 并等待正在进行的轮转完成
+static void _svcDumpStop();                                         // 停止定时写入计数, 并等待正在进行的一次完成
+static void _svcFlushAdd(struct LogFlush* f);                       // 刷新策略需要定时处理时, 加入后台线程的链表
+static void _svcFlushDel(struct LogFlush* f);                       // 从后台线程的链表中移除, 并等待正在进行的处理完成
+static void _logSizeSync(LogPtr log);                               // 根据文件实际大小重新设置 cursize, 仅在打开和清空文件时使用
+#define _logSizeAdd(log, n, want) do{ size_t _n = (n); if(_n) __atomic_fetch_add(&(log)->cursize, _n, __ATOMIC_RELAXED); \
+            if(_n && (log)->shared) __atomic_fetch_add(&(log)->shared->m->size, _n, __ATOMIC_RELAXED); \
+            if(_n < (size_t)(want)) __atomic_fetch_add(&(log)->nerr, 1, __ATOMIC_RELAXED); }while(0)  // 累加已写入的字节数, 没写完时记一次错误
+
+#define LR_TIME     0x01                                            // 记录开头添加时间
+#define LR_NAME     0x02                                            // 时间后添加 "[name] "
+#define LR_COLON    0x04                                            // 名称后添加 ":", 用户日志记录的格式
+#define LR_LINE     0x08                                            // 保证记录以换行结尾
+#define LR_CONSOLE  0x10                                            // 同时输出到控制台
+#define LR_RECORD   (LR_TIME | LR_NAME | LR_COLON | LR_LINE)        // logAdd* 添加的完整记录
+#define LR_LEVEL(lv) (((lv) + 1) << 5)                              // 名称后添加 "[LEVEL] ", 占用高 3 位, 0 表示不带级别
+#define LR_LVOF(f)  ((int)(((f) >> 5) & 7) - 1)                     // 从 flags 中取出级别, 不带级别时为 -1
+static const char* _lv_name[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+static int  _fmtV(char* buf, size_t cap, const char* fmt, va_list ap); // 同 vsnprintf, 常用的转换由本模块直接处理, 其余交给 vsnprintf
+static size_t _logEmit(LogPtr log, const char* name, unsigned flags, const char* text, va_list* ap); // 格式化一条记录, 然后一次性写入文件和控制台, 返回记录长度
+static unsigned _logLvFlags(LogPtr log, int level);                 // 分级记录的 LR_* 标志, 低于日志级别的只进入飞行记录器和增加的输出
+static LogHist* _logBegin(LogPtr log, uint64_t* t0);               // 添加记录前: 检查文件大小, 计数, 开启延迟统计时返回直方图并记下开始时间
+static int  _kvBuild(char** out, LogPtr log, const char* name, unsigned flags, const char* msg, size_t mlen,
+                     const LogField* f, int n);                     // 按日志的记录格式组装一条结构化记录
+static size_t _writeAll(int fd, const char* buf, size_t len);       // 写入全部内容, 返回实际写入的字节数
+static void _logOut(LogPtr log, const char* rec, size_t len, unsigned flags); // 将已格式化的记录写入文件 (队列/映射/文件描述符) 和控制台
+#define LR_SYNC     0x100                                           // 内部使用: 异步队列中的记录写入后需要同步到磁盘
+#define LR_RINGONLY 0x200                                           // 低于日志级别, 只写入飞行记录器和增加的输出
+#define LR_BLOB     0x400                                           // logAddBlob 的记录, 不写入飞行记录器和增加的输出; 异步队列中表示内容还未编码
+#define LR_DUMP     0x800                                           // 与 LR_BLOB 一起使用: 编码为 hexdump (logAddHexdump)
+#define LR_KEEP     0x1000                                          // 内部使用: 不能丢弃的记录 (二进制模式的格式串定义), 异步队列满时总是等待
+static size_t _blobLen(unsigned flags, size_t n);                   // 二进制数据编码为文本后 (不含前缀) 的长度
+static size_t _blobText(char* dst, unsigned flags, const unsigned char* data, size_t n); // 将二进制数据编码为文本, 返回长度
+struct LogRecorder;
+static void _lrPut(struct LogRecorder* r, const char* rec, size_t len, unsigned flags); // 将记录复制到飞行记录器的环形缓冲区
+static void _lrLevel(LogPtr log);                                   // 重新计算分级记录的门限 log->level
+struct LogFlush{                            // 刷新策略, 见 flush policy 一节
+    size_t   bytes;                         // 缓冲区达到此大小时写入, 为 0 表示不缓冲
+    int      ms;                            // 缓冲的记录最多停留的毫秒数, 为 0 表示不限
+    int      level;                         // 不低于此级别的记录立即写入并同步到磁盘, LOG_LV_OFF 表示不同步
+    int      syncms;                        // 后台同步到磁盘的间隔, 单位为毫秒, 为 0 表示不同步
+    pthread_mutex_t mtx;                    // 保护缓冲区
+    char*    buf;
+    size_t   len, cap;
+    uint64_t first;                         // 缓冲区中最早的记录放入的时间 (单调时钟, ns)
+    pthread_mutex_t syncmtx;                // 同步到磁盘期间持有
+    size_t   synced;                        // 已同步到磁盘的写入总字节数
+    uint64_t lastsync;                      // 上次后台同步的时间
+    LogPtr   log;
+    bool     listed;                        // 已加入后台线程的链表
+    struct LogFlush* next;
+};
+static void _lfAppend(LogPtr log, const char* rec, size_t len, bool force); // 记录放入刷新缓冲区, 满了 (或 force) 时一次写入
+static void _lfSync(LogPtr log);                                    // 同步到磁盘, 并发的请求合并为一次 (group commit)
+static void _lfWrite(LogPtr log, struct LogFlush* f);               // 写出刷新缓冲区, 只在持有 f->mtx 时调用
+static void _lfDestroy(LogPtr log);                                 // 写出缓冲的记录, 释放刷新策略
+static uint64_t _lfDue(struct LogFlush* f, uint64_t now);           // 刷新策略下一次需要后台处理的时间
+static void _lfTick(struct LogFlush* f);                            // 后台线程: 写出停留过久的记录, 定时同步到磁盘
+static int  _lmSync(struct LogMap* m);                              // 将映射的当前文件同步到磁盘
+
+struct LogDedup;
+static bool _ldEmit(LogPtr log, const char* rec, size_t len, unsigned flags); // 去重模式下写入一条记录, 与上一条相同时只计数, 返回是否已处理
+static void _ldFlush(LogPtr log);                                   // 写入尚未报告的重复次数
+
+static size_t _lbEmit(LogPtr log, const char* name, unsigned flags, const char* text, va_list* ap); // 二进制模式下编码一条记录并写入, 返回记录长度
+static void _lbEmitStr(LogPtr log, const char* name, unsigned flags, const char* fmt, ...); // 同 _lbEmit, 参数直接传入
+static size_t _lbNewFile(LogPtr log, int fd);                       // 二进制模式下换了新文件, 写入文件头, 返回写入的字节数
+#define LZ_MAGIC    "LOGLZ001"                                      // 块压缩文件的文件头
+struct LogLz;
+typedef struct LzRange{                     // 还原时的时间范围, 见 compressed blocks 一节
+    const char* from;                       // 开始时间的前缀, 为 NULL 时不限制
+    size_t flen;
+    const char* to;                         // 结束时间的前缀 (包含), 为 NULL 时不限制
+    size_t tlen;
+    bool   keep;                            // 当前记录在范围内, 之后不带时间的行跟随它
+}LzRange;
+static size_t _lzNewFile(LogPtr log, int fd);                       // 块压缩模式下换了新文件, 写入文件头, 返回写入的字节数
+static void _lzAppend(LogPtr log, const char* buf, size_t len);     // 写线程把一批记录放入块缓冲区, 满了就压缩写入
+static void _lzSeal(LogPtr log);                                    // 写线程压缩块缓冲区中的记录, 作为一个块写入文件
+static void _lzTick(LogPtr log);                                    // 写线程按请求或超时写出块缓冲区
+static void _lzClose(LogPtr log);                                   // 写线程退出前写出剩余的记录和索引
+static void _lzFlush(LogPtr log);                                   // 请求写线程写出块缓冲区, 并等待完成
+static void _lzFree(struct LogLz* z);
+static void _lzPut(LzRange* r, const char* p, size_t len, FILE* out); // 按时间范围输出还原后的文本
+static int  _lzDecFile(const char* path, LzRange* r, FILE* out);    // 还原一个块压缩文件
+
+static bool _regAdd(LogPtr log);                                   // 以名称注册日志, 名称已存在时返回 false
+static void _regDel(LogPtr log);                                    // 注销日志
+static void _regEach(void (*fn)(LogPtr log, void* arg), void* arg);  // 对每个已注册的日志调用 fn, 期间持有注册表锁
+struct LogShard{                                                    // 按线程分片的计数, 各占一个缓存行
+    size_t   nrec;                                                  // 添加的记录数
+    LogHist* add;                                                   // logAdd* 耗时, logSetStats 开启时分配
+    LogHist* disk;                                                  // 放入队列到写入文件的耗时, 同上
+}__attribute__((aligned(64)));
+struct LogArena{                                                    // 日志结构, 计数分片, 名称和路径一次分配, 之后添加记录不再分配内存
+    struct Log log;                                                 // 必须在最前面, LogPtr 即为 arena 的地址
+    struct LogShard shards[LOG_STAT_SHARDS];
+    size_t cap;                                                     // str 的大小, 足够存放名称和 DF_LOG_DIR 下的临时路径
+    char   str[];                                                   // 名称和路径
+};
+static struct LogShard* _logShard(LogPtr log);                      // 当前线程使用的计数分片
+static void _statFree(LogPtr log);                                  // 释放直方图
+static void _histAdd(LogHist* h, uint64_t v);                       // 向直方图添加一个样本
+static uint64_t _statNow();                                         // 用于计算延迟的单调时钟, 单位为纳秒
+static int  _logStatsLine(LogPtr log, char* buf, size_t cap);       // 将日志的统计信息格式化为一行
+
+#define LQ_BATCH    (64 << 10)                                      // 写线程每次合并写入文件的最大字节数
+struct LogQueue;
+struct LogSink{                             // 日志的一个输出, 见 sinks 一节
+    int      type;                          // LOG_SINK_*
+    int      level;                         // 低于此级别的分级记录不写入此输出
+    int      fd;                            // 文件, 控制台和套接字输出的文件描述符
+    bool     ownfd;                         // fd 由输出打开, 释放时关闭
+    struct sockaddr_un addr;                // unix 套接字输出的目标地址
+    char*    ring;                          // 内存输出的环形缓冲区
+    size_t   size;                          // 环形缓冲区大小, 为 2 的幂
+    size_t   head;                          // 已写入环形缓冲区的总字节数
+    pthread_mutex_t mtx;                    // 内存输出: 保护环形缓冲区, 写线程写入时 logSinkRead 不能读取
+    LogSinkFn fn;                           // 回调输出的函数和参数
+    void*    arg;
+    size_t   nrec;                          // 计数: 写入 (交给输出) 的记录数
+    size_t   nerr;                          // 计数: 写入失败 (未写完) 的次数
+    struct LogQueue* queue;                 // 队列和写线程, 加入日志之后才有
+    struct LogSink* next;                   // 同一日志的输出组成的链表
+};
+static struct LogQueue* _lqCreate(LogPtr log, struct LogSink* sink, size_t qsize, int policy); // 创建异步队列, 并启动写线程; sink 不为 NULL 时写入该输出
+static void _lqDestroy(struct LogQueue* q);                         // 写完队列中的记录, 停止写线程并释放队列
+static void _lqFlush(struct LogQueue* q);                           // 等待队列中的记录全部写入
+static void _lqFlushAll();                                          // 等待所有异步队列中的记录全部写入
+static void _lqPush(struct LogQueue* q, const char* rec, unsigned len, unsigned flags); // 放入一条已格式化的记录
+static void _lqPushV(struct LogQueue* q, const struct iovec* iov, int cnt, unsigned flags); // 同 _lqPush, 记录由 cnt 段拼接而成, 只拷贝一次
+static void _iovCopy(char* dst, const struct iovec* iov, int cnt);  // 将各段依次拷贝到 dst
+static void _lqWake(struct LogQueue* q);                            // 若写线程正在等待, 则唤醒它
+static void _lqBackoff(int* spins);                                 // 等待写线程时的退避
+static size_t _lsDrain(struct LogQueue* q, char* batch);            // 输出的写线程取出队列中的记录, 交给输出
+static void _lsOut(LogPtr log, const char* rec, size_t len, unsigned flags); // 按级别将记录放入各输出的队列
+static void _lsDestroyAll(LogPtr log);                              // 写完并释放日志的所有输出
+
+#define LP_MAGIC    "LOGSHM01"
+struct LogShm{                                                      // 多进程共享的控制块, 映射自 path.shm, 见 shared mode 一节
+    char     magic[8];                                              // LP_MAGIC, 第一个打开的进程初始化后写入
+    pthread_mutex_t mtx;                                            // 进程间共享的 robust 锁, 只在轮转和清空文件时持有
+    size_t   size;                                                  // 文件大小, 各进程写入后原子累加
+    size_t   gen;                                                   // 文件的代数, 每轮转或清空一次加 1
+};
+struct LogShared{
+    struct LogShm* m;
+    size_t   gen;                                                   // 本进程正在写入的文件的代数
+};
+static bool _lpLock(LogPtr log);                                    // 锁住控制块; 其它进程已轮转或清空了文件时先切换过去, 返回 false
+static void _lpUnlock(LogPtr log, bool done);                       // 解锁, done 表示本进程轮转或清空了文件
+static bool _logReopen(LogPtr log);                                 // 重新打开 path 并替换 log->fp, 只在后台线程中调用
+static int  _logEmpty(LogPtr log);                                  // 清空文件, 共享模式下由调用者持有控制块的锁
 
 /* ------------------------------- SYS API ------------------------------------*/
+static LogPtr _sys = NULL;                      // 系统日志结构指针
+static bool _logsys_service = false;            // 系统日志初始化状态, 只有为 true , 以下 SET API 才有效
+static bool LOGSYS_MUTETYPE = MUTE;
+
 /**
  * @brief logsysInit - 初始化内部日志系统, 可执行可不执行
  * 若执行, 所有的日志创建销毁操作都会记录到默认的日志文件中, 通过 LOGSYS_PATH 查看具体文件
@@ -49,12 +221,45 @@ void logsysStop()
 {
     if(!_logsys_service)  return;
 
+    _svcDumpStop();
+    _lqFlushAll();                          // 先写完所有异步日志, 期间产生的系统日志也能被记录
+    logsysDump();
     logsysAdd(NULL, "log system Stoped!\n");
     logDestroy(_sys);
     _sys = NULL;
     _logsys_service = false;
 }
 
+void logsysSetMutetype(bool mutetype)
+{
+    if(_logsys_service) _sys->mutetype = mutetype;
+    LOGSYS_MUTETYPE = mutetype;
+}
+
+void logsysSetFileSize(size_t size_mb)
+{
+    if(_logsys_service)  _sys->maxsize = size_mb<<20;
+}
+
+static void _logsysDumpOne(LogPtr log, void* arg)
+{
+    char buf[512];
+
+    (void)arg;
+    _logStatsLine(log, buf, sizeof(buf));
+    logsysAdd(log, "%s\n", buf);
+}
+
+/**
+ * @brief logsysDump - 将所有已注册 (创建时指定了名称) 日志的计数写入系统日志, 每个日志一行
+ * 添加记录时不再写系统日志, 记录的数量等信息通过这里查看
+ */
+void logsysDump()
+{
+    if(!_logsys_service)  return;
+    _regEach(_logsysDumpOne, NULL);
+}
+
 /**
  * @brief logsysAdd - 添加日志到系统日志
  * @param log   现在操作的日志, 主要是为了得到 log->name, 用以区分, 可以为 NULL
@@ -64,32 +269,9 @@ void logsysAdd(LogPtr log, const char* text, ...)
 {
     if(!_logsys_service || !_sys || !text || !(*text))  return;
 
-    _logFileShrink(_sys);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    fprintf(_sys->fp, "%s", _timeStr(TS_LOG));
-    if(log && log->name)
-    {
-        fprintf(_sys->fp, "[%s] ", log->name);
-    }
-    vfprintf(_sys->fp, text, argptr);
-    fflush(_sys->fp);
-
-    /* 输出日志到 控制台 中 */
-    if(!_sys->mutetype)
-    {
-        va_start(argptr, text);
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        if(log && log->name)
-        {
-            fprintf(stderr, "[%s] ", log->name);
-        }
-        vfprintf(stderr, text, argptr);
-    }
-
+    _logEmit(_sys, log ? log->name : NULL, _sys->mutetype ? LR_TIME | LR_NAME | LR_LINE : LR_TIME | LR_NAME | LR_LINE | LR_CONSOLE, text, &argptr);
     va_end(argptr);
 }
 
@@ -102,20 +284,9 @@ void logsysAddMute(LogPtr log, const char* text, ...)
 {
     if(!_logsys_service || !_sys || !text || !(*text))  return;
 
-    _logFileShrink(_sys);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    fprintf(_sys->fp, "%s", _timeStr(TS_LOG));
-    if(log && log->name)
-    {
-        fprintf(_sys->fp, "[%s] ", log->name);
-    }
-    vfprintf(_sys->fp, text, argptr);
-    fflush(_sys->fp);
-
+    _logEmit(_sys, log ? log->name : NULL, LR_TIME | LR_NAME | LR_LINE, text, &argptr);
     va_end(argptr);
 }
 
@@ -128,33 +299,12 @@ void logsysAddNMute(LogPtr log, const char* text, ...)
 {
     if(!_logsys_service || !_sys || !text || !(*text))  return;
 
-    _logFileShrink(_sys);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    fprintf(_sys->fp, "%s", _timeStr(TS_LOG));
-    if(log && log->name)
-    {
-        fprintf(_sys->fp, "[%s] ", log->name);
-    }
-    vfprintf(_sys->fp, text, argptr);
-    fflush(_sys->fp);
-
-    /* 输出日志到 控制台 中 */
-    va_start(argptr, text);
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
-    if(log && log->name)
-    {
-        fprintf(stderr, "[%s] ", log->name);
-    }
-    vfprintf(stderr, text, argptr);
-
+    _logEmit(_sys, log ? log->name : NULL, LR_TIME | LR_NAME | LR_LINE | LR_CONSOLE, text, &argptr);
     va_end(argptr);
 }
 
-
 /* ----------------------------- API implementation ------------------------- */
 
 /**
@@ -162,7 +312,7 @@ void logsysAddNMute(LogPtr log, const char* text, ...)
  */
 void logShowTime()
 {
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
+    _logEmit(NULL, NULL, LR_TIME | LR_CONSOLE, NULL, NULL);
 }
 
 /**
@@ -176,7 +326,7 @@ void logShowText(const char* text, ...)
     va_list argptr;
     va_start(argptr, text);
 
-    vfprintf(stderr, text, argptr);
+    _logEmit(NULL, NULL, LR_CONSOLE, text, &argptr);
 
     va_end(argptr);
 }
@@ -192,8 +342,7 @@ void logShow(const char* text, ...)     // 打印时间和内容到控制台
     va_list argptr;
     va_start(argptr, text);
 
-    logShowTime();
-    vfprintf(stderr, text, argptr);
+    _logEmit(NULL, NULL, LR_TIME | LR_CONSOLE, text, &argptr);
 
     va_end(argptr);
 }
@@ -201,9 +350,11 @@ void logShow(const char* text, ...)     // 打印时间和内容到控制台
 
 static void _logReset(LogPtr log)
 {
-    if(log->name)   free(log->name);
-    if(log->path)   free(log->path);
     if(log->fp)     fclose(log->fp);
+    if(log->oldfp)  fclose(log->oldfp);
+    if(log->map)    _lmDestroy(log->map);
+    if(log->fmtgen) free(log->fmtgen);
+    if(log->shards) _statFree(log);
     bzero(log, sizeof(*log));
 }
 
@@ -213,21 +364,32 @@ static void _logReset(LogPtr log)
  * @param name      名称
  * @param path      路径
  * @param mutetype  静默模式
+ * @param lazy      为 true 时只记下路径, 第一次写入时才创建目录和打开文件
  * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
- * @note   如果返回 LOG_OK, 说明 路径一定合法, 并且已成功打开
+ * @note   如果返回 LOG_OK, 说明 路径一定合法, 并且已成功打开 (或等待延迟打开)
  */
-static int _logInit(LogPtr log, const char* name, const char* path, bool mutetype)
+static int _logInit(LogPtr log, const char* name, const char* path, bool mutetype, bool lazy)
 {
-    if(name && *name) log->name = strdup(name);
-    if(path && *path)
+    struct LogArena* a = (struct LogArena*)log;
+    size_t nlen = name ? strlen(name) + 1 : 0;
+
+    if(nlen > 1)
+        log->name = (char*)memcpy(a->str, name, nlen);
+    else
+        nlen = 0;
+    memset(a->shards, 0, sizeof(a->shards));
+    log->shards = a->shards;
+    if(path && *path && strlen(path) < a->cap - nlen)
     {
-        _mkdir(path, 0755);
-        log->path     = strdup(path);
-        log->fp       = fopen(log->path, "a+");
+        log->path     = strcpy(a->str + nlen, path);
         log->maxsize  = DF_LOG_SIZE << 20;          // 默认日志文件大小 DF_LOG_SIZE MB
         log->mutetype = mutetype;
+        if(lazy)
+            log->lazy = true;
+        else
+            _logOpen(log);
     }
-    if(!path || !log->fp)
+    if(!path || !(log->fp || log->lazy))
     {
         logsysAddNMute(log, "%s(%d)-%s:%s\n", __FILE__, __LINE__, __FUNCTION__ ,strerror(errno));
         return LOG_ERR;
@@ -236,6 +398,84 @@ static int _logInit(LogPtr log, const char* name, const char* path, bool mutetyp
     return LOG_OK;
 }
 
+/**
+ * @brief _logOpen - 创建目录并以追加方式打开 log->path
+ * @return 成功返回 true
+ * @note   目录缓存中的目录可能已被删除, 打开失败 (ENOENT) 时清空缓存, 重新创建目录再试一次
+ */
+static bool _logOpen(LogPtr log)
+{
+    FILE* fp;
+
+    _mkdir(log->path, 0755);
+    if(!(fp = fopen(log->path, "a+")) && ENOENT == errno)
+    {
+        _dirClear();
+        _mkdir(log->path, 0755);
+        fp = fopen(log->path, "a+");
+    }
+    if(!fp)     return false;
+    __atomic_store_n(&log->fp, fp, __ATOMIC_RELEASE);
+    _logSizeSync(log);
+    return true;
+}
+
+static pthread_mutex_t _lazy_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief _logOpenLazy - 打开延迟打开的日志的文件, 失败时和 logCreate 一样在 DF_LOG_DIR 下创建临时文件
+ * @note  只尝试一次; 同时第一次写入的线程在锁上等待, 之后的记录都会写入文件
+ */
+static void _logOpenLazy(LogPtr log)
+{
+    pthread_mutex_lock(&_lazy_mtx);
+    if(log->lazy)
+    {
+        if(!_logOpen(log))
+        {
+            logsysAdd(log, "\"%s\" cannot write, try to create a temp file\n", log->path);
+            strcpy(log->path, _logPath(DF_LOG_DIR, log->name));    // 路径缓冲区至少有 MAX_PATH_LENGTH + 1 字节
+            if(!_logOpen(log))
+                logsysAdd(log, "Open err: cannot create file \"%s\"\n", log->path);
+        }
+        __atomic_store_n(&log->lazy, false, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&_lazy_mtx);
+}
+
+static LogPtr _logCreate(const char* name, const char* path, bool mutetype, bool lazy)
+{
+    size_t nlen = name ? strlen(name) + 1 : 0;
+    size_t plen = path ? strlen(path) + 1 : 0;
+    size_t cap  = nlen + (plen > MAX_PATH_LENGTH + 1 ? plen : MAX_PATH_LENGTH + 1);
+    struct LogArena* a = NULL;
+    LogPtr r_log;
+
+    if(posix_memalign((void**)&a, 64, sizeof(*a) + cap))
+        return NULL;
+    memset(a, 0, sizeof(*a));
+    a->cap = cap;
+    r_log  = &a->log;
+    logsysAdd(NULL, "[%s] Creating...\n", name);
+    /* 直接使用指定的文件路径初始化, 不预先检查文件状态: 不可写时打开同样会失败 */
+    if(LOG_ERR == _logInit(r_log, name, path, mutetype, lazy))
+    {
+        /* 如果失败, 重置log, 在程序目录下产生临时文件进行初始化, 如果仍失败, 那么销毁 log, 返回 null */
+        _logReset(r_log);
+        logsysAdd(NULL, "[%s] \"%s\" cannot write, try to create a temp file\n", name, path);
+        if(LOG_ERR == _logInit(r_log, name, _logPath(DF_LOG_DIR, name), mutetype, false))
+        {
+            logsysAdd(NULL, "[%s] Create err: cannot create file \"%s\"\n", name, r_log->path);
+            logDestroy(r_log);
+            return r_log = NULL;
+        }
+    }
+    if(r_log->name && !_regAdd(r_log))
+        logsysAdd(r_log, "name already in use, cannot be found by name\n");
+    logsysAdd(r_log, "Create ok, link file: \"%s\"%s\n", r_log->path, r_log->lazy ? " (lazy)" : "");
+    return r_log;
+}
+
 /**
  * @brief logCreate - 创建一个日志结构
  * @param name      日志名称, 若输出到控制台, 则通过名称进行区分
@@ -246,55 +486,218 @@ static int _logInit(LogPtr log, const char* name, const char* path, bool mutetyp
  */
 LogPtr logCreate(const char* name, const char* path, bool mutetype)
 {
-    LogPtr r_log = (LogPtr)calloc(sizeof(*r_log), 1);
-    status f_s = _GetFileStatus(path);
-    logsysAdd(NULL, "[%s] Creating...\n", name);
-    switch(f_s)
+    return _logCreate(name, path, mutetype, false);
+}
+
+/**
+ * @brief logCreateLazy - 创建一个延迟打开文件的日志结构
+ * 创建时不访问文件系统, 第一次写入 (或 logSetBinary / logSetCompress / logSetShared / logFlieEmpty) 时
+ * 才创建目录和打开文件; 适合启动时创建大量日志, 而其中很多可能很久才会写入的情况
+ * @param name      日志名称
+ * @param path      文件路径, 同 logCreate; 打开失败时同样改用 DF_LOG_DIR 下的临时文件
+ * @param mutetype  所创建日志的静默属性
+ * @return 创建的日志结构指针, 若失败, 则返回 NULL
+ * @note   打开文件之前 fp 为 NULL, logFileSize 返回 0
+ */
+LogPtr logCreateLazy(const char* name, const char* path, bool mutetype)
+{
+    return _logCreate(name, path, mutetype, true);
+}
+
+typedef struct LogMany{
+    LogPtr* logs;
+    const char* const* names;
+    const char* const* paths;
+    int  n;
+    int  next;                              // 下一个要创建的下标
+    int  ok;                                // 创建成功的个数
+    bool mutetype;
+    bool lazy;
+}LogMany;
+
+static void* _logManyThread(void* arg)
+{
+    LogMany* m = (LogMany*)arg;
+    int i;
+
+    while((i = __atomic_fetch_add(&m->next, 1, __ATOMIC_RELAXED)) < m->n)
+        if((m->logs[i] = _logCreate(m->names ? m->names[i] : NULL, m->paths[i], m->mutetype, m->lazy)))
+            __atomic_fetch_add(&m->ok, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * @brief logCreateMany - 批量创建日志结构
+ * 每个日志同 logCreate (lazy 时同 logCreateLazy); 同一目录只在第一次创建时检查, 不延迟时由 threads 个线程
+ * (包括调用者线程) 并行打开文件, 在文件系统延迟较高时可以明显缩短启动时间
+ * @param logs      输出, n 个日志结构指针, 创建失败的为 NULL
+ * @param names     n 个名称, 可以为 NULL (都不命名)
+ * @param paths     n 个文件路径
+ * @param n         个数
+ * @param mutetype  所创建日志的静默属性
+ * @param threads   并行打开文件的线程数, 最多 LOG_MANY_THREADS 个, 小于 1 时为 1
+ * @param lazy      为 true 时都延迟到第一次写入时打开, 此时不创建线程
+ * @return 创建成功的个数
+ */
+int logCreateMany(LogPtr* logs, const char* const* names, const char* const* paths, int n, bool mutetype, int threads, bool lazy)
+{
+    pthread_t th[LOG_MANY_THREADS];
+    LogMany   m = {logs, names, paths, n, 0, 0, mutetype, lazy};
+    int i, nth = 0;
+
+    if(!logs || !paths || n <= 0)   return 0;
+    if(lazy || threads < 1)         threads = 1;
+    if(threads > LOG_MANY_THREADS)  threads = LOG_MANY_THREADS;
+    if(threads > n)                 threads = n;
+    for(i = 1; i < threads; i++)
+        if(0 == pthread_create(&th[nth], NULL, _logManyThread, &m))
+            nth++;
+    _logManyThread(&m);
+    for(i = 0; i < nth; i++)
+        pthread_join(th[i], NULL);
+    return m.ok;
+}
+
+/**
+ * @brief logCreateAsync - 创建一个异步日志结构
+ * 添加日志时只在调用者线程中格式化记录并放入无锁队列, 由后台写线程写入文件和控制台
+ * @param name      日志名称
+ * @param path      文件路径, 同 logCreate
+ * @param mutetype  所创建日志的静默属性
+ * @param qsize     队列长度 (记录条数), 会向上取整为 2 的幂, 为 0 时使用 DF_LOG_QSIZE
+ * @param policy    队列满时的处理策略: LOG_BP_BLOCK, LOG_BP_DROPNEW, LOG_BP_DROPOLD
+ * @return 创建的日志结构指针, 若失败, 则返回 NULL
+ */
+LogPtr logCreateAsync(const char* name, const char* path, bool mutetype, size_t qsize, int policy)
+{
+    LogPtr r_log = logCreate(name, path, mutetype);
+    if(!r_log)  return NULL;
+
+    if(policy != LOG_BP_DROPNEW && policy != LOG_BP_DROPOLD)
+        policy = LOG_BP_BLOCK;
+    r_log->queue = _lqCreate(r_log, NULL, qsize ? qsize : DF_LOG_QSIZE, policy);
+    if(!r_log->queue)
     {
-        case FILE_CANWRITE:
-        case FILE_NOTEXIST:
-            /* 使用指定的文件路径初始化, 如果成功, 跳出返回  */
-            if(LOG_OK == _logInit(r_log, name, path, mutetype))
-                break;
-            /* 如果失败, 重置log, 继续执行 FILE_NOTWRITE 分支 */
-            _logReset(r_log);
-        case FILE_NOTWRITE:
-            /* 在程序目录下产生临时文件进行初始化, 如果失败, 那么销毁 log, 返回 null  */
-            logsysAdd(NULL, "[%s] \"%s\" cannot write, try to create a temp file\n", name, path);
-            if(LOG_ERR == _logInit(r_log, name, _logPath(DF_LOG_DIR, name), mutetype))
-            {
-                logsysAdd(NULL, "[%s] Create err: cannot create file \"%s\"\n", name, r_log->path);
-                logDestroy(r_log);
-                return r_log = NULL;
-            }
+        logsysAdd(r_log, "Create async queue err: %s\n", strerror(errno));
+        logDestroy(r_log);
+        return NULL;
+    }
+    logsysAdd(r_log, "Async mode on, policy: %d\n", policy);
+    return r_log;
+}
+
+/**
+ * @brief logCreateMmap - 创建一个内存映射模式的日志结构
+ * 文件按 chunk_mb 预分配并映射到内存, 添加日志时只需原子地增加写入位置, 再 memcpy 到映射区, 不经过文件流.
+ * 关闭时截掉预分配未使用的部分; 若程序崩溃, 下次打开时会截掉尾部的空白, 文件中的记录总是连续的.
+ * 超出大小限制时由后台线程切换文件 (按 logSetRotate 归档或直接丢弃), 不会阻塞添加日志的线程.
+ * @param name      日志名称
+ * @param path      文件路径, 同 logCreate
+ * @param mutetype  所创建日志的静默属性
+ * @param chunk_mb  每次预分配的大小, 单位为 MB, 为 0 时使用 DF_LOG_MAPCHUNK
+ * @return 创建的日志结构指针, 若失败, 则返回 NULL
+ */
+LogPtr logCreateMmap(const char* name, const char* path, bool mutetype, size_t chunk_mb)
+{
+    LogPtr r_log = logCreate(name, path, mutetype);
+    if(!r_log)  return NULL;
+
+    r_log->map = _lmCreate(r_log->path, (chunk_mb ? chunk_mb : DF_LOG_MAPCHUNK) << 20, r_log->maxsize);
+    if(!r_log->map)
+    {
+        logsysAdd(r_log, "Create mmap err: %s\n", strerror(errno));
+        logDestroy(r_log);
+        return NULL;
     }
-    logsysAdd(r_log, "Create ok, link file: \"%s\"\n", r_log->path);
+    fclose(r_log->fp);                      // 之后都通过映射写入, 不再使用文件流
+    r_log->fp = NULL;
+    _logSizeSync(r_log);
+
+    logsysAdd(r_log, "Mmap mode on, chunk: %u MB\n", (unsigned int)(chunk_mb ? chunk_mb : DF_LOG_MAPCHUNK));
     return r_log;
 }
 
 /**
  * @brief logDestroy - 销毁一个日志结构, 释放内存
  * @param log   要销毁的日志结构指针
+ * @note  异步模式下会先等待写线程写完队列中的所有记录
  */
 void logDestroy(LogPtr log)
 {
     if(!log)    return ;
+    if(log->name)
+        _regDel(log);
+    _svcFinish(log);
+    if(log->dedup)
+        logSetDedup(log, false);    // 写入尚未报告的重复次数
+    if(log->queue)
+    {
+        _lqDestroy(log->queue);
+        log->queue = NULL;
+        _svcFinish(log);            // 写线程写完队列时可能又请求了轮转
+    }
+    if(log->lz)                     // 写线程退出前已写出剩余的块和索引
+    {
+        _lzFree(log->lz);
+        log->lz = NULL;
+    }
+    if(log->sinks)
+        _lsDestroyAll(log);
+    if(log->shared)
+        logSetShared(log, false);
+    if(log->flush)
+        _lfDestroy(log);
+    if(log->rec)
+        logSetRecorder(log, 0, LOG_LV_OFF, NULL);
     logsysAdd(log, "log destroied\n");
     _logReset(log);
 
     free(log);
 }
 
+/**
+ * @brief logFlush - 刷新日志
+ * 异步模式下阻塞等待, 直到此前添加的记录都已写入文件; 同步模式下记录已直接写入文件, 这里只刷新文件流缓冲.
+ * 若已请求了轮转而后台线程还未处理, 则在这里完成
+ * @param log
+ */
+void logFlush(LogPtr log)
+{
+    struct LogSink* k;
+
+    if(!log)    return;
+    __atomic_fetch_add(&log->nflush, 1, __ATOMIC_RELAXED);
+    if(log->dedup)
+        _ldFlush(log);
+    if(log->flush)
+    {
+        pthread_mutex_lock(&log->flush->mtx);
+        _lfWrite(log, log->flush);
+        pthread_mutex_unlock(&log->flush->mtx);
+    }
+    if(log->queue)
+        _lqFlush(log->queue);
+    else if(log->fp)
+        fflush(log->fp);
+    if(log->lz)
+        _lzFlush(log);
+    for(k = __atomic_load_n(&log->sinks, __ATOMIC_ACQUIRE); k; k = k->next)
+        _lqFlush(k->queue);
+    _svcFinish(log);                        // 已写入的记录超出大小限制时, 返回前完成轮转
+}
+
 /**
  * @brief logFileSize - 获取日志文件大小
  * @param log
- * @return 大小, 单位为字节
+ * @return 大小, 单位为字节, 包括还在文件流缓冲中未写入的部分
+ * @note   返回的是日志结构中缓存的计数, 不会访问文件; 延迟打开的日志在打开文件前返回 0
  */
 size_t logFileSize(LogPtr log)
 {
-    if(!log->fp) return -1;
-    fseek(log->fp, 0, SEEK_END);
-    return ftell(log->fp);
+    if(!log->fp && !log->map) return log->lazy ? 0 : -1;
+    if(log->shared)                         // 所有进程写入的大小
+        return __atomic_load_n(&log->shared->m->size, __ATOMIC_RELAXED);
+    return __atomic_load_n(&log->cursize, __ATOMIC_RELAXED);
 }
 
 /**
@@ -307,10 +710,26 @@ int logSetFileSize(LogPtr log, size_t size_mb)
 {
     if(!log || size_mb > INT_MAX>>20)   return -1;
     log->maxsize = size_mb << 20;
+    if(log->map)                            // 调大限制后映射范围不够时重新映射, 否则超出的部分都要改用 pwrite
+        _lmLimit(log->map, log->maxsize);
     logsysAdd(log, "set file size to %d \n", log->maxsize);
     return log->maxsize;
 }
 
+/**
+ * @brief logSetLevel - 设置日志的级别, 低于此级别的 logAddLevel / logTrace ~ logFatal 记录会被丢弃
+ * @param log
+ * @param level LOG_LV_TRACE ~ LOG_LV_OFF
+ * @note  不影响 logAdd 等不带级别的接口; 开启了飞行记录器时, 低于此级别但不低于记录器级别的记录只进入记录器
+ */
+void logSetLevel(LogPtr log, int level)
+{
+    if(!log || level < LOG_LV_TRACE || level > LOG_LV_OFF)    return;
+    __atomic_store_n(&log->filelevel, level, __ATOMIC_RELAXED);
+    _lrLevel(log);
+    logsysAdd(log, "set level to %s\n", level == LOG_LV_OFF ? "OFF" : _lv_name[level]);
+}
+
 /**
  * @brief logSetMutetype - 设置日志的静默属性
  * @param log
@@ -325,19 +744,71 @@ void logSetMutetype(LogPtr log, bool mutetype)
         logsysAdd(log, "set mutetype to NMUTE \n");
 }
 
+/**
+ * @brief logSetRotate - 设置日志文件轮转
+ * 文件超出大小限制 (或到达轮转时间) 时, 依次将 path.N-1 ~ path.1 重命名为 path.N ~ path.2, path 重命名为 path.1,
+ * 然后重新打开 path. 重命名和打开都在后台线程中进行, 期间添加的日志继续写入原来的文件, 不会阻塞.
+ * @param log
+ * @param keep          保留的归档文件数, 为 0 时恢复默认行为: 超出大小限制则清空文件
+ * @param interval_sec  按时间轮转的间隔, 单位为秒, 如 86400 为每天一次; 为 0 表示只按大小轮转
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ */
+int logSetRotate(LogPtr log, int keep, int interval_sec)
+{
+    if(!log || keep < 0 || interval_sec < 0)    return LOG_ERR;
+
+    log->rotkeep = keep;
+    log->rotint  = interval_sec;
+    if(interval_sec)
+        log->rotnext = (time(NULL) / interval_sec + 1) * interval_sec;
+    logsysAdd(log, "set rotate: keep %d, interval %d s\n", keep, interval_sec);
+    return LOG_OK;
+}
+
 /**
  * @brief logFlieEmpty  - 清空日志结构所指文件
  * @param log
  * @return
+ * @note  共享模式下持有控制块的锁清空, 其它进程写入的文件也是这个文件
  */
 int logFlieEmpty(LogPtr log)
 {
+    int r;
+
+    if(log->lazy)                           // 文件可能已有内容, 打开后清空
+        _logOpenLazy(log);
+    if(!log->shared)
+        return _logEmpty(log);
+    _lpLock(log);                           // 其它进程已轮转时, 清空的是切换后的文件
+    r = _logEmpty(log);
+    _lpUnlock(log, r >= 0);
+    return r;
+}
+
+static int _logEmpty(LogPtr log)
+{
+    if(log->map)                            // 内存映射模式下不能直接截断, 删除后切换到新文件
+    {
+        unlink(log->path);
+        if(LOG_ERR == _lmSwap(log))
+            return -1;
+        __atomic_fetch_add(&log->nrot, 1, __ATOMIC_RELAXED);
+        logsysAdd(log, "Log file had been truncated \n");
+        return 0;
+    }
     if(!log->fp)   return -1;
 
+    fflush(log->fp);
     int fd = fileno(log->fp);
     fd = ftruncate(fd, 0);
 
     rewind(log->fp);
+    if(log->bin)
+        _lbNewFile(log, fileno(log->fp));
+    if(log->lz)
+        _lzNewFile(log, fileno(log->fp));
+    _logSizeSync(log);
+    __atomic_fetch_add(&log->nrot, 1, __ATOMIC_RELAXED);
 
     logsysAdd(log, "Log file had been truncated \n");
 
@@ -352,13 +823,7 @@ void logAddTime(LogPtr log)
 {
     if(!log)    return;
 
-    _logFileShrink(log);
-
-    if(log->fp)
-        fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    if(!log->mutetype)
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-    logsysAdd(log, "add time\n");
+    _logEmit(log, NULL, log->mutetype ? LR_TIME : LR_TIME | LR_CONSOLE, NULL, NULL);
 }
 
 /**
@@ -369,11 +834,7 @@ void logAddTimeMute(LogPtr log)
 {
     if(!log)    return;
 
-    _logFileShrink(log);
-
-    if(log->fp)
-        fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    logsysAdd(log, "add time\n");
+    _logEmit(log, NULL, LR_TIME, NULL, NULL);
 }
 
 /**
@@ -384,12 +845,7 @@ void logAddTimeNMute(LogPtr log)
 {
     if(!log)    return;
 
-    _logFileShrink(log);
-
-    if(log->fp)
-        fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
-    logsysAdd(log, "add time\n");
+    _logEmit(log, NULL, LR_TIME | LR_CONSOLE, NULL, NULL);
 }
 
 /**
@@ -399,19 +855,11 @@ void logAddTimeNMute(LogPtr log)
  */
 void logAddText(LogPtr log, const char* text, ...)
 {
-    if(!log || !text || !(*text)) return;
-
-    _logFileShrink(log);
+    if(!log || !text || !(*text))   return;
 
     va_list argptr;
     va_start(argptr, text);
-
-    if(log->fp)
-        vfprintf(log->fp, text, argptr);
-    if(!log->mutetype)
-        vfprintf(stderr, text, argptr);
-    logsysAdd(log, "add a text \n");
-
+    _logEmit(log, log->name, log->mutetype ? 0 : LR_CONSOLE, text, &argptr);
     va_end(argptr);
 }
 /**
@@ -421,17 +869,11 @@ void logAddText(LogPtr log, const char* text, ...)
  */
 void logAddTextMute(LogPtr log, const char* text, ...)
 {
-    if(!log || !text || !(*text)) return;
-
-    _logFileShrink(log);
+    if(!log || !text || !(*text))   return;
 
     va_list argptr;
     va_start(argptr, text);
-
-    if(log->fp)
-        vfprintf(log->fp, text, argptr);
-    logsysAdd(log, "add a text \n");
-
+    _logEmit(log, log->name, 0, text, &argptr);
     va_end(argptr);
 }
 /**
@@ -441,18 +883,11 @@ void logAddTextMute(LogPtr log, const char* text, ...)
  */
 void logAddTextNMute(LogPtr log, const char* text, ...)
 {
-    if(!log || !text || !(*text)) return;
-
-    _logFileShrink(log);
+    if(!log || !text || !(*text))   return;
 
     va_list argptr;
     va_start(argptr, text);
-
-    if(log->fp)
-        vfprintf(log->fp, text, argptr);
-    vfprintf(stderr, text, argptr);
-    logsysAdd(log, "add a text \n");
-
+    _logEmit(log, log->name, LR_CONSOLE, text, &argptr);
     va_end(argptr);
 }
 
@@ -466,39 +901,18 @@ void logAdd(LogPtr log, const char* text, ...)
 {
     if(!log || !text || !(*text))   return;
 
-    _logFileShrink(log);
-
     va_list argptr;
     va_start(argptr, text);
-
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
-
-    if(!log->mutetype)
-    {
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        if(log->name)   fprintf(stderr, "[%s] :", log->name);
-        vfprintf(stderr, text, argptr);
-    }
-    logsysAdd(log, "add a log\n");
-
+    _logEmit(log, log->name, log->mutetype ? LR_RECORD : LR_RECORD | LR_CONSOLE, text, &argptr);
     va_end(argptr);
 }
 void logAddMute(LogPtr log, const char* text, ...)     // 添加 时间 和 text 到 日志中, 强制静默处理
 {
     if(!log || !text || !(*text))   return;
 
-    _logFileShrink(log);
-
     va_list argptr;
     va_start(argptr, text);
-
-
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
-
-    logsysAdd(log, "add a log\n");
-
+    _logEmit(log, log->name, LR_RECORD, text, &argptr);
     va_end(argptr);
 }
 /**
@@ -510,67 +924,129 @@ void logAddNMute(LogPtr log, const char* text, ...)
 {
     if(!log || !text || !(*text))   return;
 
-    _logFileShrink(log);
-
     va_list argptr;
     va_start(argptr, text);
+    _logEmit(log, log->name, LR_RECORD | LR_CONSOLE, text, &argptr);
+    va_end(argptr);
+}
 
-    // 添加到文件流中
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
+/**
+ * @brief logAddByName - 添加 时间 和 text 到 名称为 name 的日志中, 由其 mute 属性决定是否静默处理
+ * @param name  日志名称, 即 logCreate 时指定的名称
+ * @param text
+ * @note  频繁调用时可以使用 logAdd(logHandle(name), ...), 省去每次查找的开销
+ */
+void logAddByName(const char* name, const char* text, ...)
+{
+    LogPtr log = logGet(name);
+    if(!log || !text || !(*text))   return;
 
-    // 输出到控制台
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
-    if(log->name)   fprintf(stderr, "[%s] :", log->name);
-    vfprintf(stderr, text, argptr);
+    va_list argptr;
+    va_start(argptr, text);
+    _logEmit(log, log->name, log->mutetype ? LR_RECORD : LR_RECORD | LR_CONSOLE, text, &argptr);
+    va_end(argptr);
+}
 
-    logsysAdd(log, "add a log\n");
+/**
+ * @brief logAddLevel - 添加 时间, 级别 和 text 到 日志中, 由 (*log).mute 决定是否静默处理
+ * 级别低于日志当前级别时在 va_start 之前返回; 一般通过 logTrace ~ logFatal 宏调用, 宏在求值参数之前就会比较级别
+ * @param log
+ * @param level LOG_LV_TRACE ~ LOG_LV_FATAL
+ * @param text
+ */
+void logAddLevel(LogPtr log, int level, const char* text, ...)
+{
+    if(!log || !text || !(*text))   return;
+    if(level < __atomic_load_n(&log->level, __ATOMIC_RELAXED) || level < LOG_LV_TRACE || level > LOG_LV_FATAL)
+        return;
 
+    va_list argptr;
+    va_start(argptr, text);
+    _logEmit(log, log->name, _logLvFlags(log, level), text, &argptr);
     va_end(argptr);
 }
 
 /* ------------------------- private functions ------------------------------ */
 
-static status _GetFileStatus(const char* path)
+static unsigned _logLvFlags(LogPtr log, int level)
 {
-    if (access(path, F_OK) == 0)       // 如果文件存在
-    {
-        if (access(path, W_OK) != 0)    // 如果不可写
-        {
-            return FILE_NOTWRITE;
-        }
-        return FILE_CANWRITE;
-    }
-    // 文件不存在
-    return FILE_NOTEXIST;
+    return level < __atomic_load_n(&log->filelevel, __ATOMIC_RELAXED) ? LR_RECORD | LR_LEVEL(level) | LR_RINGONLY
+           : (log->mutetype ? LR_RECORD : LR_RECORD | LR_CONSOLE) | LR_LEVEL(level);
 }
 
+/* 时间字串缓存, 每个线程一份, 只有在秒数变化 (或精度改变) 时才重新调用 localtime_r 生成,
+ * 同一秒内只需把 clock_gettime 得到的毫秒/微秒数填入小数部分即可 */
+typedef struct TimeCache{
+    time_t sec;                     // 缓存对应的日历时间 (秒)
+    int    prec;                    // 缓存生成时的小数位数
+    int    len;                     // log 字串的长度
+    int    frac;                    // log 字串中小数部分的起始位置
+    char   log[48];                 // "[YYYY-MM-DD HH:MM:SS.uuuuuu] "
+    char   file[48];                // "-YYYYMMDDHHMMSS.out"
+}TimeCache;
+
+static __thread TimeCache _tc = {-1, -1, 0, 0, {0}, {0}};
+static int _ts_prec = LOG_TS_SEC;   // 时间的小数位数, 由 logSetTimePrecision() 设置
+
 /**
- * 返回一个存储当前本地时间的静态字符串指针
+ * 返回一个存储当前本地时间的字符串指针
  * @param  type  根据 type 返回不同形式的字串
- * @return char* 指向静态区的字符串指针
+ * @return char* 指向本线程缓存区的字符串指针, 在本线程下次调用前有效
  * 注意, 不可 free
 */
-char* _timeStr(int type)
+static char* _timeStr(int type)
 {
-    // static char* timestr = (char*)calloc(30, 1); // C 不支持
-    static char timestr[30];    // 因为不大, 所以直接放到 栈 中
-    static struct tm *local;
-    static time_t t;
+    static const int div[7] = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000};
+    struct timespec ts;
+    struct tm local;
+    int prec = __atomic_load_n(&_ts_prec, __ATOMIC_RELAXED);
+    int i;
+    long frac;
 
-    memset(timestr, 0, 30);
-    t = time(NULL);         // 获取日历时间
-    local = localtime(&t);  // 将日历时间转化为本地时间，并保存在 struct tm 结构中
-    switch(type)
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if(ts.tv_sec != _tc.sec || prec != _tc.prec)
     {
-        case TS_LOG:
-            sprintf(timestr, "[%02d-%02d-%02d %02d:%02d:%02d] ",local->tm_year+1900, local->tm_mon, local->tm_mday, local->tm_hour, local->tm_min, local->tm_sec);
-            break;
-        case TS_FILE:
-            sprintf(timestr, "-%02d%02d%02d%02d%02d%02d.out",local->tm_year+1900, local->tm_mon, local->tm_mday, local->tm_hour, local->tm_min, local->tm_sec);
-            break;
+        localtime_r(&ts.tv_sec, &local);    // 将日历时间转化为本地时间，并保存在 struct tm 结构中
+        _tc.len = snprintf(_tc.log, sizeof(_tc.log), "[%04d-%02d-%02d %02d:%02d:%02d",
+                           local.tm_year+1900, local.tm_mon+1, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec);
+        if(prec)
+        {
+            _tc.log[_tc.len++] = '.';
+            _tc.frac = _tc.len;
+            _tc.len += prec;
+        }
+        memcpy(_tc.log + _tc.len, "] ", 3);
+        _tc.len += 2;
+        snprintf(_tc.file, sizeof(_tc.file), "-%04d%02d%02d%02d%02d%02d.out",
+                 local.tm_year+1900, local.tm_mon+1, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec);
+        _tc.sec  = ts.tv_sec;
+        _tc.prec = prec;
+    }
+
+    if(TS_FILE == type)
+        return _tc.file;
+
+    if(prec)                                // 填入小数部分
+    {
+        frac = ts.tv_nsec / div[prec];
+        for(i = prec - 1; i >= 0; i--)
+        {
+            _tc.log[_tc.frac + i] = '0' + frac % 10;
+            frac /= 10;
+        }
     }
-    return timestr;
+    return _tc.log;
+}
+
+/**
+ * @brief logSetTimePrecision - 设置日志时间的精度, 对所有日志有效
+ * @param digits  小数位数: LOG_TS_SEC(0), LOG_TS_MS(3), LOG_TS_US(6), 其它 0~6 之间的值也可以
+ */
+void logSetTimePrecision(int digits)
+{
+    if(digits < 0)  digits = 0;
+    if(digits > 6)  digits = 6;
+    __atomic_store_n(&_ts_prec, digits, __ATOMIC_RELAXED);
 }
 
 /**
@@ -581,15 +1057,9 @@ char* _timeStr(int type)
 */
 static char* _logPath(const char* dir, const char* name)
 {
-    static char* r_path = NULL;
-    if(!r_path)
-        r_path = (char*)malloc(MAX_PATH_LENGTH + 1);
-    bzero(r_path, MAX_PATH_LENGTH + 1);
-    if(dir)
-        strcat(r_path, dir);
-    if(name)
-        strcat(r_path, name);
-    strcat(r_path, _timeStr(TS_FILE));
+    static __thread char r_path[MAX_PATH_LENGTH + 1];  // logCreateMany 会在多个线程中创建日志
+
+    snprintf(r_path, sizeof(r_path), "%s%s%s", dir ? dir : "", name ? name : "", _timeStr(TS_FILE));
     return r_path;
 }
 
@@ -597,51 +1067,6059 @@ static char* _logPath(const char* dir, const char* name)
  * @brief _mkdir - 根据路径依次创建文件夹, 直到文件的最底层
  * @param path  路径, 文件夹或文件路径均可
  * @param mode  权限, 推荐 0755
+ * @note  已确认存在的目录记在目录缓存中, 同一目录下再创建日志时不需要任何系统调用;
+ *        已存在 (EEXIST) 不算错误, 只记入缓存, 不写系统日志
  */
-void _mkdir(const char* path, mode_t mode)
+static void _mkdir(const char* path, mode_t mode)
 {
-    char* head = strdup(path);
-    char* tail = head;
+    char  head[PATH_MAX];
+    char* tail;
+    char* last = strrchr(path, '/');
+    size_t len = last ? (size_t)(last - path) : 0;
 
-    while(*tail)
+    if(!len || len >= sizeof(head))     return;     // 没有目录部分; 过长的路径打开文件时也会失败
+    if(_dirHas(path, len))              return;     // 最底层的目录已存在, 上层目录必然也存在
+    memcpy(head, path, len);
+    head[len] = '\0';
+    for(tail = head + 1; ; tail++)
     {
-        if('/' == *tail)
+        if('/' == *tail || '\0' == *tail)
         {
+            char c = *tail;
             *tail = '\0';
-            if(mkdir(head, mode))
-                logsysAdd(NULL, "%s(%d)-[mkdir]: \"%s\" %s\n", __FILE__, __LINE__, head, strerror(errno));
-            else
-                logsysAdd(NULL, "mkdir \"%s\" ok\n", head);
-            *tail = '/';
+            if(!_dirHas(head, tail - head))
+            {
+                if(0 == mkdir(head, mode))
+                {
+                    logsysAdd(NULL, "mkdir \"%s\" ok\n", head);
+                    _dirAdd(head, tail - head);
+                }
+                else if(EEXIST == errno)
+                    _dirAdd(head, tail - head);
+                else
+                    logsysAdd(NULL, "%s(%d)-[mkdir]: \"%s\" %s\n", __FILE__, __LINE__, head, strerror(errno));
+            }
+            *tail = c;
+            if('\0' == c)  break;
         }
-        tail++;
     }
+}
+
+/**
+ * @brief _logSizeSync - 获取文件的实际大小, 重新设置 cursize
+ * @param log
+ * @note  只在打开和清空文件时调用, 平时由写入的字节数累加得到, 不访问文件
+ */
+static void _logSizeSync(LogPtr log)
+{
+    struct stat st;
+    size_t size = 0, old;
+
+    if(log->map)
+        size = _lmSize(log->map);
+    else if(0 == fstat(fileno(log->fp), &st))
+        size = st.st_size;
 
-    free(head);
+    /* 之前的文件中由本日志写入的部分计入总字节数 (打开时已有的内容会在这里扣除) */
+    old = __atomic_exchange_n(&log->cursize, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&log->wbase, old - size, __ATOMIC_RELAXED);
 }
 
 /**
- * @brief _logFileShrink - 若 日志文件 已达上限, 则清空文件
+ * @brief _logFileShrink - 若 日志文件 已达上限, 则清空文件; 若设置了轮转, 则请求后台线程轮转
+ * 共享模式下按所有进程写入的大小判断, 由后台线程持有控制块的锁清空或轮转; 其它进程已换了文件时也由后台线程切换过去
  * @param log
  */
 void _logFileShrink(LogPtr log)
 {
-    if(0 != log->maxsize && logFileSize(log) > log->maxsize)
+    struct LogShared* s = log->shared;
+
+    if(0 != log->maxsize && __atomic_load_n(s ? &s->m->size : &log->cursize, __ATOMIC_RELAXED) > log->maxsize)
     {
-        logsysAdd(log, "Test to reach the upper file limitation ~!, Empty file...\n");
-        logFlieEmpty(log);
+        if(log->rotkeep || log->map || s)   // 内存映射和共享模式下切换文件也交给后台线程
+        {
+            if(!__atomic_load_n(&log->rotating, __ATOMIC_RELAXED))
+                __atomic_fetch_add(&log->nlimit, 1, __ATOMIC_RELAXED);
+            _svcRotate(log);
+        }
+        else
+        {
+            __atomic_fetch_add(&log->nlimit, 1, __ATOMIC_RELAXED);
+            logFlieEmpty(log);      // 先清空再记录, 否则清空系统日志时会再次进入这里
+            logsysAdd(log, "Test to reach the upper file limitation ~!, file emptied\n");
+        }
     }
+    else if(log->rotint && time(NULL) >= log->rotnext)
+        _svcRotate(log);
+    else if(s && __atomic_load_n(&s->m->gen, __ATOMIC_ACQUIRE) != s->gen)
+        _svcRotate(log);
 }
 
-/* ------------------------- private functions ------------------------------ */
+/**
+ * @brief _logPin - 登记为当前文件的写入者, 返回当前文件的描述符 (没有打开文件时为 -1)
+ * 与内存映射的 users 相同的协议: 在 fgen 对应的槽上加 1, 再确认 fgen 未变; _logReopen 替换 fp 后把 fgen 加 1,
+ * 旧文件在其槽归零后才关闭. 所以登记期间拿到的描述符不会被关闭, 也不会被别的文件复用
+ * @param slot  登记的槽, 传给 _logUnpin
+ */
+static int _logPin(LogPtr log, int* slot)
+{
+    unsigned g;
+    FILE*    fp;
+
+    for(;;)
+    {
+        g = __atomic_load_n(&log->fgen, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&log->fusers[g & 1], 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&log->fgen, __ATOMIC_SEQ_CST) == g)
+            break;
+        __atomic_fetch_sub(&log->fusers[g & 1], 1, __ATOMIC_RELEASE);  // 正在换文件, 登记到新的槽上
+    }
+    *slot = g & 1;
+    fp = __atomic_load_n(&log->fp, __ATOMIC_ACQUIRE);
+    return fp ? fileno(fp) : -1;
+}
+
+static void _logUnpin(LogPtr log, int slot)
+{
+    __atomic_fetch_sub(&log->fusers[slot], 1, __ATOMIC_RELEASE);
+}
+
+static void _logWrite(LogPtr log, const char* buf, size_t len)
+{
+    int slot, fd = _logPin(log, &slot);
+
+    if(fd >= 0)
+        _logSizeAdd(log, _writeAll(fd, buf, len), len);
+    _logUnpin(log, slot);
+}
+
+/* ---------------------------- fast formatter ------------------------------- */
+/* 日志中几乎只用到 %d %u %x %s %c %p %f, glibc 的 vfprintf 要处理区域设置, 宽字符, 位置参数等, 对这些转换来说很慢.
+ * _fmtV 自行处理这些转换 (包括标志, 宽度, 精度和长度修饰符), 输出与 printf 逐字节相同:
+ *   整数每次转换两位十进制数字, 十六进制按半字节查表;
+ *   %f 在精度不超过 17, 绝对值小于 2^64 时用 128 位整数精确计算 v * 10^prec 并按 "四舍六入五成双" 舍入,
+ *      与 glibc 对精确二进制值的舍入结果相同, 否则交给 snprintf;
+ *   %e %g %a, long double 等单个转换交给 snprintf, 位置参数 (%1$d), %n, 宽字符等整个格式串交给 vsnprintf.
+ */
+#define FMT_LEFT    0x01                        // '-'
+#define FMT_PLUS    0x02                        // '+'
+#define FMT_SPACE   0x04                        // ' '
+#define FMT_ALT     0x08                        // '#'
+#define FMT_ZERO    0x10                        // '0'
+
+enum{ FL_NONE, FL_HH, FL_H, FL_L, FL_LL, FL_Z, FL_J, FL_T, FL_LD, FL_BAD };  // 长度修饰符
+
+typedef struct FmtOut{
+    char*  p;
+    size_t cap;                                 // 可写入的字符数, 不包括结尾的 '\0'
+    size_t len;                                 // 完整输出的长度, 可能超过 cap
+}FmtOut;
+
+static const char _fmt_d2[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline void _foPut(FmtOut* o, const char* s, size_t n)
+{
+    if(n && o->len < o->cap)
+        memcpy(o->p + o->len, s, n < o->cap - o->len ? n : o->cap - o->len);
+    o->len += n;
+}
+
+static void _foFill(FmtOut* o, char c, int n)
+{
+    if(n <= 0)  return;
+    if(o->len < o->cap)
+        memset(o->p + o->len, c, (size_t)n < o->cap - o->len ? (size_t)n : o->cap - o->len);
+    o->len += n;
+}
+
+/* 输出一个字段: 前缀 (符号, "0x") + zeros 个 '0' + body, 按宽度和标志补齐 */
+static void _foField(FmtOut* o, const char* pre, int plen, int zeros, const char* body, int blen, int width, int flags)
+{
+    int pad = width - plen - zeros - blen;
+
+    if((flags & FMT_ZERO) && !(flags & FMT_LEFT) && pad > 0)
+    {
+        zeros += pad;
+        pad = 0;
+    }
+    if(!(flags & FMT_LEFT))
+        _foFill(o, ' ', pad);
+    _foPut(o, pre, plen);
+    _foFill(o, '0', zeros);
+    _foPut(o, body, blen);
+    if(flags & FMT_LEFT)
+        _foFill(o, ' ', pad);
+}
+
+/* 无符号整数转为十进制, 写在 end 之前, 返回起始位置 */
+static char* _fmtDec(char* end, unsigned long long v)
+{
+    while(v >= 100)
+    {
+        end -= 2;
+        memcpy(end, _fmt_d2 + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if(v >= 10)
+    {
+        end -= 2;
+        memcpy(end, _fmt_d2 + v * 2, 2);
+    }
+    else
+        *--end = '0' + v;
+    return end;
+}
+
+static char* _fmtDec128(char* end, unsigned __int128 v)
+{
+    while(v > 0xFFFFFFFFFFFFFFFFULL)        // 先按 10^19 分段, 余下的部分用 64 位运算
+    {
+        unsigned long long r = (unsigned long long)(v % 10000000000000000000ULL);
+        char* p = _fmtDec(end, r);
+        while(p > end - 19)
+            *--p = '0';
+        end = p;
+        v /= 10000000000000000000ULL;
+    }
+    return _fmtDec(end, (unsigned long long)v);
+}
+
+static void _fmtInt(FmtOut* o, unsigned long long v, bool neg, int base, bool upper, int width, int prec, int flags)
+{
+    const char* hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char  d[32], pre[2];
+    char* end = d + sizeof(d);
+    char* p = end;
+    int   plen = 0, n, zeros;
+
+    if(!(v == 0 && prec == 0))              // 精度为 0 时, 0 不输出数字
+    {
+        if(10 == base)
+            p = _fmtDec(end, v);
+        else if(16 == base)
+            do{ *--p = hex[v & 15]; v >>= 4; }while(v);
+        else
+            do{ *--p = '0' + (v & 7); v >>= 3; }while(v);
+    }
+    n = end - p;
+
+    if(10 == base)
+    {
+        if(neg)                     pre[plen++] = '-';
+        else if(flags & FMT_PLUS)   pre[plen++] = '+';
+        else if(flags & FMT_SPACE)  pre[plen++] = ' ';
+    }
+    else if((flags & FMT_ALT) && 16 == base && n && !(n == 1 && '0' == *p))
+    {
+        pre[plen++] = '0';
+        pre[plen++] = upper ? 'X' : 'x';
+    }
+    zeros = prec > n ? prec - n : 0;
+    if(8 == base && (flags & FMT_ALT) && !zeros && (!n || '0' != *p))
+        zeros = 1;                          // "%#o" 保证以 0 开头
+    if(prec >= 0)
+        flags &= ~FMT_ZERO;                 // 指定了精度时 '0' 标志无效
+    _foField(o, pre, plen, zeros, p, n, width, flags);
+}
+
+/* %f 的快速路径, 不能精确处理时返回 false */
+static bool _fmtFixed(FmtOut* o, double v, int width, int prec, int flags)
+{
+    static const unsigned long long p10[18] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+        10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+        10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL};
+    union{ double d; unsigned long long u; }x = {v};
+    unsigned long long m = x.u & ((1ULL << 52) - 1);
+    int   be = (int)(x.u >> 52) & 0x7ff, e, k, n, plen = 0;
+    unsigned __int128 q, t, r, half;
+    char  d[64], pre[1];
+    char* end = d + sizeof(d) - 1;
+    char* p;
+
+    if(prec < 0)    prec = 6;
+    if(0x7ff == be || prec > 17)            // 无穷大, NaN, 或精度太高
+        return false;
+    if(be)
+    {
+        m |= 1ULL << 52;
+        e  = be - 1075;
+    }
+    else
+        e = -1074;
+
+    if(e >= 0)                              // 整数, 要求小于 2^64, 乘以 10^17 仍不超过 128 位
+    {
+        if(e > 11)  return false;
+        q = ((unsigned __int128)m << e) * p10[prec];
+    }
+    else
+    {
+        k = -e;
+        t = (unsigned __int128)m * p10[prec];   // 小于 2^53 * 10^17 < 2^110
+        if(k >= 111)                        // t < 2^110 <= 2^(k-1), 不到一半, 舍为 0
+            q = 0;
+        else
+        {
+            q    = t >> k;
+            r    = t & (((unsigned __int128)1 << k) - 1);
+            half = (unsigned __int128)1 << (k - 1);
+            if(r > half || (r == half && (q & 1)))
+                q++;
+        }
+    }
+
+    p = _fmtDec128(end, q);
+    while(end - p <= prec)                  // 至少有一位整数
+        *--p = '0';
+    if(prec || (flags & FMT_ALT))           // 插入小数点
+    {
+        n = end - p;
+        memmove(p - 1, p, n - prec);
+        p--;
+        p[n - prec] = '.';
+    }
+    if(x.u >> 63)                   pre[plen++] = '-';
+    else if(flags & FMT_PLUS)       pre[plen++] = '+';
+    else if(flags & FMT_SPACE)      pre[plen++] = ' ';
+    _foField(o, pre, plen, 0, p, end - p, width, flags);
+    return true;
+}
+
+/* 重新组装单个转换的格式串, 宽度和精度已解析为数字; spec 至少 48 字节 */
+static void _fmtSpec(char* spec, int flags, int width, int prec, const char* lm, char conv)
+{
+    size_t n = 0;
+
+    spec[n++] = '%';
+    if(flags & FMT_LEFT)    spec[n++] = '-';
+    if(flags & FMT_PLUS)    spec[n++] = '+';
+    if(flags & FMT_SPACE)   spec[n++] = ' ';
+    if(flags & FMT_ALT)     spec[n++] = '#';
+    if(flags & FMT_ZERO)    spec[n++] = '0';
+    char  d[12];
+    char* p;
+
+    if(width)
+    {
+        p = _fmtDec(d + sizeof(d), width);
+        memcpy(spec + n, p, d + sizeof(d) - p);
+        n += d + sizeof(d) - p;
+    }
+    if(prec >= 0)
+    {
+        spec[n++] = '.';
+        p = _fmtDec(d + sizeof(d), prec);
+        memcpy(spec + n, p, d + sizeof(d) - p);
+        n += d + sizeof(d) - p;
+    }
+    while(*lm)
+        spec[n++] = *lm++;
+    spec[n++] = conv;
+    spec[n]   = '\0';
+}
+
+/* 交给 snprintf 处理一个转换, spec 为重新组装的 "%...c", 参数由调用者按类型传入 */
+static void _fmtOne(FmtOut* o, const char* spec, ...)
+{
+    va_list ap;
+    size_t  room = o->len < o->cap ? o->cap - o->len + 1 : 0;  // 包括结尾的 '\0'
+    char    c;
+    int     n;
+
+    va_start(ap, spec);
+    n = vsnprintf(room ? o->p + o->len : &c, room ? room : 1, spec, ap);
+    va_end(ap);
+    if(n > 0)
+        o->len += n;
+}
+
+/**
+ * @brief _fmtV - 同 vsnprintf: 最多写入 cap - 1 个字符并以 '\0' 结尾, 返回完整输出的长度, 出错返回 -1
+ */
+static int _fmtV(char* buf, size_t cap, const char* fmt, va_list ap)
+{
+    FmtOut o = {buf, cap ? cap - 1 : 0, 0};
+    const char* start = fmt;
+    const char* s;
+    const char* lit;
+    char  spec[48], lm[3];
+    int   flags, width, prec, len, n;
+    long long i;
+    unsigned long long u;
+    va_list orig;
+
+    va_copy(orig, ap);
+    for(;;)
+    {
+        lit = fmt;
+        while(*fmt && '%' != *fmt)
+            fmt++;
+        if(fmt > lit)
+            _foPut(&o, lit, fmt - lit);
+        if(!*fmt)   break;
+        fmt++;
+
+        flags = 0;
+        for(;; fmt++)
+        {
+            if('-' == *fmt)         flags |= FMT_LEFT;
+            else if('+' == *fmt)    flags |= FMT_PLUS;
+            else if(' ' == *fmt)    flags |= FMT_SPACE;
+            else if('#' == *fmt)    flags |= FMT_ALT;
+            else if('0' == *fmt)    flags |= FMT_ZERO;
+            else                    break;
+        }
+        width = 0;
+        if('*' == *fmt)
+        {
+            width = va_arg(ap, int);
+            if(width < 0)
+            {
+                flags |= FMT_LEFT;
+                width = -width;
+            }
+            fmt++;
+        }
+        else
+            while(*fmt >= '0' && *fmt <= '9')
+                width = width * 10 + (*fmt++ - '0');
+        prec = -1;
+        if('.' == *fmt)
+        {
+            fmt++;
+            if('*' == *fmt)
+            {
+                prec = va_arg(ap, int);
+                if(prec < 0)    prec = -1;
+                fmt++;
+            }
+            else
+                for(prec = 0; *fmt >= '0' && *fmt <= '9'; )
+                    prec = prec * 10 + (*fmt++ - '0');
+        }
+        n = 0;
+        while(n < 2 && ('h' == *fmt || 'l' == *fmt || 'z' == *fmt || 'j' == *fmt || 't' == *fmt || 'L' == *fmt))
+            lm[n++] = *fmt++;
+        lm[n] = '\0';
+        len = !n ? FL_NONE : 2 == n ? ('h' == lm[0] && 'h' == lm[1] ? FL_HH : 'l' == lm[0] && 'l' == lm[1] ? FL_LL : FL_BAD)
+            : 'h' == lm[0] ? FL_H : 'l' == lm[0] ? FL_L : 'z' == lm[0] ? FL_Z : 'j' == lm[0] ? FL_J : 't' == lm[0] ? FL_T : FL_LD;
+
+        if(flags & FMT_LEFT)
+            flags &= ~FMT_ZERO;
+        if(flags & FMT_PLUS)
+            flags &= ~FMT_SPACE;
+
+        switch(*fmt)
+        {
+            case 'd': case 'i':
+                switch(len)
+                {
+                    case FL_NONE:   i = va_arg(ap, int);                break;
+                    case FL_HH:     i = (signed char)va_arg(ap, int);   break;
+                    case FL_H:      i = (short)va_arg(ap, int);         break;
+                    case FL_L:      i = va_arg(ap, long);               break;
+                    case FL_LL:     i = va_arg(ap, long long);          break;
+                    case FL_Z:      i = va_arg(ap, ssize_t);            break;
+                    case FL_J:      i = va_arg(ap, intmax_t);           break;
+                    case FL_T:      i = va_arg(ap, ptrdiff_t);          break;
+                    default:        goto whole;
+                }
+                _fmtInt(&o, i < 0 ? 0ULL - (unsigned long long)i : (unsigned long long)i, i < 0, 10, false, width, prec, flags);
+                break;
+
+            case 'u': case 'x': case 'X': case 'o':
+                switch(len)
+                {
+                    case FL_NONE:   u = va_arg(ap, unsigned);                   break;
+                    case FL_HH:     u = (unsigned char)va_arg(ap, unsigned);    break;
+                    case FL_H:      u = (unsigned short)va_arg(ap, unsigned);   break;
+                    case FL_L:      u = va_arg(ap, unsigned long);              break;
+                    case FL_LL:     u = va_arg(ap, unsigned long long);         break;
+                    case FL_Z:      u = va_arg(ap, size_t);                     break;
+                    case FL_J:      u = va_arg(ap, uintmax_t);                  break;
+                    case FL_T:      u = (unsigned long long)va_arg(ap, ptrdiff_t); break;
+                    default:        goto whole;
+                }
+                _fmtInt(&o, u, false, 'u' == *fmt ? 10 : 'o' == *fmt ? 8 : 16, 'X' == *fmt, width, prec, flags & ~(FMT_PLUS | FMT_SPACE));
+                break;
+
+            case 's':
+                if(len)     goto whole;         // %ls
+                s = va_arg(ap, const char*);
+                if(!s)
+                    s = prec < 0 || prec >= 6 ? "(null)" : "";
+                n = prec < 0 ? (int)strlen(s) : (int)strnlen(s, prec);
+                _foField(&o, "", 0, 0, s, n, width, flags & FMT_LEFT);
+                break;
+
+            case 'c':
+                if(len)     goto whole;         // %lc
+                spec[0] = (char)va_arg(ap, int);
+                _foField(&o, "", 0, 0, spec, 1, width, flags & FMT_LEFT);
+                break;
+
+            case 'p':
+                if(len || prec >= 0 || (flags & (FMT_PLUS | FMT_SPACE)))  goto whole;
+                u = (uintptr_t)va_arg(ap, void*);
+                if(u)
+                    _fmtInt(&o, u, false, 16, false, width, -1, (flags & (FMT_LEFT | FMT_ZERO)) | FMT_ALT);
+                else
+                    _foField(&o, "", 0, 0, "(nil)", 5, width, flags & FMT_LEFT);
+                break;
+
+            case '%':
+                _foPut(&o, "%", 1);
+                break;
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if(len && FL_L != len && FL_LD != len)
+                    goto whole;
+                if(FL_LD == len)
+                {
+                    _fmtSpec(spec, flags, width, prec, lm, *fmt);
+                    _fmtOne(&o, spec, va_arg(ap, long double));
+                }
+                else
+                {
+                    double d = va_arg(ap, double);
+                    if(!('f' == *fmt && _fmtFixed(&o, d, width, prec, flags)))
+                    {
+                        _fmtSpec(spec, flags, width, prec, lm, *fmt);
+                        _fmtOne(&o, spec, d);
+                    }
+                }
+                break;
+
+            default:                            // %n, %m, 位置参数, 未知的转换等
+                goto whole;
+        }
+        fmt++;
+    }
+    va_end(orig);
+
+    if(cap)
+        buf[o.len < o.cap ? o.len : o.cap] = '\0';
+    return o.len > INT_MAX ? -1 : (int)o.len;
+
+whole:
+    n = vsnprintf(buf, cap, start, orig);
+    va_end(orig);
+    return n;
+}
+
+/* ---------------------------- record assembly ------------------------------ */
+/* 每个线程一个记录缓冲区: 时间, 名称, 内容和换行都只格式化一次到这里,
+ * 然后对每个输出目标各调用一次 write(2), 保证并发时每条记录都是完整的一行 */
+static __thread char _rb[LOG_REC_SIZE];
+static __thread char _kb[LOG_REC_SIZE];         // 结构化记录的缓冲区, _rb 可能正存放着要作为 msg 的内容
+
+/**
+ * @brief _logBuild - 将一条记录格式化到本线程的记录缓冲区中
+ * @param out   返回记录的起始地址, 若不等于 _rb, 则是另行分配的, 用完需要 free
+ * @param name  日志名称, 可以为 NULL
+ * @param flags LR_TIME, LR_NAME, LR_COLON, LR_LINE
+ * @param text  格式串, 可以为 NULL
+ * @param ap    参数列表, text 为 NULL 时忽略
+ * @return 记录长度, 失败返回 -1
+ */
+static int _logBuild(char** out, const char* name, unsigned flags, const char* text, va_list* ap)
+{
+    char*  buf = _rb;
+    size_t cap = LOG_REC_SIZE;
+    int    len = 0, n;
+    va_list cp;
+
+    if(flags & LR_TIME)
+    {
+        const char* t = _timeStr(TS_LOG);
+        len = _tc.len;
+        memcpy(buf, t, len);
+    }
+    if((flags & LR_NAME) && name)
+    {
+        if(LR_LVOF(flags) >= 0)
+            n = snprintf(buf + len, cap - len, (flags & LR_COLON) ? "[%s] [%s] :" : "[%s] [%s] ", name, _lv_name[LR_LVOF(flags)]);
+        else
+            n = snprintf(buf + len, cap - len, (flags & LR_COLON) ? "[%s] :" : "[%s] ", name);
+        len = n < (int)(cap - len) ? len + n : (int)cap - 1;
+    }
+    if(text)
+    {
+        va_copy(cp, *ap);
+        n = _fmtV(buf + len, cap - len, text, cp);
+        va_end(cp);
+        if(n < 0)   return -1;
+        if((size_t)(len + n + 1) > cap)         // 缓冲区放不下 (包括可能添加的换行), 另行分配
+        {
+            buf = (char*)malloc(len + n + 2);
+            if(!buf)    return -1;
+            memcpy(buf, _rb, len);
+            _fmtV(buf + len, n + 1, text, *ap);
+        }
+        len += n;
+    }
+    if((flags & LR_LINE) && (0 == len || '\n' != buf[len - 1]))
+        buf[len++] = '\n';
+
+    *out = buf;
+    return len;
+}
+
+static size_t _writeAll(int fd, const char* buf, size_t len)
+{
+    size_t  done = 0;
+    ssize_t n;
+
+    while(done < len)
+    {
+        n = write(fd, buf + done, len - done);
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * @brief _logEmit - 格式化一条记录, 同步模式下写入文件 (和控制台), 异步模式下放入队列
+ * @param log   目标日志, 为 NULL 时只输出到控制台
+ * @param name  记录中附带的名称, 可以为 NULL
+ * @param flags LR_*
+ * @param text  格式串, 可以为 NULL
+ * @param ap    参数列表
+ * @return 记录的长度, 格式化失败时为 0
+ */
+static size_t _logEmit(LogPtr log, const char* name, unsigned flags, const char* text, va_list* ap)
+{
+    uint64_t t0;
+    LogHist* lat = _logBegin(log, &t0);
+    char*    rec;
+    char*    kv;
+    int      len;
+    size_t   r = 0;
+
+    if(log && log->bin)
+        r = _lbEmit(log, name, flags, text, ap);
+    else if(log && log->format != LOG_FMT_TEXT)     // 先格式化内容, 再作为 msg 组装成结构化记录
+    {
+        if((len = text ? _logBuild(&rec, NULL, 0, text, ap) : 0) >= 0)
+        {
+            if(len && '\n' == rec[len - 1])
+                len--;
+            if((len = _kvBuild(&kv, log, name, flags, text ? rec : NULL, len, NULL, 0)) > 0)
+            {
+                _logOut(log, kv, len, flags);
+                r = len;
+                if(kv != _kb)
+                    free(kv);
+            }
+            if(text && rec != _rb)
+                free(rec);
+        }
+    }
+    else if((len = _logBuild(&rec, name, flags, text, ap)) > 0)
+    {
+        if(!(log && log->dedup && text && _ldEmit(log, rec, len, flags)))
+            _logOut(log, rec, len, flags);
+        r = len;
+        if(rec != _rb)
+            free(rec);
+    }
+
+    if(lat)
+        _histAdd(lat, _statNow() - t0);
+    return r;
+}
+
+static LogHist* _logBegin(LogPtr log, uint64_t* t0)
+{
+    struct LogShard* sh;
+
+    /* 清空文件时会向系统日志写入记录, 覆盖本线程的记录缓冲区, 所以要在格式化之前处理; 延迟打开同理 */
+    if(log && __atomic_load_n(&log->lazy, __ATOMIC_ACQUIRE))
+        _logOpenLazy(log);
+    if(log && !log->queue && (log->fp || log->map))
+        _logFileShrink(log);
+
+    if(log && log->shards)
+    {
+        sh = _logShard(log);
+        __atomic_fetch_add(&sh->nrec, 1, __ATOMIC_RELAXED);
+        if(__atomic_load_n(&log->stats, __ATOMIC_ACQUIRE))
+        {
+            *t0 = _statNow();
+            return sh->add;
+        }
+    }
+    return NULL;
+}
+
+static void _logOut(LogPtr log, const char* rec, size_t len, unsigned flags)
+{
+    struct LogFlush* f = log ? log->flush : NULL;
+    bool durable = f && LR_LVOF(flags) >= __atomic_load_n(&f->level, __ATOMIC_RELAXED);
+
+    if(log && log->rec && !log->bin && !(flags & LR_BLOB))
+        _lrPut(log->rec, rec, len, flags);
+    if(log && log->sinks && !log->bin && !(flags & LR_BLOB))
+        _lsOut(log, rec, len, flags);
+    if(flags & LR_RINGONLY)                 // 低于日志级别, 只进入飞行记录器和增加的输出
+        return;
+    if(log && log->queue)
+    {
+        _lqPush(log->queue, rec, len, (flags & (LR_CONSOLE | LR_KEEP)) | (durable ? LR_SYNC : 0));
+        if(durable)                         // 等待写线程写入并同步到磁盘
+            _lqFlush(log->queue);
+    }
+    else
+    {
+        if(log && log->map)
+            _logSizeAdd(log, _lmWrite(log->map, rec, len), len);
+        else if(f && f->bytes)
+            _lfAppend(log, rec, len, durable);
+        else if(log && log->fp)
+            _logWrite(log, rec, len);
+        if(flags & LR_CONSOLE)
+            _writeAll(STDERR_FILENO, rec, len);
+        if(durable)
+            _lfSync(log);
+    }
+}
+
+/* ---------------------------- flush policy ---------------------------------- */
+/* 刷新策略 (logSetFlush):
+ * 同步模式下可以先把记录放入每个日志一个的缓冲区, 达到 bytes 字节, 或最早的记录停留超过 ms 毫秒 (由后台线程检查) 时
+ * 一次写入; 级别不低于 level 的记录会立即写入并 fdatasync, 其余记录只在后台每 syncms 毫秒 fdatasync 一次.
+ * 同步到磁盘时持有 syncmtx, 等待期间到达的请求由下一次 fdatasync 一起完成 (group commit), 所以并发的关键记录
+ * 不会各自同步一次. 异步模式下写线程本来就合并写入, 关键记录由写线程在写完这一批后同步, 调用者等待其完成;
+ * 内存映射模式下记录只是内存拷贝, 不需要缓冲.
+ */
+
+static size_t _logWritten(LogPtr log)
+{
+    return __atomic_load_n(&log->wbase, __ATOMIC_RELAXED) + __atomic_load_n(&log->cursize, __ATOMIC_RELAXED);
+}
+
+/* 写出缓冲区, 只在持有 f->mtx 时调用 */
+static void _lfWrite(LogPtr log, struct LogFlush* f)
+{
+    if(!f->len)     return;
+    if(log->fp)
+        _logWrite(log, f->buf, f->len);
+    __atomic_fetch_add(&log->nflush, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&f->len, 0, __ATOMIC_RELAXED);
+}
+
+static void _lfAppend(LogPtr log, const char* rec, size_t len, bool force)
+{
+    struct LogFlush* f = log->flush;
+
+    pthread_mutex_lock(&f->mtx);
+    if(f->len + len > f->cap)
+        _lfWrite(log, f);
+    if(len > f->cap)                        // 比缓冲区还大, 直接写入
+    {
+        if(log->fp)
+            _logWrite(log, rec, len);
+    }
+    else
+    {
+        if(!f->len)
+            __atomic_store_n(&f->first, _statNow(), __ATOMIC_RELAXED);
+        memcpy(f->buf + f->len, rec, len);
+        __atomic_store_n(&f->len, f->len + len, __ATOMIC_RELAXED);
+    }
+    if(force || f->len >= f->bytes)
+        _lfWrite(log, f);
+    pthread_mutex_unlock(&f->mtx);
+}
+
+static void _lfSync(LogPtr log)
+{
+    struct LogFlush* f = log->flush;
+    size_t want = _logWritten(log), upto;  // 调用者的记录已经写入, 包含在内
+    int    fd, slot;
+
+    if(__atomic_load_n(&f->synced, __ATOMIC_ACQUIRE) >= want)
+        return;
+
+    pthread_mutex_lock(&f->syncmtx);
+    if(__atomic_load_n(&f->synced, __ATOMIC_ACQUIRE) < want)   // 等锁期间别的线程已经同步过了, 则不必再同步
+    {
+        upto = _logWritten(log);
+        if(log->map)
+            _lmSync(log->map);
+        else
+        {
+            fd = _logPin(log, &slot);
+            if(fd >= 0)
+                fdatasync(fd);
+            _logUnpin(log, slot);
+        }
+        __atomic_store_n(&f->synced, upto, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&log->nsync, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&f->syncmtx);
+}
+
+/**
+ * @brief logSetFlush - 设置日志的刷新策略
+ * @param log
+ * @param bytes     同步模式下, 记录先放入缓冲区, 达到 bytes 字节时一次写入; 为 0 时每条记录直接写入 (默认)
+ * @param ms        缓冲的记录最多停留 ms 毫秒, 由后台线程写出; 为 0 时只按大小写入
+ * @param level     级别不低于 level 的记录 (logWarn 等) 立即写入并 fdatasync, 返回时已落盘; LOG_LV_OFF 表示不同步
+ * @param sync_ms   后台每 sync_ms 毫秒 fdatasync 一次; 为 0 时不在后台同步
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ * @note   logFlush 会写出缓冲区; 异步和内存映射模式下 bytes 和 ms 无效 (本来就合并写入或不需要写入)
+ */
+int logSetFlush(LogPtr log, size_t bytes, int ms, int level, int sync_ms)
+{
+    struct LogFlush* f;
+    char* buf;
+
+    if(!log || ms < 0 || sync_ms < 0 || level < LOG_LV_TRACE || level > LOG_LV_OFF)
+        return LOG_ERR;
+    if(log->map || log->queue)
+        bytes = 0;
+
+    if(!(f = log->flush))
+    {
+        f = (struct LogFlush*)calloc(1, sizeof(*f));
+        if(!f)  return LOG_ERR;
+        pthread_mutex_init(&f->mtx, NULL);
+        pthread_mutex_init(&f->syncmtx, NULL);
+        f->log      = log;
+        f->level    = LOG_LV_OFF;
+        f->synced   = _logWritten(log);
+        f->lastsync = _statNow();
+        __atomic_store_n(&log->flush, f, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&f->mtx);
+    _lfWrite(log, f);
+    if(bytes > f->cap)
+    {
+        if(!(buf = (char*)realloc(f->buf, bytes)))
+        {
+            pthread_mutex_unlock(&f->mtx);
+            return LOG_ERR;
+        }
+        f->buf = buf;
+        f->cap = bytes;
+    }
+    f->bytes  = bytes;
+    f->ms     = ms;
+    f->syncms = sync_ms;
+    __atomic_store_n(&f->level, level, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&f->mtx);
+
+    _svcFlushAdd(f);
+    logsysAdd(log, "set flush: %zu bytes, %d ms, level %d, sync %d ms\n", bytes, ms, level, sync_ms);
+    return LOG_OK;
+}
+
+static uint64_t _lfDue(struct LogFlush* f, uint64_t now)
+{
+    uint64_t due = UINT64_MAX, t;
+
+    if(f->bytes && f->ms)                   // 有缓冲的记录时按最早的记录计算, 否则过 ms 再检查
+    {
+        t = (__atomic_load_n(&f->len, __ATOMIC_RELAXED) ? __atomic_load_n(&f->first, __ATOMIC_RELAXED) : now)
+            + (uint64_t)f->ms * 1000000;
+        if(t < due) due = t;
+    }
+    if(f->syncms)
+    {
+        t = f->lastsync + (uint64_t)f->syncms * 1000000;
+        if(t < due) due = t;
+    }
+    return due;
+}
+
+static void _lfTick(struct LogFlush* f)
+{
+    uint64_t now = _statNow();
+
+    if(f->bytes && f->ms)
+    {
+        pthread_mutex_lock(&f->mtx);
+        if(f->len && now - f->first >= (uint64_t)f->ms * 1000000)
+            _lfWrite(f->log, f);
+        pthread_mutex_unlock(&f->mtx);
+    }
+    if(f->syncms && now - f->lastsync >= (uint64_t)f->syncms * 1000000)
+    {
+        f->lastsync = now;
+        _lfSync(f->log);
+    }
+}
+
+static void _lfDestroy(LogPtr log)
+{
+    struct LogFlush* f = log->flush;
+
+    _svcFlushDel(f);
+    pthread_mutex_lock(&f->mtx);
+    _lfWrite(log, f);
+    pthread_mutex_unlock(&f->mtx);
+    pthread_mutex_destroy(&f->mtx);
+    pthread_mutex_destroy(&f->syncmtx);
+    free(f->buf);
+    free(f);
+    log->flush = NULL;
+}
+
+/* ---------------------------- flight recorder ------------------------------ */
+/* 飞行记录器: 每个日志一个内存环形缓冲区, 记录 (已格式化的文本) 复制进去后就不再管它, 写满后覆盖最旧的.
+ * 写入只有一次 fetch_add 取得位置和一次 memcpy, 并发写入互不等待; 被覆盖的记录可能残缺, 写出时从第一个换行之后开始.
+ * 崩溃时在信号处理函数中写出, 所以写出只使用 open/write/close 等异步信号安全的调用, 路径事先生成,
+ * 已开启的记录器登记在固定大小的数组中, 信号处理函数遍历时不需要加锁 */
+#define LR_SLOTS    64                                  // 最多同时开启的飞行记录器个数
+#define LR_ALTSTACK (64 << 10)                          // 信号处理函数的备用栈大小
+
+struct LogRecorder{
+    char*    ring;                                      // 匿名映射的环形缓冲区
+    size_t   size;                                      // 缓冲区大小, 2 的幂
+    uint64_t head;                                      // 已写入的总字节数
+    int      level;                                     // 不低于此级别的分级记录 (和所有不分级的记录) 进入记录器
+    LogPtr   log;
+    char     path[PATH_MAX];                            // 写出的文件
+};
+
+static struct LogRecorder* _lr_slots[LR_SLOTS];
+static pthread_mutex_t     _lr_mtx = PTHREAD_MUTEX_INITIALIZER;    // 保护登记和注销, 信号处理函数只读
+static const int           _lr_signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+static struct sigaction    _lr_old[sizeof(_lr_signals) / sizeof(_lr_signals[0])];
+static bool                _lr_handler = false;
+static char*               _lr_altstack = NULL;                     // 栈溢出时信号处理函数使用的备用栈
+
+static void _lrPut(struct LogRecorder* r, const char* rec, size_t len, unsigned flags)
+{
+    uint64_t pos;
+    size_t   idx, first;
+    int      lv = LR_LVOF(flags);
+
+    if(lv >= 0 && lv < r->level)
+        return;
+    if(len > r->size)                       // 只保留最后的部分
+    {
+        rec += len - r->size;
+        len  = r->size;
+    }
+    pos   = __atomic_fetch_add(&r->head, len, __ATOMIC_RELAXED);
+    idx   = pos & (r->size - 1);
+    first = len < r->size - idx ? len : r->size - idx;
+    memcpy(r->ring + idx, rec, first);
+    memcpy(r->ring, rec + first, len - first);
+}
+
+static void _lrLevel(LogPtr log)
+{
+    struct LogSink* k;
+    int lv = __atomic_load_n(&log->filelevel, __ATOMIC_RELAXED);
+
+    if(log->rec && log->rec->level < lv)
+        lv = log->rec->level;
+    for(k = __atomic_load_n(&log->sinks, __ATOMIC_ACQUIRE); k; k = k->next)
+        if(k->level < lv)
+            lv = k->level;
+    __atomic_store_n(&log->level, lv, __ATOMIC_RELAXED);
+}
+
+/* 异步信号安全地写出字符串 */
+static void _lrPuts(int fd, const char* s)
+{
+    size_t n = 0;
+
+    while(s[n])
+        n++;
+    _writeAll(fd, s, n);
+}
+
+/**
+ * @brief _lrDump - 将记录器中的内容写入 path, 可以在信号处理函数中调用
+ * @param sig   引起写出的信号, 为 0 表示主动写出
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ */
+static int _lrDump(struct LogRecorder* r, const char* path, int sig)
+{
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), start;
+    size_t   idx, n;
+    char     num[24];
+    int      fd;
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return LOG_ERR;
+
+    _lrPuts(fd, "----- flight recorder: ");
+    _lrPuts(fd, r->log->name ? r->log->name : r->log->path);
+    if(sig)
+    {
+        _lrPuts(fd, ", signal ");
+        num[sizeof(num) - 1] = '\0';
+        _lrPuts(fd, _fmtDec(num + sizeof(num) - 1, (unsigned)sig));
+    }
+    _lrPuts(fd, " -----\n");
+
+    start = head > r->size ? head - r->size : 0;
+    if(start)                               // 最旧的记录可能已被部分覆盖, 从下一个换行之后开始
+    {
+        while(start < head && '\n' != r->ring[start & (r->size - 1)])
+            start++;
+        start++;
+    }
+    while(start < head)
+    {
+        idx = start & (r->size - 1);
+        n   = head - start < r->size - idx ? head - start : r->size - idx;
+        _writeAll(fd, r->ring + idx, n);
+        start += n;
+    }
+    close(fd);
+    return LOG_OK;
+}
+
+static void _lrSignal(int sig, siginfo_t* si, void* uc)
+{
+    size_t i;
+    struct LogRecorder* r;
+
+    (void)si;
+    (void)uc;
+    for(i = 0; i < LR_SLOTS; i++)
+        if((r = __atomic_load_n(&_lr_slots[i], __ATOMIC_ACQUIRE)))
+            _lrDump(r, r->path, sig);
+
+    for(i = 0; i < sizeof(_lr_signals) / sizeof(_lr_signals[0]); i++)  // 恢复原来的处理方式, 再次引发信号
+        if(_lr_signals[i] == sig)
+            sigaction(sig, &_lr_old[i], NULL);
+    raise(sig);
+}
+
+/**
+ * @brief logSetRecorder - 开启/关闭日志的飞行记录器
+ * @param log
+ * @param size_mb   环形缓冲区大小, 单位为 MB, 向上取整为 2 的幂; 为 0 时关闭
+ * @param level     不低于此级别的分级记录进入记录器, 可以低于日志级别 (只进入记录器, 不写入文件); 不分级的记录总是进入
+ * @param dump_path 写出的文件, 为 NULL 时为 "<日志文件路径>.crash"
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ * @note  二进制模式的记录不进入记录器; 需在没有其它线程写此日志时调用
+ */
+int logSetRecorder(LogPtr log, size_t size_mb, int level, const char* dump_path)
+{
+    struct LogRecorder* r;
+    size_t size = 1;
+    int    i;
+
+    if(!log || level < LOG_LV_TRACE || level > LOG_LV_OFF)
+        return LOG_ERR;
+
+    if((r = log->rec))                      // 先关闭原来的
+    {
+        pthread_mutex_lock(&_lr_mtx);
+        for(i = 0; i < LR_SLOTS; i++)
+            if(_lr_slots[i] == r)
+                __atomic_store_n(&_lr_slots[i], NULL, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&_lr_mtx);
+        log->rec = NULL;
+        _lrLevel(log);
+        munmap(r->ring, r->size);
+        free(r);
+    }
+    if(!size_mb)
+        return LOG_OK;
+
+    while(size < size_mb)
+        size <<= 1;
+    if(!(r = (struct LogRecorder*)calloc(1, sizeof(*r))))
+        return LOG_ERR;
+    r->size  = size << 20;
+    r->level = level;
+    r->log   = log;
+    if(dump_path)
+        snprintf(r->path, sizeof(r->path), "%s", dump_path);
+    else
+        snprintf(r->path, sizeof(r->path), "%s.crash", log->path);
+    if(MAP_FAILED == (r->ring = (char*)mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)))
+    {
+        free(r);
+        return LOG_ERR;
+    }
+
+    pthread_mutex_lock(&_lr_mtx);
+    for(i = 0; i < LR_SLOTS && _lr_slots[i]; i++)
+        ;
+    if(i < LR_SLOTS)
+        __atomic_store_n(&_lr_slots[i], r, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&_lr_mtx);
+    if(i == LR_SLOTS)
+        logsysAdd(log, "%s(%d)-[recorder]: too many recorders, not dumped on crash\n", __FILE__, __LINE__);
+
+    log->rec = r;
+    _lrLevel(log);
+    logsysAdd(log, "set recorder: %zu MB, level %s, dump to \"%s\"\n", size, level == LOG_LV_OFF ? "OFF" : _lv_name[level], r->path);
+    return LOG_OK;
+}
+
+/**
+ * @brief logDumpRecorder - 将飞行记录器中的记录写入文件
+ * @param log
+ * @param path  为 NULL 时写入 logSetRecorder 指定的文件
+ * @return 成功返回 LOG_OK, 失败 (或没有开启记录器) 返回 LOG_ERR
+ */
+int logDumpRecorder(LogPtr log, const char* path)
+{
+    if(!log || !log->rec)   return LOG_ERR;
+    return _lrDump(log->rec, path ? path : log->rec->path, 0);
+}
+
+/**
+ * @brief logSetCrashHandler - 安装/卸载崩溃信号的处理函数
+ * 收到 SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL 时写出所有飞行记录器, 然后恢复原来的处理方式并再次引发信号
+ * @param on
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ * @note  备用栈 (用于栈溢出) 只对调用此函数的线程有效
+ */
+int logSetCrashHandler(bool on)
+{
+    struct sigaction sa;
+    stack_t st;
+    size_t  i;
+
+    pthread_mutex_lock(&_lr_mtx);
+    if(on && !_lr_handler)
+    {
+        if(!_lr_altstack && (_lr_altstack = (char*)malloc(LR_ALTSTACK)))
+        {
+            st.ss_sp    = _lr_altstack;
+            st.ss_size  = LR_ALTSTACK;
+            st.ss_flags = 0;
+            sigaltstack(&st, NULL);
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = _lrSignal;
+        sa.sa_flags     = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        for(i = 0; i < sizeof(_lr_signals) / sizeof(_lr_signals[0]); i++)
+            sigaction(_lr_signals[i], &sa, &_lr_old[i]);
+        _lr_handler = true;
+    }
+    else if(!on && _lr_handler)
+    {
+        for(i = 0; i < sizeof(_lr_signals) / sizeof(_lr_signals[0]); i++)
+            sigaction(_lr_signals[i], &_lr_old[i], NULL);
+        _lr_handler = false;
+    }
+    pthread_mutex_unlock(&_lr_mtx);
+    return LOG_OK;
+}
+
+/* ---------------------------- structured records ----------------------------- */
+/* 结构化记录: 字段按类型直接写入本线程的 _kb 缓冲区 (整数自行转换, 字符串只做转义), 不经过 printf 格式串解析;
+ * 放不下时改为动态分配. 字符串转义先用 SSE2 一次检查 16 个字节, 没有需要转义的字符时整段拷贝 */
+typedef struct KvBuf{
+    char*  p;
+    size_t len, cap;
+    bool   err;                                 // 分配失败, 丢弃这条记录
+}KvBuf;
+
+static bool _kbGrow(KvBuf* b, size_t need)
+{
+    size_t cap;
+    char*  p;
+
+    if(b->len + need <= b->cap)     return true;
+    if(b->err)                      return false;
+    for(cap = b->cap * 2; cap < b->len + need; cap *= 2)
+        ;
+    p = (char*)(b->p == _kb ? malloc(cap) : realloc(b->p, cap));
+    if(!p)
+    {
+        b->err = true;
+        return false;
+    }
+    if(b->p == _kb)
+        memcpy(p, _kb, b->len);
+    b->p   = p;
+    b->cap = cap;
+    return true;
+}
+
+static void _kbPut(KvBuf* b, const char* s, size_t n)
+{
+    if(!_kbGrow(b, n))  return;
+    memcpy(b->p + b->len, s, n);
+    b->len += n;
+}
+
+#define _kbStr(b, s)    _kbPut((b), (s), strlen(s))
+
+/* 返回 s 中第一个需要转义 (JSON) 的字符的位置, logfmt 为 true 时空格和 '=' 也算 (值需要加引号), 没有则返回 n */
+static size_t _kvScan(const char* s, size_t n, bool logfmt)
+{
+    size_t i = 0;
+    unsigned char c;
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\'), ctrl = _mm_set1_epi8(0x1f);
+    const __m128i space = _mm_set1_epi8(' '), equal = _mm_set1_epi8('=');
+    __m128i v, m;
+    int mask;
+
+    for(; i + 16 <= n; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)(s + i));
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));     // 无符号 v <= 0x1f
+        if(logfmt)
+            m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, equal)));
+        if((mask = _mm_movemask_epi8(m)))
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for(; i < n; i++)
+    {
+        c = (unsigned char)s[i];
+        if(c < 0x20 || '"' == c || '\\' == c || (logfmt && (' ' == c || '=' == c)))
+            return i;
+    }
+    return n;
+}
+
+/* 按 JSON 字符串的规则转义 s 写入 b, 不包括两边的引号 */
+static void _kbEsc(KvBuf* b, const char* s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    char   e[6] = {'\\', 'u', '0', '0'};
+    size_t k;
+
+    for(;;)
+    {
+        k = _kvScan(s, n, false);
+        _kbPut(b, s, k);
+        if(k == n)  break;
+        switch(s[k])
+        {
+            case '"':   _kbPut(b, "\\\"", 2);  break;
+            case '\\':  _kbPut(b, "\\\\", 2);  break;
+            case '\n':  _kbPut(b, "\\n", 2);   break;
+            case '\r':  _kbPut(b, "\\r", 2);   break;
+            case '\t':  _kbPut(b, "\\t", 2);   break;
+            default:
+                e[4] = hex[(unsigned char)s[k] >> 4];
+                e[5] = hex[s[k] & 0xf];
+                _kbPut(b, e, 6);
+        }
+        s += k + 1;
+        n -= k + 1;
+    }
+}
+
+/* 字符串值: JSON 中总是加引号; logfmt 和文本格式中只在含有空格, '=', 引号或控制字符 (或为空) 时加引号 */
+static void _kbQuote(KvBuf* b, const char* s, size_t n, int format)
+{
+    if(LOG_FMT_JSON != format && n && _kvScan(s, n, true) == n)
+    {
+        _kbPut(b, s, n);
+        return;
+    }
+    _kbPut(b, "\"", 1);
+    _kbEsc(b, s, n);
+    _kbPut(b, "\"", 1);
+}
+
+static void _kbUint(KvBuf* b, unsigned long long v, bool neg)
+{
+    char  d[24];
+    char* p = d + sizeof(d);
+
+    do{
+        *--p = '0' + v % 10;
+        v /= 10;
+    }while(v);
+    if(neg)
+        *--p = '-';
+    _kbPut(b, p, d + sizeof(d) - p);
+}
+
+static void _kbDbl(KvBuf* b, double v, int format)
+{
+    char d[32];
+    int  n;
+
+    if(!__builtin_isfinite(v))              // JSON 中没有 NaN 和无穷大
+    {
+        _kbStr(b, LOG_FMT_JSON == format ? "null" : __builtin_isnan(v) ? "NaN" : v > 0 ? "+Inf" : "-Inf");
+        return;
+    }
+    n = snprintf(d, sizeof(d), "%.15g", v);
+    if(strtod(d, NULL) != v)                // 15 位有效数字不能还原时用 17 位
+        n = snprintf(d, sizeof(d), "%.17g", v);
+    _kbPut(b, d, n);
+}
+
+static void _kbField(KvBuf* b, const LogField* f, int format)
+{
+    switch(f->type)
+    {
+        case LOG_KV_INT:
+            _kbUint(b, f->v.i < 0 ? 0ULL - (unsigned long long)f->v.i : (unsigned long long)f->v.i, f->v.i < 0);
+            break;
+        case LOG_KV_UINT:
+            _kbUint(b, f->v.u, false);
+            break;
+        case LOG_KV_DBL:
+            _kbDbl(b, f->v.d, format);
+            break;
+        case LOG_KV_BOOL:
+            _kbStr(b, f->v.i ? "true" : "false");
+            break;
+        default:
+            if(f->v.s)
+                _kbQuote(b, f->v.s, strlen(f->v.s), format);
+            else if(LOG_FMT_JSON == format)
+                _kbStr(b, "null");
+            else
+                _kbPut(b, "\"\"", 2);
+    }
+}
+
+/* 写入 "key":  或  key= , 第一个字段之前不加分隔符 */
+static void _kbKey(KvBuf* b, const char* key, int format, bool first)
+{
+    if(LOG_FMT_JSON == format)
+    {
+        _kbPut(b, first ? "\"" : ",\"", first ? 1 : 2);
+        _kbStr(b, key);
+        _kbPut(b, "\":", 2);
+    }
+    else
+    {
+        if(!first)
+            _kbPut(b, " ", 1);
+        _kbStr(b, key);
+        _kbPut(b, "=", 1);
+    }
+}
+
+/**
+ * @brief _kvBuild - 按日志的记录格式组装一条结构化记录
+ * @param out   返回记录的起始地址, 若不等于 _kb, 则是另行分配的, 用完需要 free
+ * @param flags LR_TIME, LR_NAME 和 LR_LEVEL 决定是否包含时间, 名称和级别
+ * @param msg   消息, 可以为 NULL
+ * @param f     字段, n 为字段个数
+ * @return 记录长度 (以换行结尾), 失败返回 -1
+ */
+static int _kvBuild(char** out, LogPtr log, const char* name, unsigned flags, const char* msg, size_t mlen,
+                    const LogField* f, int n)
+{
+    KvBuf b = {_kb, 0, LOG_REC_SIZE, false};
+    int   format = log->format, lv = LR_LVOF(flags), i;
+    bool  first = true;
+    const char* t;
+
+    if(LOG_FMT_TEXT == format)              // 与 logAdd 的记录相同的前缀, 字段以 logfmt 的形式跟在 msg 后面
+    {
+        if(flags & LR_TIME)
+            _kbPut(&b, _timeStr(TS_LOG), _tc.len);
+        if((flags & LR_NAME) && name)
+        {
+            _kbPut(&b, "[", 1);
+            _kbStr(&b, name);
+            _kbPut(&b, "] ", 2);
+        }
+        if(lv >= 0)
+        {
+            _kbPut(&b, "[", 1);
+            _kbStr(&b, _lv_name[lv]);
+            _kbPut(&b, "] ", 2);
+        }
+        _kbPut(&b, ":", 1);
+        if(msg)
+            _kbPut(&b, msg, mlen);
+        first = !msg || !mlen;
+    }
+    else
+    {
+        if(LOG_FMT_JSON == format)
+            _kbPut(&b, "{", 1);
+        if(flags & LR_TIME)                 // 去掉时间两边的 "[" 和 "] "
+        {
+            t = _timeStr(TS_LOG);
+            _kbKey(&b, "ts", format, first);
+            _kbPut(&b, "\"", 1);
+            _kbPut(&b, t + 1, _tc.len - 3);
+            _kbPut(&b, "\"", 1);
+            first = false;
+        }
+        if((flags & LR_NAME) && name)
+        {
+            _kbKey(&b, "name", format, first);
+            _kbQuote(&b, name, strlen(name), format);
+            first = false;
+        }
+        if(lv >= 0)
+        {
+            _kbKey(&b, "level", format, first);
+            _kbQuote(&b, _lv_name[lv], strlen(_lv_name[lv]), format);
+            first = false;
+        }
+        if(msg)
+        {
+            _kbKey(&b, "msg", format, first);
+            _kbQuote(&b, msg, mlen, format);
+            first = false;
+        }
+    }
+
+    for(i = 0; i < n; i++)
+    {
+        _kbKey(&b, f[i].key ? f[i].key : "", LOG_FMT_TEXT == format ? LOG_FMT_LOGFMT : format, first);
+        _kbField(&b, &f[i], format);
+        first = false;
+    }
+    if(LOG_FMT_JSON == format)
+        _kbPut(&b, "}", 1);
+    _kbPut(&b, "\n", 1);
+
+    if(b.err)
+    {
+        if(b.p != _kb)
+            free(b.p);
+        return -1;
+    }
+    *out = b.p;
+    return (int)b.len;
+}
+
+/**
+ * @brief logAddKVn - 添加一条结构化记录, 一般通过 logAddKV 宏使用
+ * @param log
+ * @param level     LOG_LV_TRACE ~ LOG_LV_FATAL, 低于日志级别时直接返回
+ * @param msg       消息, 可以为 NULL
+ * @param fields    字段数组, n 为字段个数
+ * @note  与 logAdd 写入同一个文件, 遵循同样的大小限制和轮转; 二进制模式下按文本格式组装后保存
+ */
+void logAddKVn(LogPtr log, int level, const char* msg, const LogField* fields, int n)
+{
+    unsigned flags;
+    uint64_t t0;
+    LogHist* lat;
+    char*    rec;
+    int      len, format;
+
+    if(!log || n < 0 || (n && !fields))   return;
+    if(level < __atomic_load_n(&log->level, __ATOMIC_RELAXED) || level < LOG_LV_TRACE || level > LOG_LV_FATAL)
+        return;
+
+    flags = _logLvFlags(log, level);
+    lat   = _logBegin(log, &t0);
+    if(log->bin)                            // 二进制模式下只组装 msg 和字段, 时间, 名称和级别由记录本身保存
+    {
+        format = log->format;
+        log->format = LOG_FMT_TEXT;
+        len = _kvBuild(&rec, log, NULL, 0, msg, msg ? strlen(msg) : 0, fields, n);
+        log->format = format;
+        if(len > 0)
+        {
+            rec[len - 1] = '\0';
+            _lbEmitStr(log, log->name, flags, "%s", rec + 1);   // 去掉开头的 ":"
+        }
+    }
+    else if((len = _kvBuild(&rec, log, log->name, flags, msg, msg ? strlen(msg) : 0, fields, n)) > 0)
+        _logOut(log, rec, len, flags);
+    if(len > 0 && rec != _kb)
+        free(rec);
+
+    if(lat)
+        _histAdd(lat, _statNow() - t0);
+}
+
+/**
+ * @brief logSetFormat - 设置日志的记录格式
+ * @param log
+ * @param format    LOG_FMT_TEXT, LOG_FMT_JSON, LOG_FMT_LOGFMT
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ * @note  二进制模式下记录由 logDecode 还原为文本, 此设置无效
+ */
+int logSetFormat(LogPtr log, int format)
+{
+    if(!log || format < LOG_FMT_TEXT || format > LOG_FMT_LOGFMT)
+        return LOG_ERR;
+    __atomic_store_n(&log->format, format, __ATOMIC_RELAXED);
+    return LOG_OK;
+}
+
+/* ---------------------------- storm control -------------------------------- */
+/* 日志风暴控制: 下游故障时同一个调用处可能每秒产生上百万条相同的记录, 很快写满文件.
+ * 调用处的统计和开关 (logAt, logSiteEnable) 也在这里, 与限流/采样共用调用处链表.
+ * 限流和采样按调用处 (宏中的静态 LogSite) 在格式化之前判断, 被丢弃的调用只有一次读取时钟和一次 CAS;
+ * 去重按日志在格式化之后判断 (需要比较内容), 省下的是写入. 丢弃的条数在恢复写入时报告, 并计入 nsupp */
+static LogSite* _site_list = NULL;              // 调用过的调用处链表, 只增不减 (LogSite 都是静态变量)
+
+struct LogDedup{
+    pthread_mutex_t mtx;
+    char*    last;                              // 上一条记录去掉时间后的内容
+    size_t   len, cap;
+    size_t   repeat;                            // 之后又重复了多少次, 尚未报告
+};
+
+/* 第一次调用时加入调用处链表, 返回是否由本次调用加入 */
+static bool _siteList(LogSite* s, const char* fmt)
+{
+    if(__atomic_load_n(&s->listed, __ATOMIC_RELAXED) || __atomic_exchange_n(&s->listed, 1, __ATOMIC_ACQ_REL))
+        return false;
+    s->fmt  = fmt;
+    s->t0   = _statNow();
+    s->next = __atomic_load_n(&_site_list, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&_site_list, &s->next, s, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return true;
+}
+
+/* 计数一次调用, 返回之前的调用次数 */
+static size_t _siteHit(LogSite* s)
+{
+    size_t hit = __atomic_fetch_add(&s->hits, 1, __ATOMIC_RELAXED);
+
+    _siteList(s, NULL);
+    return hit;
+}
+
+static bool _siteDrop(LogSite* s, LogPtr log)
+{
+    __atomic_fetch_add(&s->suppressed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->pending, 1, __ATOMIC_RELAXED);
+    if(log)
+        __atomic_fetch_add(&log->nsupp, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+static bool _sitePass(LogSite* s, LogPtr log)
+{
+    size_t n;
+
+    if(__atomic_load_n(&s->pending, __ATOMIC_RELAXED) && (n = __atomic_exchange_n(&s->pending, 0, __ATOMIC_RELAXED)))
+        logAdd(log, "%s(%d): %zu similar records suppressed\n", s->file ? s->file : "?", s->line, n);
+    return true;
+}
+
+/**
+ * @brief logSiteRate - 调用处的令牌桶限流 (GCRA), 一般通过 logRateOn / logAddRate 使用
+ * @param s         调用处的静态状态
+ * @param log       丢弃时计入此日志的 suppressed 计数, 恢复时向其报告, 可以为 NULL
+ * @param per_sec   平均每秒允许的条数, 不大于 0 时全部丢弃
+ * @param burst     最多允许连续的条数
+ * @return 是否应写入
+ */
+bool logSiteRate(LogSite* s, LogPtr log, double per_sec, int burst)
+{
+    uint64_t now, tat, ntat, step, tol;
+
+    _siteHit(s);
+    if(per_sec <= 0)
+        return _siteDrop(s, log);
+
+    step = (uint64_t)(1e9 / per_sec);
+    tol  = step * (burst > 1 ? burst - 1 : 0);
+    now  = _statNow();
+    tat  = __atomic_load_n(&s->tat, __ATOMIC_RELAXED);
+    do{
+        if(tat > now + tol)
+            return _siteDrop(s, log);
+        ntat = (tat > now ? tat : now) + step;
+    }while(!__atomic_compare_exchange_n(&s->tat, &tat, ntat, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return _sitePass(s, log);
+}
+
+/**
+ * @brief logSiteSample - 调用处的采样, 每 n 次调用写入一次, 一般通过 logSampleOn / logAddSample 使用
+ * @param n     采样间隔, 不大于 1 时全部写入
+ * @return 是否应写入
+ */
+bool logSiteSample(LogSite* s, LogPtr log, unsigned n)
+{
+    if(_siteHit(s) % (n > 1 ? n : 1))
+        return _siteDrop(s, log);
+    return _sitePass(s, log);
+}
+
+/**
+ * @brief logSiteDump - 输出有丢弃记录的调用处
+ * @param out
+ */
+void logSiteDump(FILE* out)
+{
+    LogSite* s;
+    size_t   n;
+
+    if(!out)    return;
+    for(s = __atomic_load_n(&_site_list, __ATOMIC_ACQUIRE); s; s = s->next)
+        if((n = __atomic_load_n(&s->suppressed, __ATOMIC_RELAXED)))
+            fprintf(out, "%s(%d): hits %zu, suppressed %zu\n", s->file ? s->file : "?", s->line,
+                    __atomic_load_n(&s->hits, __ATOMIC_RELAXED), n);
+}
+
+/* 调用处统计: logAt / logAtLevel 的调用处第一次写入时登记 (记下格式串), 之后每条记录累加记录数和字节数;
+ * 开关 off 在宏中判断, 关闭的调用处不求值参数. logSiteEnable 的规则会保存下来, 之后登记的调用处也按规则设置开关,
+ * 所以可以在启动时就关闭还没有执行过的调用处. 规则的修改和新调用处应用规则都持有 _site_mtx, 不会漏掉. */
+#define LOG_SITE_RULES  64                      // 最多保存的规则数
+
+typedef struct SiteRule{
+    char spec[128];
+    bool on;
+}SiteRule;
+
+static SiteRule        _site_rules[LOG_SITE_RULES];
+static int             _site_nrule = 0;
+static pthread_mutex_t _site_mtx   = PTHREAD_MUTEX_INITIALIZER;
+
+/* spec 为函数名, "file" 或 "file:line", file 需与调用处文件路径的最后若干级相同 */
+static bool _siteMatch(const LogSite* s, const char* spec)
+{
+    const char* colon = strrchr(spec, ':');
+    size_t flen = colon ? (size_t)(colon - spec) : strlen(spec);
+    size_t slen;
+
+    if(!colon && s->func && 0 == strcmp(s->func, spec))
+        return true;
+    if(!s->file || (slen = strlen(s->file)) < flen || memcmp(s->file + slen - flen, spec, flen))
+        return false;
+    if(slen > flen && '/' != s->file[slen - flen - 1])
+        return false;
+    return !colon || atoi(colon + 1) == s->line;
+}
+
+/* 登记调用处, 并按已有的规则设置开关 */
+static void _siteReg(LogSite* s, const char* fmt)
+{
+    int i;
+
+    if(!_siteList(s, fmt))
+        return;
+    pthread_mutex_lock(&_site_mtx);
+    for(i = 0; i < _site_nrule; i++)
+        if(_siteMatch(s, _site_rules[i].spec))
+            __atomic_store_n(&s->off, !_site_rules[i].on, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&_site_mtx);
+}
+
+/**
+ * @brief logSiteAdd - 通过调用处添加一条记录, 并计入调用处的记录数和字节数, 一般通过 logAt / logAtLevel 使用
+ * @param s     调用处的静态状态
+ * @param level 级别, 小于 0 时为不分级的记录 (同 logAdd)
+ * @param text  格式串
+ */
+void logSiteAdd(LogSite* s, LogPtr log, int level, const char* text, ...)
+{
+    unsigned flags;
+    size_t   n;
+    va_list  argptr;
+
+    if(!s || !log || !text || !(*text))   return;
+    if(!__atomic_load_n(&s->listed, __ATOMIC_RELAXED))
+    {
+        _siteReg(s, text);
+        if(__atomic_load_n(&s->off, __ATOMIC_RELAXED))     // 规则关闭了此调用处
+            return;
+    }
+    if(level < 0)
+        flags = log->mutetype ? LR_RECORD : LR_RECORD | LR_CONSOLE;
+    else if(level < __atomic_load_n(&log->level, __ATOMIC_RELAXED) || level > LOG_LV_FATAL)
+        return;
+    else
+        flags = _logLvFlags(log, level);
+
+    va_start(argptr, text);
+    n = _logEmit(log, log->name, flags, text, &argptr);
+    va_end(argptr);
+    __atomic_fetch_add(&s->nrec, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->nbytes, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief logSiteEnable - 打开/关闭匹配的调用处
+ * @param spec  函数名, "file.c" 或 "file.c:line"; 文件名与调用处 __FILE__ 的结尾比较, 如 "net.c" 匹配 "src/net.c"
+ * @param on
+ * @return 已登记的调用处中匹配的个数, 规则已满时返回 LOG_ERR
+ * @note  规则会保存下来, 之后第一次执行的调用处也按规则设置; 同一调用处匹配多条规则时以最后一条为准
+ */
+int logSiteEnable(const char* spec, bool on)
+{
+    LogSite* s;
+    int i, n = 0;
+
+    if(!spec || !*spec) return LOG_ERR;
+    pthread_mutex_lock(&_site_mtx);
+    for(i = 0; i < _site_nrule && strcmp(_site_rules[i].spec, spec); i++)
+        ;
+    if(i < _site_nrule)                     // 同样的规则只保留最后一次, 移到末尾
+        memmove(&_site_rules[i], &_site_rules[i + 1], (--_site_nrule - i) * sizeof(SiteRule));
+    if(_site_nrule == LOG_SITE_RULES)
+    {
+        pthread_mutex_unlock(&_site_mtx);
+        return LOG_ERR;
+    }
+    snprintf(_site_rules[_site_nrule].spec, sizeof(_site_rules[0].spec), "%s", spec);
+    _site_rules[_site_nrule++].on = on;
+    for(s = __atomic_load_n(&_site_list, __ATOMIC_ACQUIRE); s; s = s->next)
+    {
+        if(_siteMatch(s, spec))
+        {
+            __atomic_store_n(&s->off, !on, __ATOMIC_RELAXED);
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&_site_mtx);
+    return n;
+}
+
+/**
+ * @brief logSiteTop - 按登记 (或 logSiteReset) 以来每秒写入的字节数从大到小取前 n 个调用处
+ * @param out   至少 n 个元素
+ * @return 取到的个数
+ */
+int logSiteTop(LogSiteStat* out, int n)
+{
+    LogSiteStat st;
+    LogSite* s;
+    uint64_t now = _statNow(), t0;
+    int cnt = 0, i;
+
+    if(!out || n <= 0)  return 0;
+    for(s = __atomic_load_n(&_site_list, __ATOMIC_ACQUIRE); s; s = s->next)
+    {
+        if(!(st.records = __atomic_load_n(&s->nrec, __ATOMIC_RELAXED)))
+            continue;                       // 只限流/采样的调用处, 或没有写入过
+        st.site   = s;
+        st.bytes  = __atomic_load_n(&s->nbytes, __ATOMIC_RELAXED);
+        t0        = __atomic_load_n(&s->t0, __ATOMIC_RELAXED);
+        st.bytes_per_sec = st.bytes * 1e9 / (now > t0 + 1000000 ? now - t0 : 1000000);    // 至少按 1 毫秒计算
+        for(i = cnt < n ? cnt++ : n; i > 0 && out[i - 1].bytes_per_sec < st.bytes_per_sec; i--)
+            if(i < n)
+                out[i] = out[i - 1];
+        if(i < n)
+            out[i] = st;
+    }
+    return cnt;
+}
+
+/**
+ * @brief logSiteTopDump - 输出每秒写入字节数最多的 n 个调用处, 关闭的调用处标有 [off]
+ * @param out
+ * @param n
+ */
+void logSiteTopDump(FILE* out, int n)
+{
+    LogSiteStat* st;
+    const char*  fmt;
+    int i, cnt, flen;
+
+    if(!out || n <= 0 || !(st = (LogSiteStat*)malloc(n * sizeof(LogSiteStat))))
+        return;
+    cnt = logSiteTop(st, n);
+    for(i = 0; i < cnt; i++)
+    {
+        fmt  = st[i].site->fmt ? st[i].site->fmt : "";
+        flen = strcspn(fmt, "\n");         // 格式串只输出第一行
+        fprintf(out, "%12.0f B/s %12zu B %10zu rec  %s:%d %s() \"%.*s\"%s\n", st[i].bytes_per_sec, st[i].bytes, st[i].records,
+                st[i].site->file ? st[i].site->file : "?", st[i].site->line, st[i].site->func ? st[i].site->func : "?",
+                flen, fmt, __atomic_load_n(&st[i].site->off, __ATOMIC_RELAXED) ? " [off]" : "");
+    }
+    free(st);
+}
+
+/**
+ * @brief logSiteReset - 清零所有调用处的记录数和字节数, 从现在开始重新计算速率
+ */
+void logSiteReset()
+{
+    LogSite* s;
+    uint64_t now = _statNow();
+
+    for(s = __atomic_load_n(&_site_list, __ATOMIC_ACQUIRE); s; s = s->next)
+    {
+        __atomic_store_n(&s->nrec, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->nbytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->t0, now, __ATOMIC_RELAXED);
+    }
+}
+
+/* 写入 "last message repeated N times", 只在持有 d->mtx 时调用 */
+static void _ldRepeat(LogPtr log, struct LogDedup* d)
+{
+    char buf[128];
+    int  n;
+
+    if(!d->repeat)  return;
+    n = snprintf(buf, sizeof(buf), "%s%s%s%slast message repeated %zu times\n", _timeStr(TS_LOG),
+                 log->name ? "[" : "", log->name ? log->name : "", log->name ? "] :" : "", d->repeat);
+    if(n > (int)sizeof(buf) - 1)
+        n = sizeof(buf) - 1;
+    d->repeat = 0;
+    _logOut(log, buf, n, log->mutetype ? 0 : LR_CONSOLE);
+}
+
+static bool _ldEmit(LogPtr log, const char* rec, size_t len, unsigned flags)
+{
+    struct LogDedup* d = log->dedup;
+    size_t skip = (flags & LR_TIME) ? (size_t)_tc.len : 0;     // 比较时不包括时间
+    char*  p;
+
+    if(len < skip)  return false;
+    rec += skip;
+    len -= skip;
+
+    pthread_mutex_lock(&d->mtx);
+    if(len == d->len && 0 == memcmp(rec, d->last, len))
+    {
+        d->repeat++;
+        pthread_mutex_unlock(&d->mtx);
+        __atomic_fetch_add(&log->nsupp, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    _ldRepeat(log, d);
+    if(len > d->cap && (p = (char*)realloc(d->last, len)))
+    {
+        d->last = p;
+        d->cap  = len;
+    }
+    if(len <= d->cap)
+    {
+        memcpy(d->last, rec, len);
+        d->len = len;
+    }
+    else
+        d->len = 0;
+    _logOut(log, rec - skip, len + skip, flags);        // 持有锁写入, 保证报告在下一条记录之前
+    pthread_mutex_unlock(&d->mtx);
+    return true;
+}
+
+static void _ldFlush(LogPtr log)
+{
+    pthread_mutex_lock(&log->dedup->mtx);
+    _ldRepeat(log, log->dedup);
+    pthread_mutex_unlock(&log->dedup->mtx);
+}
+
+/**
+ * @brief logSetDedup - 开启/关闭合并连续重复的记录
+ * 与上一条记录的内容 (不包括时间) 相同的记录只计数, 直到出现不同的记录, logFlush 或关闭时
+ * 写入一条 "last message repeated N times"
+ * @param log
+ * @param on
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ * @note  需在没有其它线程写此日志时调用; 二进制模式下不格式化记录, 无法去重
+ */
+int logSetDedup(LogPtr log, bool on)
+{
+    struct LogDedup* d;
+
+    if(!log)    return LOG_ERR;
+    if(on && !log->dedup)
+    {
+        if(!(d = (struct LogDedup*)calloc(1, sizeof(*d))))
+            return LOG_ERR;
+        if((d->last = (char*)malloc(LOG_REC_SIZE)))   // 一般的记录不超过 LOG_REC_SIZE, 比较时不必再分配
+            d->cap = LOG_REC_SIZE;
+        pthread_mutex_init(&d->mtx, NULL);
+        log->dedup = d;
+    }
+    else if(!on && (d = log->dedup))
+    {
+        _ldFlush(log);
+        log->dedup = NULL;
+        pthread_mutex_destroy(&d->mtx);
+        free(d->last);
+        free(d);
+    }
+    return LOG_OK;
+}
+
+/* ---------------------------- binary mode ----------------------------------- */
+/* 二进制模式 (延迟格式化):
+ * 添加日志时不调用 vfprintf, 只记录格式串编号, 时间和原始参数 (字符串会被拷贝), 由 logDecode 离线还原为文本.
+ * 格式串以其地址为键登记一次, 登记时解析出各参数的类型; 每个文件中第一次用到某个格式串时, 先写入它的定义.
+ * 文件内容 (本机字节序):
+ *      文件头: "LOGBIN01", u8 时间精度, u8 类型(LB_SESSION/LB_CONT), u16 名称长度, 名称, '\n'
+ *      定义:   u8 LB_FMT, u32 编号, u32 长度, 格式串, '\n'
+ *      记录:   u8 LB_REC, u8 flags(LR_*, 含级别), u32 编号, u64 秒, u32 纳秒, u32 参数长度, 参数, '\n'
+ *      数据:   u8 LB_BLOB, u8 flags, u32 类型 (0: blob, 1: hexdump), u64 秒, u32 纳秒, u32 长度, 数据, '\n'
+ * 每段都以 '\n' 结尾, 所以内存映射模式下按末尾的 0 截断文件时不会截掉有效内容.
+ * 格式串定义总是先于使用它的记录写入, 但轮转时二者可能分处新旧两个文件, 所以还原时按时间顺序依次读入各文件,
+ * 定义在文件之间沿用; 进程重新打开同一文件时写入 LB_SESSION 文件头, 之前的定义作废.
+ * 0 号格式串固定为 "%s", 用于无法解析的格式串 (如 %n, %ls), 此时在调用者线程中格式化, 保存格式化后的文本.
+ */
+#define LB_MAGIC    "LOGBIN01"
+#define LB_FMT      1
+#define LB_REC      2
+#define LB_BLOB     3                       // logAddBlob / logAddHexdump 的原始数据, 还原时再编码为文本
+#define LB_RECHEAD  22                      // 记录头的长度
+#define LB_HDRHEAD  12                      // 文件头中名称之前的长度
+#define LB_SESSION  0                       // 文件头: 新的进程/会话开始, 格式串编号重新计算
+#define LB_CONT     1                       // 文件头: 轮转或清空后的新文件, 沿用之前的格式串编号
+
+typedef struct LbSpec{
+    unsigned short beg, end;                // 转换说明在格式串中的位置 [beg, end), beg 处为 '%'
+    char  conv;                             // 转换字符
+    char  lmod;                             // 长度修饰: 0, 'h'(h/hh), 'l', 'q'(ll/q), 'j', 'z', 't', 'L'
+    char  wstar, pstar;                     // 宽度/精度由参数给出
+    int   prec;                             // 精度, -1 表示未指定
+}LbSpec;
+
+typedef struct LbFmt{
+    const char* fmt;                        // 登记时的地址
+    char*       text;                       // 格式串的拷贝, 用于核对地址相同但内容已变的格式串 (如用户的缓冲区)
+    unsigned    id;
+    int         nspec;                      // 转换说明的个数, -1 表示无法按二进制记录
+    LbSpec      spec[LOG_BIN_MAXARGS];
+}LbFmt;
+
+#define LB_IDXSIZE  (LOG_BIN_MAXFMT * 2)
+static LbFmt*   _lb_fmt[LOG_BIN_MAXFMT];    // 编号 -> 格式串
+static LbFmt*   _lb_idx[LB_IDXSIZE];        // 以地址为键的哈希表, 查找不加锁
+static unsigned _lb_nfmt = 1;               // 0 号保留给 "%s"
+static pthread_mutex_t _lb_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief _lbParse - 解析格式串中的转换说明
+ * @return 转换说明的个数, 含有不支持的转换 (或个数超出 max) 时返回 -1
+ */
+static int _lbParse(const char* fmt, LbSpec* sp, int max)
+{
+    const char* p = fmt;
+    LbSpec* s;
+    int n = 0;
+
+    while(*p)
+    {
+        if('%' != *p)           { p++;    continue; }
+        if('%' == p[1])         { p += 2; continue; }
+        if(n >= max || p - fmt > 65535)
+            return -1;
+
+        s = &sp[n];
+        memset(s, 0, sizeof(*s));
+        s->beg  = p - fmt;
+        s->prec = -1;
+        p++;
+        while(*p && strchr("-+ #0'", *p))
+            p++;
+        if('*' == *p)   { s->wstar = 1; p++; }
+        else while(*p >= '0' && *p <= '9')
+            p++;
+        if('.' == *p)
+        {
+            p++;
+            if('*' == *p)   { s->pstar = 1; p++; }
+            else
+            {
+                s->prec = 0;
+                while(*p >= '0' && *p <= '9')
+                    s->prec = s->prec * 10 + (*p++ - '0');
+            }
+        }
+        switch(*p)
+        {
+            case 'h':   s->lmod = 'h'; p += ('h' == p[1]) ? 2 : 1;              break;
+            case 'l':   s->lmod = ('l' == p[1]) ? 'q' : 'l'; p += ('l' == p[1]) ? 2 : 1; break;
+            case 'q': case 'j': case 'z': case 't': case 'L':
+                        s->lmod = *p++;                                         break;
+        }
+        s->conv = *p;
+        switch(*p)
+        {
+            case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+                if('L' == s->lmod)  return -1;
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                if('L' != s->lmod)  s->lmod = 0;                                // %lf 与 %f 相同
+                break;
+            case 'c': case 's': case 'p':
+                if(s->lmod)         return -1;                                  // 不支持宽字符
+                break;
+            default:
+                return -1;                                                      // %n, %m 等
+        }
+        p++;
+        s->end = p - fmt;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief _lbFmt - 获取格式串的登记信息, 第一次使用时登记
+ * @return 登记信息, 格式串无法按二进制记录或已登记满时返回 NULL
+ */
+static LbFmt* _lbFmt(const char* fmt)
+{
+    size_t i = (((uintptr_t)fmt >> 3) * (size_t)0x9E3779B97F4A7C15ULL) & (LB_IDXSIZE - 1);
+    size_t start = i;
+    LbFmt* f;
+
+    while((f = __atomic_load_n(&_lb_idx[i], __ATOMIC_ACQUIRE)))
+    {
+        if(f->fmt == fmt)
+            goto found;
+        i = (i + 1) & (LB_IDXSIZE - 1);
+    }
+
+    pthread_mutex_lock(&_lb_mtx);
+    for(i = start; (f = _lb_idx[i]); i = (i + 1) & (LB_IDXSIZE - 1))
+        if(f->fmt == fmt)
+            break;
+    if(!f && _lb_nfmt < LOG_BIN_MAXFMT && (f = (LbFmt*)calloc(1, sizeof(LbFmt))))
+    {
+        f->fmt   = fmt;
+        f->text  = strdup(fmt);
+        f->nspec = f->text ? _lbParse(fmt, f->spec, LOG_BIN_MAXARGS) : -1;
+        f->id    = _lb_nfmt++;
+        _lb_fmt[f->id] = f;
+        __atomic_store_n(&_lb_idx[i], f, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&_lb_mtx);
+    if(!f)  return NULL;
+
+found:
+    if(f->nspec < 0 || strcmp(f->text, fmt))    // 地址相同但内容变了, 说明不是常量格式串
+        return NULL;
+    return f;
+}
+
+#define LB_PUT(v)   do{ if(pos + sizeof(v) <= cap) memcpy(dst + pos, &(v), sizeof(v)); pos += sizeof(v); }while(0)
+
+/**
+ * @brief _lbArgs - 按格式串的登记信息, 从 ap 中取出参数编码到 dst
+ * @return 编码所需的长度, 超出 cap 的部分不写入
+ */
+static size_t _lbArgs(char* dst, size_t cap, const LbFmt* f, va_list ap)
+{
+    const LbSpec* s;
+    size_t   pos = 0;
+    int      i, prec, star;
+    int64_t  iv;
+    uint64_t pv;
+    double   dv;
+    long double lv;
+    const char* sv;
+    uint32_t slen;
+
+    for(i = 0; i < f->nspec; i++)
+    {
+        s    = &f->spec[i];
+        prec = s->prec;
+        if(s->wstar)
+        {
+            star = va_arg(ap, int);
+            iv   = star;
+            LB_PUT(iv);
+        }
+        if(s->pstar)
+        {
+            star = va_arg(ap, int);
+            iv   = prec = star;
+            LB_PUT(iv);
+        }
+        switch(s->conv)
+        {
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                if('L' == s->lmod)  { lv = va_arg(ap, long double); LB_PUT(lv); }
+                else                { dv = va_arg(ap, double);      LB_PUT(dv); }
+                break;
+            case 's':
+                sv = va_arg(ap, const char*);
+                if(!sv) sv = "(null)";
+                slen = prec >= 0 ? strnlen(sv, prec) : strlen(sv);
+                LB_PUT(slen);
+                if(pos + slen <= cap)
+                    memcpy(dst + pos, sv, slen);
+                pos += slen;
+                break;
+            case 'p':
+                pv = (uintptr_t)va_arg(ap, void*);
+                LB_PUT(pv);
+                break;
+            default:
+                switch(s->lmod)
+                {
+                    case 'l':   iv = va_arg(ap, long);          break;
+                    case 'q':   iv = va_arg(ap, long long);     break;
+                    case 'j':   iv = va_arg(ap, intmax_t);      break;
+                    case 'z':   iv = va_arg(ap, size_t);        break;
+                    case 't':   iv = va_arg(ap, ptrdiff_t);     break;
+                    default:    iv = va_arg(ap, int);           break;
+                }
+                LB_PUT(iv);
+        }
+    }
+    return pos;
+}
+
+static size_t _lbHeader(LogPtr log, char* buf, size_t cap, int kind)
+{
+    uint16_t nlen = log->name ? strlen(log->name) : 0;
+    char     prec = __atomic_load_n(&_ts_prec, __ATOMIC_RELAXED);
+
+    if(LB_HDRHEAD + (size_t)nlen + 1 > cap)
+        nlen = cap - LB_HDRHEAD - 1;
+    memcpy(buf, LB_MAGIC, 8);
+    buf[8] = prec;
+    buf[9] = kind;
+    memcpy(buf + 10, &nlen, 2);
+    memcpy(buf + LB_HDRHEAD, log->name, nlen);
+    buf[LB_HDRHEAD + nlen] = '\n';
+    return LB_HDRHEAD + nlen + 1;
+}
+
+static size_t _lbNewFile(LogPtr log, int fd)
+{
+    char   buf[512];
+    size_t n = _lbHeader(log, buf, sizeof(buf), LB_CONT);
+
+    /* 先更新编号再让新文件生效, 这样写入新文件前都会重新写入格式串定义 */
+    __atomic_fetch_add(&log->bingen, 1, __ATOMIC_RELEASE);
+    return pwrite(fd, buf, n, 0) == (ssize_t)n ? n : 0;
+}
+
+/**
+ * @brief logSetBinary - 将日志切换为二进制模式
+ * 之后 logAdd* 只记录格式串编号, 时间和参数, 不在调用者线程中格式化 (非静默时输出到控制台的部分除外),
+ * 使用 logDecode (或 logdecode 工具) 将文件还原为文本格式.
+ * @param log
+ * @return 成功返回 LOG_OK; 文件不为空且不是二进制日志文件时返回 LOG_ERR
+ * @note   应在添加日志之前调用; 格式串需为常量字符串, 内容会变的格式串按文本处理, 仍能正确记录但没有加速
+ */
+int logSetBinary(LogPtr log)
+{
+    char buf[512];
+    int  fd;
+    size_t n;
+
+    if(!log)        return LOG_ERR;
+    if(log->bin)    return LOG_OK;
+    if(log->shared)
+    {
+        logsysAdd(log, "set binary err: shared log\n");
+        return LOG_ERR;
+    }
+    if(log->lazy)                           // 要检查文件内容并写入文件头
+        _logOpenLazy(log);
+
+    if(logFileSize(log) > 0)
+    {
+        fd = open(log->path, O_RDONLY);
+        n  = fd < 0 ? 0 : pread(fd, buf, 8, 0);
+        if(fd >= 0) close(fd);
+        if(8 != n || memcmp(buf, LB_MAGIC, 8))
+        {
+            logsysAdd(log, "set binary err: file is not empty\n");
+            return LOG_ERR;
+        }
+    }
+
+    log->fmtgen = (unsigned*)calloc(LOG_BIN_MAXFMT, sizeof(unsigned));
+    if(!log->fmtgen)    return LOG_ERR;
+    log->bingen = 1;
+    n = _lbHeader(log, buf, sizeof(buf), LB_SESSION);
+    _logOut(log, buf, n, LR_KEEP);          // 文件头同样不能丢弃
+    log->bin = true;
+    logsysAdd(log, "Binary mode on\n");
+    return LOG_OK;
+}
+
+static size_t _lbEmit(LogPtr log, const char* name, unsigned flags, const char* text, va_list* ap)
+{
+    LbFmt*   f = text ? _lbFmt(text) : NULL;
+    char*    rec = _rb;
+    size_t   cap = LOG_REC_SIZE, alen, flen;
+    unsigned gen;
+    uint32_t id, u32;
+    uint64_t sec;
+    struct timespec ts;
+    va_list  cp;
+    int      n;
+
+    if(flags & LR_CONSOLE)                  // 控制台仍需要文本, 先输出, 之后 _rb 用于编码
+    {
+        char* txt;
+        if(ap)  va_copy(cp, *ap);
+        n = _logBuild(&txt, name, flags, text, ap ? &cp : NULL);
+        if(ap)  va_end(cp);
+        if(n > 0)
+            _writeAll(STDERR_FILENO, txt, n);
+        if(n > 0 && txt != _rb)
+            free(txt);
+    }
+
+    /* 本文件中第一次使用此格式串, 先写入定义; 并发时可能重复写入, 不影响还原 */
+    gen = __atomic_load_n(&log->bingen, __ATOMIC_ACQUIRE);
+    if(f && __atomic_load_n(&log->fmtgen[f->id], __ATOMIC_RELAXED) != gen)
+    {
+        flen = strlen(f->text);
+        if(10 + flen <= cap)
+        {
+            u32 = flen;
+            rec[0] = LB_FMT;
+            memcpy(rec + 1, &f->id, 4);
+            memcpy(rec + 5, &u32, 4);
+            memcpy(rec + 9, f->text, flen);
+            rec[9 + flen] = '\n';
+            _logOut(log, rec, 10 + flen, LR_KEEP);  // 丢弃了定义, 此文件中之后使用它的记录都无法还原
+            __atomic_store_n(&log->fmtgen[f->id], gen, __ATOMIC_RELAXED);
+        }
+        else
+            f = NULL;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec[0] = LB_REC;
+    rec[1] = flags & ~LR_CONSOLE;
+    id  = f ? f->id : 0;
+    sec = ts.tv_sec;
+    u32 = ts.tv_nsec;
+    memcpy(rec + 2,  &id,  4);
+    memcpy(rec + 6,  &sec, 8);
+    memcpy(rec + 14, &u32, 4);
+
+    if(f)
+    {
+        va_copy(cp, *ap);
+        alen = _lbArgs(rec + LB_RECHEAD, cap - LB_RECHEAD - 1, f, cp);
+        va_end(cp);
+        if(LB_RECHEAD + alen + 1 > cap)     // 放不下, 另行分配
+        {
+            cap = LB_RECHEAD + alen + 1;
+            if(!(rec = (char*)malloc(cap)))   return 0;
+            memcpy(rec, _rb, LB_RECHEAD);
+            _lbArgs(rec + LB_RECHEAD, cap - LB_RECHEAD - 1, f, *ap);
+        }
+    }
+    else                                    // 0 号格式串 "%s": 在这里格式化
+    {
+        n = 0;
+        if(text)
+        {
+            va_copy(cp, *ap);
+            n = _fmtV(rec + LB_RECHEAD + 4, cap - LB_RECHEAD - 4, text, cp);
+            va_end(cp);
+            if(n < 0)   return 0;
+            if((size_t)(LB_RECHEAD + 4 + n + 1) > cap)
+            {
+                cap = LB_RECHEAD + 4 + n + 1;
+                if(!(rec = (char*)malloc(cap)))   return 0;
+                memcpy(rec, _rb, LB_RECHEAD);
+                _fmtV(rec + LB_RECHEAD + 4, n + 1, text, *ap);
+            }
+        }
+        u32 = n;
+        memcpy(rec + LB_RECHEAD, &u32, 4);
+        alen = 4 + n;
+    }
+    u32 = alen;
+    memcpy(rec + 18, &u32, 4);
+    rec[LB_RECHEAD + alen] = '\n';
+
+    _logOut(log, rec, LB_RECHEAD + alen + 1, flags & ~LR_CONSOLE);
+
+    if(rec != _rb)
+        free(rec);
+    return LB_RECHEAD + alen + 1;
+}
+
+static void _lbEmitStr(LogPtr log, const char* name, unsigned flags, const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    _lbEmit(log, name, flags, fmt, &ap);
+    va_end(ap);
+}
+
+/* ---- 还原 ---- */
+typedef struct LbOut{
+    char*  p;
+    size_t len, cap;
+}LbOut;
+
+static void _lbCat(LbOut* o, const char* fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(o->p + o->len, o->cap - o->len, fmt, ap);
+    va_end(ap);
+    if(n < 0)   return;
+    if(o->len + n + 1 > o->cap)
+    {
+        while(o->len + n + 1 > o->cap)
+            o->cap = o->cap ? o->cap * 2 : 4096;
+        o->p = (char*)realloc(o->p, o->cap);
+        va_start(ap, fmt);
+        vsnprintf(o->p + o->len, o->cap - o->len, fmt, ap);
+        va_end(ap);
+    }
+    o->len += n;
+}
+
+/* 保证 o 中还能追加 n 字节 (以及结尾的 0) */
+static bool _lbGrow(LbOut* o, size_t n)
+{
+    char* p;
+    size_t cap = o->cap;
+
+    if(o->len + n + 1 <= cap)   return true;
+    while(o->len + n + 1 > cap)
+        cap = cap ? cap * 2 : 4096;
+    if(!(p = (char*)realloc(o->p, cap)))
+        return false;
+    o->p   = p;
+    o->cap = cap;
+    return true;
+}
+
+#define LB_GET(v)   do{ if(pos + sizeof(v) > alen) return -1; memcpy(&(v), args + pos, sizeof(v)); pos += sizeof(v); }while(0)
+#define LB_CAT(v)   do{ if(s->wstar && s->pstar) _lbCat(o, spec, w, pr, v); else if(s->wstar) _lbCat(o, spec, w, v); \
+                        else if(s->pstar) _lbCat(o, spec, pr, v); else _lbCat(o, spec, v); }while(0)
+
+/**
+ * @brief _lbFormat - 还原一条记录的文本内容, 追加到 o
+ * @return 成功返回 0, 参数不完整返回 -1
+ */
+static int _lbFormat(LbOut* o, const LbFmt* f, const char* args, size_t alen)
+{
+    const char*   fmt = f->text;
+    const LbSpec* s;
+    char     spec[64];
+    char*    str;
+    size_t   pos = 0, lit = 0, i;
+    int      k, w = 0, pr = 0;
+    int64_t  iv;
+    uint64_t pv;
+    double   dv;
+    long double lv;
+    uint32_t slen;
+
+    for(k = 0; k <= f->nspec; k++)
+    {
+        /* 转换说明之前的普通文本, 其中的 "%%" 还原为 '%' */
+        size_t end = k < f->nspec ? f->spec[k].beg : strlen(fmt);
+        for(i = lit; i < end; i++)
+        {
+            if('%' == fmt[i] && '%' == fmt[i + 1])
+                i++;
+            _lbCat(o, "%c", fmt[i]);
+        }
+        if(k == f->nspec)
+            break;
+
+        s   = &f->spec[k];
+        lit = s->end;
+        if((size_t)(s->end - s->beg) >= sizeof(spec))
+            return -1;
+        memcpy(spec, fmt + s->beg, s->end - s->beg);
+        spec[s->end - s->beg] = '\0';
+
+        if(s->wstar)    { LB_GET(iv); w  = iv; }
+        if(s->pstar)    { LB_GET(iv); pr = iv; }
+        switch(s->conv)
+        {
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                if('L' == s->lmod)  { LB_GET(lv); LB_CAT(lv); }
+                else                { LB_GET(dv); LB_CAT(dv); }
+                break;
+            case 's':
+                LB_GET(slen);
+                if(pos + slen > alen)   return -1;
+                if(!(str = strndup(args + pos, slen)))  return -1;
+                pos += slen;
+                LB_CAT(str);
+                free(str);
+                break;
+            case 'p':
+                LB_GET(pv);
+                LB_CAT((void*)(uintptr_t)pv);
+                break;
+            case 'd': case 'i':
+                LB_GET(iv);
+                switch(s->lmod)
+                {
+                    case 'l':   LB_CAT((long)iv);       break;
+                    case 'q':   LB_CAT((long long)iv);  break;
+                    case 'j':   LB_CAT((intmax_t)iv);   break;
+                    case 'z':   LB_CAT((ssize_t)iv);    break;
+                    case 't':   LB_CAT((ptrdiff_t)iv);  break;
+                    default:    LB_CAT((int)iv);        break;
+                }
+                break;
+            default:                        // o u x X c
+                LB_GET(iv);
+                switch(s->lmod)
+                {
+                    case 'l':   LB_CAT((unsigned long)iv);      break;
+                    case 'q':   LB_CAT((unsigned long long)iv); break;
+                    case 'j':   LB_CAT((uintmax_t)iv);          break;
+                    case 'z':   LB_CAT((size_t)iv);             break;
+                    case 't':   LB_CAT((ptrdiff_t)iv);          break;
+                    default:    LB_CAT((unsigned int)iv);       break;
+                }
+        }
+    }
+    return 0;
+}
+
+typedef struct LbDec{
+    LbFmt** defs;                           // 编号 -> 格式串定义
+    char*   name;
+    int     prec;
+    LbOut   o;
+}LbDec;
+
+static void _lbDecReset(LbDec* d)
+{
+    unsigned id;
+
+    for(id = 0; id < LOG_BIN_MAXFMT; id++)
+    {
+        if(d->defs[id])
+        {
+            free(d->defs[id]->text);
+            free(d->defs[id]);
+            d->defs[id] = NULL;
+        }
+    }
+}
+
+/**
+ * @brief _lbDecFile - 还原一个文件, 格式串定义保存在 d 中, 供之后的文件使用
+ * @return 成功返回 LOG_OK; 文件无法打开或不是二进制日志文件时返回 LOG_ERR
+ */
+static int _lbDecFile(LbDec* d, const char* path, LzRange* r, FILE* out)
+{
+    static const LbFmt f0 = {NULL, "%s", 0, 1, {{0, 2, 's', 0, 0, 0, -1}}};
+    static const unsigned div[7] = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000};
+    struct stat st;
+    LbFmt*   f;
+    LbOut*   o = &d->o;
+    char     tbuf[64];
+    const char* p;
+    const char* end;
+    char*    base;
+    int      fd, ret = LOG_ERR;
+    unsigned flags;
+    uint16_t nlen;
+    uint32_t id, len, nsec;
+    uint64_t sec;
+    struct tm local;
+    time_t   t;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)  return LOG_ERR;
+    if(fstat(fd, &st) || st.st_size < LB_HDRHEAD + 1)
+        goto out_close;
+    base = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(MAP_FAILED == base)
+        goto out_close;
+    p   = base;
+    end = base + st.st_size;
+    if(memcmp(p, LB_MAGIC, 8))
+        goto out_unmap;
+    ret = LOG_OK;
+
+    while(p < end)
+    {
+        if(LB_MAGIC[0] == *p)               // 文件头
+        {
+            if(end - p < LB_HDRHEAD + 1 || memcmp(p, LB_MAGIC, 8))
+                break;
+            memcpy(&nlen, p + 10, 2);
+            if(end - p < LB_HDRHEAD + nlen + 1)
+                break;
+            if(LB_SESSION == p[9])
+                _lbDecReset(d);
+            d->prec = p[8];
+            free(d->name);
+            d->name = nlen ? strndup(p + LB_HDRHEAD, nlen) : NULL;
+            p += LB_HDRHEAD + nlen + 1;
+        }
+        else if(LB_FMT == *p)
+        {
+            if(end - p < 9) break;
+            memcpy(&id,  p + 1, 4);
+            memcpy(&len, p + 5, 4);
+            if((size_t)(end - p) < 10 + (size_t)len || id >= LOG_BIN_MAXFMT)
+                break;
+            if(!d->defs[id] && (f = (LbFmt*)calloc(1, sizeof(LbFmt))))
+            {
+                f->text  = strndup(p + 9, len);
+                f->id    = id;
+                f->nspec = f->text ? _lbParse(f->text, f->spec, LOG_BIN_MAXARGS) : -1;
+                d->defs[id] = f;
+            }
+            p += 10 + len;
+        }
+        else if(LB_REC == *p || LB_BLOB == *p)
+        {
+            if(end - p < LB_RECHEAD)    break;
+            flags = p[1];
+            memcpy(&id,   p + 2,  4);
+            memcpy(&sec,  p + 6,  8);
+            memcpy(&nsec, p + 14, 4);
+            memcpy(&len,  p + 18, 4);
+            if((size_t)(end - p) < LB_RECHEAD + (size_t)len + 1)
+                break;
+
+            o->len = 0;
+            if(flags & LR_TIME)
+            {
+                t = sec;
+                localtime_r(&t, &local);
+                strftime(tbuf, sizeof(tbuf), "[%Y-%m-%d %H:%M:%S", &local);
+                _lbCat(o, "%s", tbuf);
+                if(d->prec > 0 && d->prec <= 6)
+                    _lbCat(o, ".%0*u", d->prec, nsec / div[d->prec]);
+                _lbCat(o, "] ");
+            }
+            if((flags & LR_NAME) && d->name)
+            {
+                _lbCat(o, "[%s] ", d->name);
+                if(LR_LVOF(flags) >= 0 && LR_LVOF(flags) <= LOG_LV_FATAL)
+                    _lbCat(o, "[%s] ", _lv_name[LR_LVOF(flags)]);
+                if(flags & LR_COLON)
+                    _lbCat(o, ":");
+            }
+
+            if(LB_BLOB == *p)
+            {
+                flags = id ? LR_BLOB | LR_DUMP : LR_BLOB;
+                if(_lbGrow(o, _blobLen(flags, len)))
+                    o->len += _blobText(o->p + o->len, flags, (const unsigned char*)p + LB_RECHEAD, len);
+            }
+            else
+            {
+                f = id ? (id < LOG_BIN_MAXFMT ? d->defs[id] : NULL) : (LbFmt*)&f0;
+                if(!f || f->nspec < 0 || _lbFormat(o, f, p + LB_RECHEAD, len))
+                    _lbCat(o, "<logdecode: bad record, format id %u>", id);
+            }
+            if((flags & LR_LINE) && (0 == o->len || '\n' != o->p[o->len - 1]))
+                _lbCat(o, "\n");
+            _lzPut(r, o->p, o->len, out);
+            p += LB_RECHEAD + len + 1;
+        }
+        else if(0 == *p)                    // 内存映射模式下崩溃时已预留但未写入的空洞
+            p++;
+        else
+            break;                          // 文件尾部不完整或已损坏
+    }
+
+out_unmap:
+    munmap(base, st.st_size);
+out_close:
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief logDecode - 将二进制日志文件或块压缩日志文件还原为文本格式, 与文本模式下 logAdd* 写入的内容相同
+ * @param paths 日志文件路径, 有轮转的归档时按时间顺序给出, 如 {"x.out.2", "x.out.1", "x.out"}
+ * @param n     文件个数
+ * @param out   输出的文件流, 如 stdout
+ * @return 全部成功返回 LOG_OK; 有文件无法打开或不是二进制/块压缩日志文件时返回 LOG_ERR (其余文件照常还原)
+ * @note   文件末尾不完整的记录 (程序崩溃时) 会被忽略;
+ *         单独还原一个二进制归档时, 轮转瞬间写入的少数记录可能找不到格式串定义 (在前一个文件中), 输出为 bad record
+ */
+int logDecode(const char* const* paths, int n, FILE* out)
+{
+    return logDecodeRange(paths, n, NULL, NULL, out);
+}
+
+/**
+ * @brief logDecodeRange - 同 logDecode, 只输出时间在 [from, to] 范围内的记录
+ * @param from  开始时间 "YYYY-MM-DD HH:MM:SS[.xxx]", 可以只给出前缀 (如 "2024-05-01 13"), 为 NULL 时不限制
+ * @param to    结束时间, 按给出的精度比较, 包含在内, 为 NULL 时不限制
+ * @note   块压缩文件按块的时间索引只解压范围内的块; 不带时间的记录 (logAddText) 跟随它前面的记录
+ */
+int logDecodeRange(const char* const* paths, int n, const char* from, const char* to, FILE* out)
+{
+    LbDec d;
+    LzRange r = {from, from ? strlen(from) : 0, to, to ? strlen(to) : 0, !from && !to};
+    char  magic[8];
+    int   i, fd, ret = LOG_OK;
+
+    memset(&d, 0, sizeof(d));
+    d.defs = (LbFmt**)calloc(LOG_BIN_MAXFMT, sizeof(LbFmt*));
+    if(!d.defs)     return LOG_ERR;
+
+    for(i = 0; i < n; i++)
+    {
+        memset(magic, 0, sizeof(magic));
+        if((fd = open(paths[i], O_RDONLY)) >= 0)
+        {
+            if(pread(fd, magic, 8, 0) != 8)
+                memset(magic, 0, sizeof(magic));
+            close(fd);
+        }
+        if(LOG_ERR == (0 == memcmp(magic, LZ_MAGIC, 8) ? _lzDecFile(paths[i], &r, out) : _lbDecFile(&d, paths[i], &r, out)))
+            ret = LOG_ERR;
+    }
+
+    _lbDecReset(&d);
+    free(d.defs);
+    free(d.name);
+    free(d.o.p);
+    return ret;
+}
+
+/* ---------------------------- blob records --------------------------------- */
+/* 二进制数据 (logAddBlob / logAddHexdump):
+ * 文本模式下记录为 "[time] [name] :blob N <十六进制>" 或 "[time] [name] :hexdump N" 加上 hexdump -C 格式的各行,
+ * 整条记录一次写入. 同步模式下在调用者线程中编码 (SSE2 每次 16 字节), 直接编码到记录缓冲区, 不产生中间字符串;
+ * 异步模式下调用者只格式化前缀, 数据原样拷贝一次到队列中, 由写线程编码; 二进制模式下原样保存 (LB_BLOB),
+ * 直接写入文件时用 writev 引用调用者的缓冲区, 由 logDecode 还原时编码.
+ * 这些记录不写入飞行记录器和增加的输出; JSON / logfmt 格式下编码后的文本作为 msg, 在调用者线程中组装.
+ */
+#define HD_LINE     79                      // hexdump 中完整一行的长度
+
+static const char _hex_digits[] = "0123456789abcdef";
+
+/* 十六进制编码 n 字节到 dst, 共 2n 个字符 */
+static void _hexEnc(char* dst, const unsigned char* src, size_t n)
+{
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi8(0x0f), nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0'),  gap  = _mm_set1_epi8('a' - '0' - 10);
+    __m128i v, hi, lo;
+
+    for(; n >= 16; n -= 16, src += 16, dst += 32)
+    {
+        v  = _mm_loadu_si128((const __m128i*)src);
+        hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        lo = _mm_and_si128(v, mask);
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), gap));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), gap));
+        _mm_storeu_si128((__m128i*)dst,        _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    for(; n; n--, src++)
+    {
+        *dst++ = _hex_digits[*src >> 4];
+        *dst++ = _hex_digits[*src & 15];
+    }
+}
+
+static size_t _blobLen(unsigned flags, size_t n)
+{
+    char num[24];
+    size_t h = snprintf(num, sizeof(num), "%zu", n);
+
+    if(!(flags & LR_DUMP))                  // "blob N " 十六进制 "\n"
+        return 5 + h + 1 + 2 * n + 1;
+    return 8 + h + 1 + n / 16 * HD_LINE + (n % 16 ? HD_LINE - 16 + n % 16 : 0);    // "hexdump N\n" 各行
+}
+
+/**
+ * @brief _blobText - 将二进制数据编码为文本 (不含时间和名称的前缀), 以换行结尾
+ * @param dst   至少 _blobLen(flags, n) 字节
+ * @return 编码后的长度
+ */
+static size_t _blobText(char* dst, unsigned flags, const unsigned char* data, size_t n)
+{
+    char   hex[32];
+    char*  p;
+    size_t len, off, i, k;
+
+    if(!(flags & LR_DUMP))
+    {
+        len = snprintf(hex, sizeof(hex), "blob %zu ", n);
+        memcpy(dst, hex, len);
+        _hexEnc(dst + len, data, n);
+        len += 2 * n;
+        dst[len++] = '\n';
+        return len;
+    }
+
+    len = snprintf(hex, sizeof(hex), "hexdump %zu\n", n);
+    memcpy(dst, hex, len);
+    for(off = 0; off < n; off += 16)        // "00000010  48 65 6c 6c 6f 20 77 6f  72 6c 64 0a 00 00 00 00  |Hello world.....|"
+    {
+        k = n - off < 16 ? n - off : 16;
+        p = dst + len;
+        for(i = 0; i < 8; i++)
+            p[i] = _hex_digits[(off >> (28 - 4 * i)) & 15];
+        memset(p + 8, ' ', 52);
+        _hexEnc(hex, data + off, k);
+        for(i = 0; i < k; i++)
+            memcpy(p + 10 + 3 * i + (i >= 8), hex + 2 * i, 2);
+        p[60] = '|';
+        for(i = 0; i < k; i++)
+            p[61 + i] = data[off + i] >= 0x20 && data[off + i] < 0x7f ? data[off + i] : '.';
+        p[61 + k] = '|';
+        p[62 + k] = '\n';
+        len += 63 + k;
+    }
+    return len;
+}
+
+/**
+ * @brief _blobBuild - 组装一条完整的文本记录: 前缀和编码后的数据
+ * @param out   返回记录的起始地址, 若不等于 _rb, 则是另行分配的, 用完需要 free
+ * @return 记录长度, 失败返回 0
+ */
+static size_t _blobBuild(char** out, LogPtr log, unsigned flags, const void* data, size_t n)
+{
+    char*  rec;
+    int    hlen = _logBuild(&rec, log->name, flags & ~LR_LINE, NULL, NULL);
+    size_t len  = hlen + _blobLen(flags, n);
+
+    if(len > LOG_REC_SIZE)
+    {
+        if(!(rec = (char*)malloc(len)))
+            return 0;
+        memcpy(rec, _rb, hlen);
+    }
+    *out = rec;
+    return hlen + _blobText(rec + hlen, flags, (const unsigned char*)data, n);
+}
+
+static size_t _writevAll(int fd, const struct iovec* iov, int cnt, size_t len)
+{
+    struct iovec v[4];
+    size_t  done = 0;
+    ssize_t n;
+    int     i = 0;
+
+    memcpy(v, iov, cnt * sizeof(*v));
+    while(done < len && i < cnt)
+    {
+        n = writev(fd, v + i, cnt - i);
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            break;
+        }
+        done += n;
+        while(i < cnt && (size_t)n >= v[i].iov_len)
+            n -= v[i++].iov_len;
+        if(i < cnt)
+        {
+            v[i].iov_base = (char*)v[i].iov_base + n;
+            v[i].iov_len -= n;
+        }
+    }
+    return done;
+}
+
+/* 二进制模式: 记录头和调用者的数据直接 writev 到文件, 异步模式下拼接到队列中 */
+static void _blobBin(LogPtr log, unsigned flags, const void* data, size_t n)
+{
+    char     head[LB_RECHEAD];
+    char*    rec;
+    uint32_t kind = (flags & LR_DUMP) ? 1 : 0, u32 = n;
+    uint64_t sec;
+    struct timespec ts;
+    struct iovec iov[3] = {{head, LB_RECHEAD}, {(void*)data, n}, {(void*)"\n", 1}};
+    size_t   len = LB_RECHEAD + n + 1;
+    int      fd, slot;
+
+    if(flags & LR_CONSOLE)                  // 控制台仍需要文本
+    {
+        size_t tlen = _blobBuild(&rec, log, flags, data, n);
+        if(tlen)
+            _writeAll(STDERR_FILENO, rec, tlen);
+        if(tlen && rec != _rb)
+            free(rec);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    sec = ts.tv_sec;
+    head[0] = LB_BLOB;
+    head[1] = flags & ~LR_CONSOLE;
+    memcpy(head + 2,  &kind, 4);
+    memcpy(head + 6,  &sec,  8);
+    u32 = ts.tv_nsec;
+    memcpy(head + 14, &u32,  4);
+    u32 = n;
+    memcpy(head + 18, &u32,  4);
+
+    if(log->queue)
+        _lqPushV(log->queue, iov, 3, 0);
+    else if(!log->map && !(log->flush && log->flush->bytes))
+    {
+        if(log->fp)
+        {
+            fd = _logPin(log, &slot);
+            if(fd >= 0)
+                _logSizeAdd(log, _writevAll(fd, iov, 3, len), len);
+            _logUnpin(log, slot);
+        }
+    }
+    else                                    // 内存映射或缓冲写入: 拼接后按一般记录写入
+    {
+        rec = len > LOG_REC_SIZE ? (char*)malloc(len) : _rb;
+        if(!rec)    return;
+        _iovCopy(rec, iov, 3);
+        _logOut(log, rec, len, 0);
+        if(rec != _rb)
+            free(rec);
+    }
+}
+
+static void _blobEmit(LogPtr log, unsigned flags, const void* data, size_t n)
+{
+    uint64_t t0;
+    LogHist* lat = _logBegin(log, &t0);
+    char*    rec;
+    char*    kv;
+    uint32_t hlen;
+    size_t   len;
+    int      k;
+
+    if(n > LOG_BLOB_MAX)
+        n = LOG_BLOB_MAX;
+    if(log->bin)
+        _blobBin(log, flags, data, n);
+    else if(log->queue && LOG_FMT_TEXT == log->format)  // 只格式化前缀, 数据由写线程编码
+    {
+        hlen = _logBuild(&rec, log->name, flags & ~LR_LINE, NULL, NULL);
+        struct iovec iov[3] = {{&hlen, 4}, {rec, hlen}, {(void*)data, n}};
+        _lqPushV(log->queue, iov, 3, flags & (LR_CONSOLE | LR_BLOB | LR_DUMP));
+    }
+    else if(LOG_FMT_TEXT == log->format)
+    {
+        if((len = _blobBuild(&rec, log, flags, data, n)))
+        {
+            _logOut(log, rec, len, flags);
+            if(rec != _rb)
+                free(rec);
+        }
+    }
+    else                                    // 编码后的文本作为 msg 组装成结构化记录
+    {
+        len = _blobLen(flags, n);
+        rec = len > LOG_REC_SIZE ? (char*)malloc(len) : _rb;
+        if(rec)
+        {
+            len = _blobText(rec, flags, (const unsigned char*)data, n);
+            if((k = _kvBuild(&kv, log, log->name, flags, rec, len - 1, NULL, 0)) > 0)
+            {
+                _logOut(log, kv, k, flags);
+                if(kv != _kb)
+                    free(kv);
+            }
+            if(rec != _rb)
+                free(rec);
+        }
+    }
+
+    if(lat)
+        _histAdd(lat, _statNow() - t0);
+}
+
+/**
+ * @brief logAddBlob - 添加一段二进制数据, 记录为 "[time] [name] :blob N <十六进制>"
+ * @param log
+ * @param data  数据, 同步模式下调用返回后即可重用
+ * @param len   长度, 超出 LOG_BLOB_MAX 的部分不记录
+ * @note  异步模式下数据拷贝一次到队列中, 由写线程编码; 二进制模式下原样保存
+ */
+void logAddBlob(LogPtr log, const void* data, size_t len)
+{
+    if(!log || (!data && len))  return;
+    _blobEmit(log, (log->mutetype ? LR_RECORD : LR_RECORD | LR_CONSOLE) | LR_BLOB, data, len);
+}
+
+/**
+ * @brief logAddHexdump - 添加一段二进制数据, 记录为 "[time] [name] :hexdump N" 和 hexdump -C 格式的各行
+ * @note  整个 hexdump 是一条记录, 一次写入; 其它同 logAddBlob
+ */
+void logAddHexdump(LogPtr log, const void* data, size_t len)
+{
+    if(!log || (!data && len))  return;
+    _blobEmit(log, (log->mutetype ? LR_RECORD : LR_RECORD | LR_CONSOLE) | LR_BLOB | LR_DUMP, data, len);
+}
+
+/* ---------------------------- compressed blocks ----------------------------- */
+/* 块压缩 (logSetCompress, 只用于异步模式):
+ * 写线程把合并后的记录先放入每个日志一个的块缓冲区, 满了 (或停留超过 LZ_FLUSH_MS, 或 logFlush, 或有关键记录) 时
+ * 压缩为一个独立的块写入文件, 调用者线程只做格式化和入队. 压缩算法为本模块自带的 LZ77 (序列格式与 LZ4 相同:
+ * 标记字节的高/低 4 位为字面量/匹配长度, 2 字节偏移, 匹配至少 4 字节), 压缩后不变小的块原样保存.
+ * 每个块记录其中带时间的记录的最早和最晚时间, 文件关闭或轮转时在末尾写入所有块的索引, 读取时可以只解压需要的块;
+ * 没有索引 (正在写入, 或程序崩溃) 时按块头依次扫描, 末尾不完整的块被忽略. 重新打开有索引的文件时先去掉索引再追加.
+ * 文件内容 (本机字节序):
+ *      文件头: "LOGLZ001", u32 块大小, u32 0
+ *      块:     u32 LZ_BLKMAGIC, u32 压缩后长度, u32 原始长度 (最高位为 1 表示未压缩), u32 校验 (压缩后的数据),
+ *              char 最早时间[20], char 最晚时间[20], 数据
+ *      索引:   每块 u64 偏移, u32 压缩后长度, u32 原始长度, char 最早时间[20], char 最晚时间[20],
+ *              然后 u64 块数, u64 索引的偏移, "LZINDEX1"
+ * 时间为 "YYYY-MM-DD HH:MM:SS" (不含小数部分), 块中没有带时间的记录时全为 0.
+ */
+#define LZ_HDRSIZE      16                  // 文件头的长度
+#define LZ_BLKMAGIC     0x4b425a4cu         // "LZBK"
+#define LZ_BLKHEAD      56                  // 块头的长度
+#define LZ_RAW          0x80000000u         // 原始长度的最高位: 块未压缩
+#define LZ_TSLEN        20                  // 块头和索引中时间的长度 (19 个字符加 0)
+#define LZ_IDXENT       56                  // 索引中每块的长度
+#define LZ_TRAILER      24                  // 索引末尾的长度
+#define LZ_IDXMAGIC     "LZINDEX1"
+#define LZ_HASHBITS     14                  // 查找匹配的哈希表有 2^14 项
+#define LZ_MINMATCH     4
+#define LZ_MAXOFF       65535
+#define LZ_FLUSH_MS     1000                // 块缓冲区中的记录最多停留的时间
+#define LZ_LINEHEAD     40                  // 不在记录开头的这些字节内切分块, 保证记录的时间 (含小数部分) 完整地在一个块中
+#define DF_LZ_BLOCK     256                 // 默认块大小, 单位为 KB
+
+typedef struct LzIdx{
+    uint64_t off;                           // 块在文件中的偏移
+    uint32_t clen;                          // 块头中的压缩后长度和原始长度
+    uint32_t rlen;
+    char     tmin[LZ_TSLEN];                // 最早和最晚时间
+    char     tmax[LZ_TSLEN];
+}LzIdx;
+
+struct LogLz{
+    size_t   block;                         // 块大小
+    char*    raw;                           // 块缓冲区, 待压缩的记录
+    size_t   len;
+    char*    out;                           // 压缩结果, 前面留出块头的位置
+    uint32_t* tab;                          // 哈希表, 每个块重新清零
+    char     tmin[LZ_TSLEN];                // 块中带时间的记录的最早和最晚时间
+    char     tmax[LZ_TSLEN];
+    char     tlast[LZ_TSLEN];               // 最近一条带时间的记录的时间
+    bool     part;                          // 块缓冲区以半条记录结尾, 后半段在下一个块的开头
+    uint64_t first;                         // 块中第一批记录放入的时间 (单调时钟), 用于定时写出
+    int      fd;                            // 写线程正在写入的文件 (复制的描述符), 轮转后换为新文件
+    size_t   nrot;                          // 上次检查时的轮转次数, 变化时说明文件已轮转或清空
+    uint64_t off;                           // 下一个块在文件中的偏移
+    LzIdx*   idx;                           // 本文件中各块的索引
+    size_t   nidx;
+    size_t   capidx;
+    int      sealreq;                       // logFlush 请求写线程写出块缓冲区, 完成后清零
+    size_t   rawbytes;                      // 计数: 压缩前和压缩后的总字节数
+    size_t   zbytes;
+};
+
+/* 记录开头的时间 (文本, logfmt 和 JSON 格式), 不是带时间的记录时返回 NULL */
+static const char* _lzTime(const char* p, const char* end)
+{
+    const char* ts;
+
+    if(end - p > 1 && '[' == p[0])
+        ts = p + 1;
+    else if(end - p > 4 && 0 == memcmp(p, "ts=\"", 4))
+        ts = p + 4;
+    else if(end - p > 7 && 0 == memcmp(p, "{\"ts\":\"", 7))
+        ts = p + 7;
+    else
+        return NULL;
+    if(end - ts < 19 || ts[0] < '0' || ts[0] > '9' || '-' != ts[4] || '-' != ts[7] || ' ' != ts[10] || ':' != ts[13] || ':' != ts[16])
+        return NULL;
+    return ts;
+}
+
+static uint32_t _lzRead32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t _lzHash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASHBITS);
+}
+
+static uint32_t _lzSum(const char* p, size_t len)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len, v;
+    size_t   i;
+
+    for(i = 0; i + 8 <= len; i += 8)
+    {
+        memcpy(&v, p + i, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    for(; i < len; i++)
+        h = (h ^ (uint8_t)p[i]) * 0x100000001b3ULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/* 写出长度中超出 15 的部分: 若干个 255 和余数 */
+static uint8_t* _lzLen(uint8_t* op, size_t n)
+{
+    for(; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+/**
+ * @brief _lzCompress - 压缩一个块
+ * @param cap   输出缓冲区的大小
+ * @return 压缩后的长度, 不小于原始长度 (压缩无效) 时返回 0
+ */
+static size_t _lzCompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap, uint32_t* tab)
+{
+    const uint8_t* ip     = src;
+    const uint8_t* anchor = src;
+    const uint8_t* iend   = src + n;
+    const uint8_t* mlimit = iend - 12;      // 最后一个匹配至少在末尾 12 字节之前开始, 末尾 5 字节总是字面量
+    const uint8_t* mend   = iend - 5;
+    const uint8_t* ref;
+    const uint8_t* p;
+    uint8_t* op   = dst;
+    uint8_t* oend = dst + (cap < n ? cap : n);
+    uint8_t* token;
+    size_t   lit, mlen, miss = 0;
+    uint32_t seq, h;
+
+    memset(tab, 0, sizeof(uint32_t) << LZ_HASHBITS);
+    if(n > 12)
+    {
+        for(ip++; ip < mlimit; )
+        {
+            seq = _lzRead32(ip);
+            h   = _lzHash(seq);
+            ref = src + tab[h];
+            tab[h] = ip - src;
+            if(ref >= ip || ip - ref > LZ_MAXOFF || _lzRead32(ref) != seq)
+            {
+                ip += 1 + (miss++ >> 6);    // 连续找不到匹配时加大步长, 不可压缩的数据很快跳过
+                continue;
+            }
+            miss = 0;
+            while(ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+            for(p = ip + LZ_MINMATCH, ref += LZ_MINMATCH; p < mend && *p == *ref; p++, ref++)
+                ;
+            lit  = ip - anchor;
+            mlen = p - ip - LZ_MINMATCH;
+            if(op + 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1 > oend)
+                return 0;
+
+            token = op++;
+            *token = (uint8_t)((lit < 15 ? lit : 15) << 4 | (mlen < 15 ? mlen : 15));
+            if(lit >= 15)
+                op = _lzLen(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+            *op++ = (uint8_t)(p - ref);
+            *op++ = (uint8_t)((p - ref) >> 8);
+            if(mlen >= 15)
+                op = _lzLen(op, mlen - 15);
+
+            ip = anchor = p;
+            if(ip < mlimit)
+                tab[_lzHash(_lzRead32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    lit = iend - anchor;                    // 末尾的字面量
+    if(op + 1 + lit + lit / 255 + 1 > oend)
+        return 0;
+    *op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if(lit >= 15)
+        op = _lzLen(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst < (ptrdiff_t)n ? (size_t)(op - dst) : 0;
+}
+
+/**
+ * @brief _lzDecompress - 解压一个块, 输入可能已损坏, 所有长度和偏移都要检查
+ * @return 成功 (恰好得到 n 字节) 返回 0, 否则返回 -1
+ */
+static int _lzDecompress(const uint8_t* src, size_t clen, uint8_t* dst, size_t n)
+{
+    const uint8_t* ip   = src;
+    const uint8_t* iend = src + clen;
+    uint8_t* op   = dst;
+    uint8_t* oend = dst + n;
+    size_t   lit, mlen, off;
+    unsigned token, b;
+
+    while(ip < iend)
+    {
+        token = *ip++;
+        lit   = token >> 4;
+        if(15 == lit)
+            do
+            {
+                if(ip >= iend)  return -1;
+                b = *ip++;
+                lit += b;
+            }while(255 == b);
+        if(lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if(ip == iend)                      // 最后一个序列只有字面量
+            break;
+
+        if(iend - ip < 2)   return -1;
+        off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        mlen = token & 15;
+        if(15 == mlen)
+            do
+            {
+                if(ip >= iend)  return -1;
+                b = *ip++;
+                mlen += b;
+            }while(255 == b);
+        mlen += LZ_MINMATCH;
+        if(!off || off > (size_t)(op - dst) || mlen > (size_t)(oend - op))
+            return -1;
+        if(off >= mlen)
+            memcpy(op, op - off, mlen);
+        else                                // 与输出重叠, 逐字节复制
+            for(b = 0; b < mlen; b++)
+                op[b] = op[(ptrdiff_t)b - (ptrdiff_t)off];
+        op += mlen;
+    }
+    return op == oend ? 0 : -1;
+}
+
+static size_t _lzHeader(const struct LogLz* z, char* buf)
+{
+    uint32_t v = z ? z->block : 0;
+
+    memcpy(buf, LZ_MAGIC, 8);
+    memcpy(buf + 8, &v, 4);
+    memset(buf + 12, 0, 4);
+    return LZ_HDRSIZE;
+}
+
+/**
+ * @brief _lzNewFile - 块压缩模式下换了新文件 (轮转或清空), 写入文件头; 块的索引由写线程发现轮转后重新开始
+ * @return 写入的字节数
+ */
+static size_t _lzNewFile(LogPtr log, int fd)
+{
+    char buf[LZ_HDRSIZE];
+
+    _lzHeader(log->lz, buf);
+    return pwrite(fd, buf, LZ_HDRSIZE, 0) == LZ_HDRSIZE ? LZ_HDRSIZE : 0;
+}
+
+/* 写入本文件的索引, 之后文件不再追加块 */
+static void _lzFooter(LogPtr log, struct LogLz* z)
+{
+    char     ent[LZ_IDXENT];
+    char     tail[LZ_TRAILER];
+    uint64_t v;
+    size_t   i;
+    int      fd = z->fd;
+
+    for(i = 0; i < z->nidx; i++)
+    {
+        memcpy(ent,      &z->idx[i].off,  8);
+        memcpy(ent + 8,  &z->idx[i].clen, 4);
+        memcpy(ent + 12, &z->idx[i].rlen, 4);
+        memcpy(ent + 16, z->idx[i].tmin, LZ_TSLEN);
+        memcpy(ent + 36, z->idx[i].tmax, LZ_TSLEN);
+        _logSizeAdd(log, _writeAll(fd, ent, LZ_IDXENT), LZ_IDXENT);
+    }
+    v = z->nidx;
+    memcpy(tail, &v, 8);
+    memcpy(tail + 8, &z->off, 8);
+    memcpy(tail + 16, LZ_IDXMAGIC, 8);
+    _logSizeAdd(log, _writeAll(fd, tail, LZ_TRAILER), LZ_TRAILER);
+}
+
+/* 写线程: 文件已轮转或清空时, 给旧文件写入索引, 换到新文件 */
+static void _lzCheckFile(LogPtr log, struct LogLz* z)
+{
+    size_t nrot = __atomic_load_n(&log->nrot, __ATOMIC_ACQUIRE);
+    struct stat ost, nst;
+    int    fd, slot;
+
+    if(nrot == z->nrot)
+        return;
+    z->nrot = nrot;
+    fd = _logPin(log, &slot);
+    fd = fd >= 0 ? dup(fd) : -1;
+    _logUnpin(log, slot);
+    if(fd < 0 || fstat(fd, &nst))
+    {
+        if(fd >= 0)     close(fd);
+        return;
+    }
+    if(0 == fstat(z->fd, &ost) && (ost.st_ino != nst.st_ino || ost.st_dev != nst.st_dev))
+        _lzFooter(log, z);                  // 轮转: 旧文件已完整, 写入索引; 清空时还是同一个文件
+    close(z->fd);
+    z->fd   = fd;
+    z->off  = nst.st_size;
+    z->nidx = 0;
+}
+
+/**
+ * @brief _lzSeal - 写线程压缩块缓冲区中的记录, 作为一个块写入文件
+ */
+static void _lzSeal(LogPtr log)
+{
+    struct LogLz* z = log->lz;
+    uint32_t hd[4], rlen;
+    size_t   clen, total;
+    LzIdx*   n;
+
+    if(!z->len)     return;
+
+    _logFileShrink(log);
+    _lzCheckFile(log, z);
+
+    clen = _lzCompress((const uint8_t*)z->raw, z->len, (uint8_t*)z->out + LZ_BLKHEAD, z->len, z->tab);
+    rlen = z->len;
+    if(!clen)                               // 不可压缩, 原样保存
+    {
+        memcpy(z->out + LZ_BLKHEAD, z->raw, z->len);
+        clen  = z->len;
+        rlen |= LZ_RAW;
+    }
+    hd[0] = LZ_BLKMAGIC;
+    hd[1] = clen;
+    hd[2] = rlen;
+    hd[3] = _lzSum(z->out + LZ_BLKHEAD, clen);
+    memcpy(z->out, hd, 16);
+    memcpy(z->out + 16, z->tmin, LZ_TSLEN);
+    memcpy(z->out + 36, z->tmax, LZ_TSLEN);
+    total = LZ_BLKHEAD + clen;
+    _logSizeAdd(log, _writeAll(z->fd, z->out, total), total);
+
+    if(z->nidx == z->capidx)
+    {
+        n = (LzIdx*)realloc(z->idx, (z->capidx ? z->capidx * 2 : 64) * sizeof(LzIdx));
+        if(n)
+        {
+            z->idx     = n;
+            z->capidx  = z->capidx ? z->capidx * 2 : 64;
+        }
+    }
+    if(z->nidx < z->capidx)
+    {
+        n = &z->idx[z->nidx++];
+        n->off  = z->off;
+        n->clen = clen;
+        n->rlen = rlen;
+        memcpy(n->tmin, z->tmin, LZ_TSLEN);
+        memcpy(n->tmax, z->tmax, LZ_TSLEN);
+    }
+    z->off      += total;
+    z->rawbytes += z->len;
+    z->zbytes   += total;
+    z->len = 0;
+    memset(z->tmin, 0, LZ_TSLEN);
+    memset(z->tmax, 0, LZ_TSLEN);
+}
+
+/* 把时间 ts 计入当前块的时间范围 */
+static void _lzSpan(struct LogLz* z, const char* ts)
+{
+    if(!z->tmin[0] || memcmp(ts, z->tmin, 19) < 0)
+        memcpy(z->tmin, ts, 19);
+    if(memcmp(ts, z->tmax, 19) > 0)
+        memcpy(z->tmax, ts, 19);
+}
+
+/**
+ * @brief _lzAppend - 写线程把一批记录放入块缓冲区, 并更新块的时间范围, 满了就写出
+ * 先写出放不下这批记录的块, 再逐段拷贝; 每段只把在段内开头的记录的时间计入所在的块,
+ * 以半条记录开头的块还要计入这条记录的时间, 否则按时间范围还原时会跳过这个块, 丢掉记录的后半段.
+ * 切分点落在某条记录开头的 LZ_LINEHEAD 字节内时, 提前在这条记录之前结束块, 否则还原时读不到它的时间
+ */
+static void _lzAppend(LogPtr log, const char* buf, size_t len)
+{
+    struct LogLz* z = log->lz;
+    const char* end = buf + len;            // 时间可能跨越两段, 按整批记录的结尾解析
+    const char* p;
+    const char* e;
+    const char* ts;
+    const char* ls;
+    size_t n;
+
+    if(z->len && z->len + len > z->block)   // 块尽量在记录边界结束
+        _lzSeal(log);
+    while(len)
+    {
+        if(!z->len)
+        {
+            z->first = _statNow();
+            if(z->part && z->tlast[0])
+                _lzSpan(z, z->tlast);
+        }
+        n = z->block - z->len < len ? z->block - z->len : len;
+        if(n < len)
+        {
+            for(ls = buf + n; ls > buf && '\n' != ls[-1]; ls--)
+                ;                           // 切分点所在记录的开头
+            if(ls == buf && z->part)
+                ls = NULL;                  // 这一段都是上一条记录的后半段
+            if(ls && buf + n - ls < LZ_LINEHEAD && z->len + (ls - buf) > 0)
+            {
+                n = ls - buf;               // 在这条记录之前结束块
+                if(!n)
+                {
+                    _lzSeal(log);
+                    continue;
+                }
+            }
+        }
+        for(p = buf, e = buf + n; p < e; p = (ts = (const char*)memchr(p, '\n', e - p)) ? ts + 1 : e)
+        {
+            if((p > buf || !z->part) && (ts = _lzTime(p, end)))
+            {
+                _lzSpan(z, ts);
+                memcpy(z->tlast, ts, 19);
+            }
+        }
+        memcpy(z->raw + z->len, buf, n);
+        z->part = '\n' != buf[n - 1];
+        z->len += n;
+        buf    += n;
+        len    -= n;
+        if(z->len == z->block || len)       // 块已满, 或提前结束
+            _lzSeal(log);
+    }
+}
+
+/* 写线程每写完一批记录后调用: 按请求或超时写出块缓冲区 */
+static void _lzTick(LogPtr log)
+{
+    struct LogLz* z = log->lz;
+
+    if(__atomic_load_n(&z->sealreq, __ATOMIC_ACQUIRE))
+    {
+        _lzSeal(log);
+        __atomic_store_n(&z->sealreq, 0, __ATOMIC_RELEASE);
+    }
+    else if(z->len && _statNow() - z->first >= (uint64_t)LZ_FLUSH_MS * 1000000)
+        _lzSeal(log);
+}
+
+/* 写线程退出前: 写出剩余的记录和索引 */
+static void _lzClose(LogPtr log)
+{
+    struct LogLz* z = log->lz;
+
+    _lzSeal(log);
+    _lzCheckFile(log, z);
+    _lzFooter(log, z);
+    close(z->fd);
+    z->fd = -1;
+    logsysAdd(log, "Compressed %zu bytes to %zu bytes\n", z->rawbytes, z->zbytes);
+}
+
+static void _lzFree(struct LogLz* z)
+{
+    if(z->fd >= 0)
+        close(z->fd);
+    free(z->raw);
+    free(z->out);
+    free(z->tab);
+    free(z->idx);
+    free(z);
+}
+
+/* 按块头校验一个块, 返回块的总长度, 无效或不完整时返回 0 */
+static size_t _lzBlock(const char* p, const char* end, uint32_t* clen, uint32_t* rlen)
+{
+    uint32_t hd[4];
+
+    if(end - p < LZ_BLKHEAD)
+        return 0;
+    memcpy(hd, p, 16);
+    if(LZ_BLKMAGIC != hd[0] || (size_t)(end - p - LZ_BLKHEAD) < hd[1] || _lzSum(p + LZ_BLKHEAD, hd[1]) != hd[3])
+        return 0;
+    *clen = hd[1];
+    *rlen = hd[2];
+    return LZ_BLKHEAD + hd[1];
+}
+
+/**
+ * @brief _lzLoadIndex - 读取文件中块的索引: 有索引时直接读取, 否则依次扫描块头
+ * @param base  文件内容
+ * @param size  文件大小
+ * @param valid 若不为 NULL, 存放有效内容的长度 (不含索引和末尾不完整的块)
+ * @return 块数, 失败时返回 0; *idx 需由调用者释放
+ */
+static size_t _lzLoadIndex(const char* base, size_t size, LzIdx** idx, size_t* valid)
+{
+    const char* p;
+    uint64_t n, ioff;
+    uint32_t clen, rlen;
+    size_t   i, cap = 0, len, cnt = 0;
+    LzIdx*   x = NULL;
+    LzIdx*   t;
+
+    *idx = NULL;
+    if(valid)   *valid = LZ_HDRSIZE;
+    if(size >= LZ_HDRSIZE + LZ_TRAILER && 0 == memcmp(base + size - 8, LZ_IDXMAGIC, 8))
+    {
+        memcpy(&n,    base + size - LZ_TRAILER, 8);
+        memcpy(&ioff, base + size - LZ_TRAILER + 8, 8);
+        if(ioff >= LZ_HDRSIZE && ioff <= size - LZ_TRAILER && n == (size - LZ_TRAILER - ioff) / LZ_IDXENT
+           && (size - LZ_TRAILER - ioff) % LZ_IDXENT == 0 && (x = (LzIdx*)calloc(n ? n : 1, sizeof(LzIdx))))
+        {
+            for(i = 0, p = base + ioff; i < n; i++, p += LZ_IDXENT)
+            {
+                memcpy(&x[i].off,  p, 8);
+                memcpy(&x[i].clen, p + 8, 4);
+                memcpy(&x[i].rlen, p + 12, 4);
+                memcpy(x[i].tmin, p + 16, LZ_TSLEN);
+                memcpy(x[i].tmax, p + 36, LZ_TSLEN);
+                if(x[i].off < LZ_HDRSIZE || x[i].off + LZ_BLKHEAD + x[i].clen > ioff)
+                    break;
+            }
+            if(i == n)
+            {
+                *idx = x;
+                if(valid)   *valid = ioff;
+                return n;
+            }
+            free(x);
+            x = NULL;
+        }
+    }
+
+    for(p = base + LZ_HDRSIZE; (len = _lzBlock(p, base + size, &clen, &rlen)); p += len)
+    {
+        if(cnt == cap)
+        {
+            t = (LzIdx*)realloc(x, (cap ? cap * 2 : 64) * sizeof(LzIdx));
+            if(!t)  break;
+            x   = t;
+            cap = cap ? cap * 2 : 64;
+        }
+        x[cnt].off  = p - base;
+        x[cnt].clen = clen;
+        x[cnt].rlen = rlen;
+        memcpy(x[cnt].tmin, p + 16, LZ_TSLEN);
+        memcpy(x[cnt].tmax, p + 36, LZ_TSLEN);
+        cnt++;
+    }
+    if(valid)   *valid = p - base;
+    *idx = x;
+    return cnt;
+}
+
+/**
+ * @brief logSetCompress - 将异步日志切换为块压缩模式
+ * 写线程把记录压缩为独立的块写入文件, 调用者线程不做压缩; 使用 logDecode (或 logdecode 工具) 还原为文本,
+ * logDecodeRange 按块的时间索引只解压需要的部分. 文件大小限制按压缩后的大小计算.
+ * @param log       异步日志 (logCreateAsync)
+ * @param block_kb  块大小, 单位为 KB, 为 0 时使用 DF_LZ_BLOCK; 块越大压缩率越高, 按时间读取时解压的多余部分也越多
+ * @return 成功返回 LOG_OK; 不是异步日志, 已是二进制模式, 或文件不为空且不是块压缩文件时返回 LOG_ERR
+ * @note   应在添加日志之前调用; 文件已是块压缩文件时去掉末尾的索引后继续追加
+ */
+int logSetCompress(LogPtr log, size_t block_kb)
+{
+    struct LogLz* z;
+    LzIdx*   idx = NULL;
+    char     buf[LZ_HDRSIZE];
+    char*    base;
+    size_t   size, valid = LZ_HDRSIZE, n = 0;
+    int      fd;
+
+    if(!log)        return LOG_ERR;
+    if(log->lz)     return LOG_OK;
+    if(log->lazy)
+        _logOpenLazy(log);
+    if(!log->queue || log->map || log->bin || log->shared)
+    {
+        logsysAdd(log, "set compress err: only for async logs in text mode\n");
+        return LOG_ERR;
+    }
+    block_kb = block_kb ? block_kb : DF_LZ_BLOCK;
+    if(block_kb < 4 || block_kb > (1 << 20))
+        return LOG_ERR;
+
+    _lqFlush(log->queue);                   // 之前的记录以文本写入, 先写完再检查文件
+    fd = fileno(log->fp);                   // 不是共享模式, 写线程不会换文件
+    size = logFileSize(log);
+    if(size > 0)
+    {
+        if(pread(fd, buf, 8, 0) != 8 || memcmp(buf, LZ_MAGIC, 8))
+        {
+            logsysAdd(log, "set compress err: file is not empty\n");
+            return LOG_ERR;
+        }
+        base = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(MAP_FAILED == base)
+            return LOG_ERR;
+        n = _lzLoadIndex(base, size, &idx, &valid);
+        munmap(base, size);
+        if(ftruncate(fd, valid))            // 去掉索引和末尾不完整的块
+        {
+            free(idx);
+            return LOG_ERR;
+        }
+        _logSizeSync(log);
+    }
+
+    z = (struct LogLz*)calloc(1, sizeof(*z));
+    if(!z || !(z->raw = (char*)malloc(block_kb << 10)) || !(z->out = (char*)malloc(LZ_BLKHEAD + (block_kb << 10)))
+          || !(z->tab = (uint32_t*)malloc(sizeof(uint32_t) << LZ_HASHBITS)) || (z->fd = dup(fd)) < 0)
+    {
+        if(z)
+        {
+            z->fd = -1;
+            _lzFree(z);
+        }
+        free(idx);
+        return LOG_ERR;
+    }
+    z->block  = block_kb << 10;
+    z->idx    = idx;
+    z->nidx   = z->capidx = n;
+    z->off    = valid;
+    z->nrot   = __atomic_load_n(&log->nrot, __ATOMIC_RELAXED);
+    if(0 == size)
+    {
+        _lzHeader(z, buf);
+        _logSizeAdd(log, _writeAll(z->fd, buf, LZ_HDRSIZE), LZ_HDRSIZE);
+    }
+    __atomic_store_n(&log->lz, z, __ATOMIC_RELEASE);
+
+    logsysAdd(log, "Compress mode on, block: %u KB, %u blocks in file\n", (unsigned int)block_kb, (unsigned int)n);
+    return LOG_OK;
+}
+
+/* 请求写线程写出块缓冲区, 并等待完成 */
+static void _lzFlush(LogPtr log)
+{
+    struct LogLz* z = log->lz;
+    int spins = 0;
+
+    __atomic_store_n(&z->sealreq, 1, __ATOMIC_RELEASE);
+    while(__atomic_load_n(&z->sealreq, __ATOMIC_ACQUIRE))
+    {
+        _lqWake(log->queue);
+        _lqBackoff(&spins);
+    }
+}
+
+/* 按 key 给出的精度比较时间, 时间比 key 短 (精度低) 而前面相同时视为较小 */
+static int _lzTsCmp(const char* ts, size_t tlen, const char* key, size_t klen)
+{
+    int r = memcmp(ts, key, tlen < klen ? tlen : klen);
+    return r ? r : (tlen < klen ? -1 : 0);
+}
+
+/* 按时间范围输出还原后的文本: 带时间的行决定其所在记录是否输出, 之后不带时间的行跟随它 */
+static void _lzPut(LzRange* r, const char* p, size_t len, FILE* out)
+{
+    const char* end = p + len;
+    const char* e;
+    const char* ts;
+    size_t tlen;
+
+    if(!r->from && !r->to)
+    {
+        fwrite(p, 1, len, out);
+        return;
+    }
+    for(; p < end; p = e)
+    {
+        e = (e = (const char*)memchr(p, '\n', end - p)) ? e + 1 : end;
+        if((ts = _lzTime(p, end)))
+        {
+            for(tlen = 19; tlen < 26 && ts + tlen < end && ((ts[tlen] >= '0' && ts[tlen] <= '9') || '.' == ts[tlen]); tlen++)
+                ;
+            r->keep = !(r->from && _lzTsCmp(ts, tlen, r->from, r->flen) < 0)
+                   && !(r->to && _lzTsCmp(ts, tlen < r->tlen ? tlen : r->tlen, r->to, r->tlen) > 0);
+        }
+        if(r->keep)
+            fwrite(p, 1, e - p, out);
+    }
+}
+
+/* 块的时间范围 [tmin, tmax] 是否与 r 相交, 按两者中较低的精度比较 */
+static bool _lzOverlap(const LzRange* r, const LzIdx* x)
+{
+    if(!x->tmin[0])                         // 没有带时间的记录, 由前面的记录决定
+        return true;
+    if(r->from && memcmp(x->tmax, r->from, r->flen < 19 ? r->flen : 19) < 0)
+        return false;
+    if(r->to && memcmp(x->tmin, r->to, r->tlen < 19 ? r->tlen : 19) > 0)
+        return false;
+    return true;
+}
+
+/**
+ * @brief _lzDecFile - 还原一个块压缩文件, 只解压时间范围内的块
+ * @return 成功返回 LOG_OK; 文件无法打开, 不是块压缩文件或有损坏的块时返回 LOG_ERR
+ */
+static int _lzDecFile(const char* path, LzRange* r, FILE* out)
+{
+    struct stat st;
+    LzIdx*   idx = NULL;
+    char*    base;
+    char*    buf = NULL;
+    size_t   n, i, rlen, cap = 0;
+    int      fd, ret = LOG_ERR;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)  return LOG_ERR;
+    if(fstat(fd, &st) || st.st_size < LZ_HDRSIZE)
+        goto out_close;
+    base = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(MAP_FAILED == base)
+        goto out_close;
+    if(memcmp(base, LZ_MAGIC, 8))
+        goto out_unmap;
+
+    ret = LOG_OK;
+    n = _lzLoadIndex(base, st.st_size, &idx, NULL);
+    for(i = 0; i < n; i++)
+    {
+        if(!_lzOverlap(r, &idx[i]))
+        {
+            r->keep = false;
+            continue;
+        }
+        rlen = idx[i].rlen & ~LZ_RAW;
+        if(idx[i].rlen & LZ_RAW)
+        {
+            _lzPut(r, base + idx[i].off + LZ_BLKHEAD, rlen, out);
+            continue;
+        }
+        if(rlen > cap)
+        {
+            free(buf);
+            cap = rlen;
+            if(!(buf = (char*)malloc(cap)))
+            {
+                ret = LOG_ERR;
+                break;
+            }
+        }
+        if(_lzDecompress((const uint8_t*)base + idx[i].off + LZ_BLKHEAD, idx[i].clen, (uint8_t*)buf, rlen))
+        {
+            fprintf(out, "<logdecode: bad block at offset %llu>\n", (unsigned long long)idx[i].off);
+            ret = LOG_ERR;
+            continue;
+        }
+        _lzPut(r, buf, rlen, out);
+    }
+
+    free(buf);
+    free(idx);
+out_unmap:
+    munmap(base, st.st_size);
+out_close:
+    close(fd);
+    return ret;
+}
+
+/* ---------------------------- mmap writer ----------------------------------- */
+/* 内存映射写入:
+ * 打开文件时映射一段足够大的地址空间 (大小限制再加上几个 chunk 的余量), 但文件本身按 chunk 逐步 fallocate,
+ * 所以平时地址空间不需要重新映射. 写入时原子地增加 off 得到写入位置, 若该位置已分配则直接 memcpy,
+ * 否则先加锁分配新的 chunk; 超出映射范围的记录用 pwrite 写入并计数, 随后把映射范围加倍 (_lmGrow),
+ * logSetFileSize 调大限制时也同样重新映射. 重新映射时同一文件映射到另一个槽位, 旧槽位的 off 换成 LM_SEALED,
+ * 之后在旧槽位上取得的位置都不小于它, 写入者据此改到新槽位重试.
+ * 切换文件 (轮转/清空) 时, 新文件放在另一个槽位中, 替换 cur 后等待旧文件的 users 归零再关闭;
+ * 槽位不释放只复用, 所以拿着旧指针的线程增加 users 后再核对一次 cur 即可. 这样的线程随后会减回去,
+ * 所以复用槽位时不能把 users 清零, 而是等它归零后再打开新文件.
+ */
+typedef struct LogMapFile{
+    int    fd;                              // -1 表示此槽位未使用
+    char*  base;                            // 映射的起始地址
+    size_t cap;                             // 映射的长度
+    size_t alloc;                           // 已预分配的文件长度
+    size_t off;                             // 下一条记录的写入位置, 即逻辑上的文件大小
+    int    users;                           // 正在写入此文件的线程数
+}LogMapFile;
+
+#define LM_SEALED   ((size_t)1 << 62)       // 已重新映射到另一个槽位的 off
+#define LM_HOLEWIN  ((size_t)1 << 20)       // 恢复时检查空洞的范围: 有效内容结尾之前的 1 M
+
+struct LogMap{
+    LogMapFile  f[2];
+    LogMapFile* cur;                        // 当前写入的文件
+    size_t      chunk;                      // 每次预分配的大小
+    pthread_mutex_t mtx;                    // 预分配时使用
+    pthread_mutex_t swapmtx;                // 切换文件和重新映射时使用
+    size_t      nfall;                      // 计数: 超出映射范围改用 pwrite 写入的记录数
+};
+
+/**
+ * @brief _lmHoles - 处理有效内容中的空洞
+ * 崩溃时其它线程可能已取得了写入位置但还没拷贝记录, 这些位置在有效内容中间留下一段 0. 只会出现在崩溃前
+ * 正在写入的记录处, 所以只检查结尾之前的 LM_HOLEWIN 字节. 文本文件中把每段 0 换成空格并以 '\n' 结尾, 成为一个空行;
+ * 二进制文件保持不变, 由 logDecode 在记录之间跳过 0
+ */
+static void _lmHoles(int fd, size_t end)
+{
+    char   buf[65536], c;
+    size_t pos = end > LM_HOLEWIN ? end - LM_HOLEWIN : 0, n, i, j;
+
+    if(pread(fd, buf, 8, 0) == 8 && 0 == memcmp(buf, LB_MAGIC, 8))
+        return;
+    for(; pos < end; pos += n)
+    {
+        n = end - pos < sizeof(buf) ? end - pos : sizeof(buf);
+        if(pread(fd, buf, n, pos) != (ssize_t)n)
+            return;
+        if(!memchr(buf, 0, n))
+            continue;
+        for(i = 0; i < n; i = j)
+        {
+            for(j = i; j < n && !buf[j]; j++)
+                buf[j] = ' ';
+            if(j > i && (j < n || (pread(fd, &c, 1, pos + n) == 1 && c)))    // 跨越缓冲区的空洞在下一段中结尾
+                buf[j - 1] = '\n';
+            for(; j < n && buf[j]; j++)
+                ;
+        }
+        if(pwrite(fd, buf, n, pos) != (ssize_t)n)
+            return;
+    }
+}
+
+/**
+ * @brief _lmRecover - 找到文件中有效内容的结尾
+ * 预分配的部分全是 0, 而文本记录中不会出现 0, 所以从后往前跳过 0 即可; 之后再处理结尾之前的空洞.
+ * 正常关闭时已截掉, 只有上次程序崩溃时才会有
+ */
+static size_t _lmRecover(int fd, size_t size)
+{
+    char   buf[65536];
+    size_t end = size, start, n;
+
+    while(end)
+    {
+        n     = end < sizeof(buf) ? end : sizeof(buf);
+        start = end - n;
+        if(pread(fd, buf, n, start) != (ssize_t)n)
+            break;
+        while(n && !buf[n - 1])
+            n--;
+        if(n)
+        {
+            end = start + n;
+            if(end != size)                 // 有预分配的部分, 说明上次没有正常关闭
+                _lmHoles(fd, end);
+            return end;
+        }
+        end = start;
+    }
+    return end;
+}
+
+static int _lmOpen(LogMapFile* f, const char* path, size_t cap)
+{
+    struct stat st;
+    size_t end;
+
+    f->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(f->fd < 0)
+        return LOG_ERR;
+    if(fstat(f->fd, &st))
+        goto err;
+
+    end = _lmRecover(f->fd, st.st_size);
+    if(end != (size_t)st.st_size && ftruncate(f->fd, end))
+        goto err;
+
+    f->base = (char*)mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if(MAP_FAILED == f->base)
+        goto err;
+    f->cap   = cap;
+    f->alloc = end;
+    f->off   = end;
+    return LOG_OK;
+
+err:
+    close(f->fd);
+    f->fd = -1;
+    return LOG_ERR;
+}
+
+/* 解除映射并关闭, 不截断文件, 用于重新映射后的旧槽位 */
+static void _lmUnmap(LogMapFile* f)
+{
+    munmap(f->base, f->cap);
+    close(f->fd);
+    f->fd = -1;
+}
+
+static void _lmClose(LogMapFile* f)
+{
+    if(f->fd < 0)   return;
+
+    munmap(f->base, f->cap);
+    if(f->alloc > f->off && ftruncate(f->fd, f->off))    // 截掉预分配未使用的部分
+        logsysAdd(NULL, "%s(%d)-[mmap]: %s\n", __FILE__, __LINE__, strerror(errno));
+    close(f->fd);
+    f->fd = -1;
+}
+
+/* 预分配文件, 直到覆盖 need 或到达映射的结尾 */
+static void _lmExtend(struct LogMap* m, LogMapFile* f, size_t need)
+{
+    size_t n;
+
+    pthread_mutex_lock(&m->mtx);
+    while(f->alloc < need && f->alloc < f->cap)
+    {
+        n = f->cap - f->alloc < m->chunk ? f->cap - f->alloc : m->chunk;
+        if(posix_fallocate(f->fd, f->alloc, n))
+            break;
+        __atomic_store_n(&f->alloc, f->alloc + n, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&m->mtx);
+}
+
+static size_t _lmCap(size_t chunk, size_t maxsize)
+{
+    size_t cap = maxsize ? maxsize + 4 * chunk : LOG_MAP_MAXCAP;
+
+    return (cap + chunk - 1) / chunk * chunk;
+}
+
+static struct LogMap* _lmCreate(const char* path, size_t chunk, size_t maxsize)
+{
+    struct LogMap* m = (struct LogMap*)calloc(1, sizeof(*m));
+    size_t cap = _lmCap(chunk, maxsize);
+
+    if(!m)  return NULL;
+    m->chunk   = chunk;
+    m->f[0].fd = -1;
+    m->f[1].fd = -1;
+    if(LOG_ERR == _lmOpen(&m->f[0], path, cap))
+    {
+        free(m);
+        return NULL;
+    }
+    m->cur = &m->f[0];
+    pthread_mutex_init(&m->mtx, NULL);
+    pthread_mutex_init(&m->swapmtx, NULL);
+    _lmExtend(m, m->cur, m->cur->off + 1);
+    return m;
+}
+
+static void _lmDestroy(struct LogMap* m)
+{
+    _lmClose(&m->f[0]);
+    _lmClose(&m->f[1]);
+    pthread_mutex_destroy(&m->mtx);
+    pthread_mutex_destroy(&m->swapmtx);
+    free(m);
+}
+
+static size_t _lmSize(struct LogMap* m)
+{
+    size_t off;
+
+    while((off = __atomic_load_n(&__atomic_load_n(&m->cur, __ATOMIC_ACQUIRE)->off, __ATOMIC_RELAXED)) >= LM_SEALED)
+        sched_yield();                      // 正在重新映射, 马上会换到新槽位
+    return off;
+}
+
+static size_t _lmWrite(struct LogMap* m, const char* rec, size_t len)
+{
+    LogMapFile* f;
+    size_t o, cap = 0;
+
+    for(;;)
+    {
+        f = __atomic_load_n(&m->cur, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&f->users, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&m->cur, __ATOMIC_SEQ_CST) == f)
+        {
+            o = __atomic_fetch_add(&f->off, len, __ATOMIC_RELAXED);
+            if(o < LM_SEALED)
+                break;
+        }
+        __atomic_fetch_sub(&f->users, 1, __ATOMIC_RELEASE);   // 文件刚被切换或重新映射, 重试
+        sched_yield();
+    }
+
+    if(o + len > __atomic_load_n(&f->alloc, __ATOMIC_ACQUIRE))
+        _lmExtend(m, f, o + len);
+    if(o + len <= __atomic_load_n(&f->alloc, __ATOMIC_ACQUIRE))
+        memcpy(f->base + o, rec, len);
+    else
+    {
+        len = pwrite(f->fd, rec, len, o) == (ssize_t)len ? len : 0;
+        __atomic_fetch_add(&m->nfall, 1, __ATOMIC_RELAXED);
+        if(o + len > f->cap)                // 已到映射的结尾, 而不是 fallocate 失败
+            cap = f->cap * 2;
+    }
+
+    __atomic_fetch_sub(&f->users, 1, __ATOMIC_RELEASE);
+    if(cap)
+        _lmGrow(m, cap);                    // 要等旧槽位的写入者退出, 所以先注销自己
+    return len;
+}
+
+static int _lmSync(struct LogMap* m)
+{
+    LogMapFile* f;
+    int ret;
+
+    for(;;)
+    {
+        f = __atomic_load_n(&m->cur, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&f->users, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&m->cur, __ATOMIC_SEQ_CST) == f)
+            break;
+        __atomic_fetch_sub(&f->users, 1, __ATOMIC_RELEASE);
+    }
+    ret = fdatasync(f->fd);                 // 共享映射中修改过的页面也会被写回
+    __atomic_fetch_sub(&f->users, 1, __ATOMIC_RELEASE);
+    return ret;
+}
+
+static int _lmSwap(LogPtr log)
+{
+    struct LogMap* m = log->map;
+    LogMapFile* of;
+    LogMapFile* nf;
+
+    pthread_mutex_lock(&m->swapmtx);
+    of = m->cur;
+    nf = of == &m->f[0] ? &m->f[1] : &m->f[0];
+    while(__atomic_load_n(&nf->users, __ATOMIC_SEQ_CST))   // 拿着更早的指针, 刚增加了 users 还没减回去的线程
+        sched_yield();
+    if(LOG_ERR == _lmOpen(nf, log->path, of->cap))
+    {
+        pthread_mutex_unlock(&m->swapmtx);
+        return LOG_ERR;
+    }
+    if(log->bin && 0 == nf->off)
+        nf->off = nf->alloc = _lbNewFile(log, nf->fd);
+    _lmExtend(m, nf, nf->off + 1);
+
+    __atomic_store_n(&m->cur, nf, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&of->users, __ATOMIC_SEQ_CST))   // 等待仍在写旧文件的线程
+        sched_yield();
+    _lmClose(of);
+    _logSizeSync(log);
+    pthread_mutex_unlock(&m->swapmtx);
+
+    return LOG_OK;
+}
+
+/**
+ * @brief _lmGrow - 把当前文件按 cap 重新映射到另一个槽位
+ * 旧槽位的 off 换成 LM_SEALED, 已取得位置的写入者仍通过旧映射写入同一文件, 之后的写入者改到新槽位;
+ * 等旧槽位的写入者都退出后再解除旧映射. 已不小于 cap 时什么也不做
+ */
+static void _lmGrow(struct LogMap* m, size_t cap)
+{
+    LogMapFile* of;
+    LogMapFile* nf;
+
+    pthread_mutex_lock(&m->swapmtx);
+    of = m->cur;
+    if(of->cap >= cap)
+        goto out;
+    nf = of == &m->f[0] ? &m->f[1] : &m->f[0];
+    while(__atomic_load_n(&nf->users, __ATOMIC_SEQ_CST))
+        sched_yield();
+    if((nf->fd = dup(of->fd)) < 0)
+        goto out;
+    nf->base = (char*)mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, nf->fd, 0);
+    if(MAP_FAILED == nf->base)
+    {
+        close(nf->fd);
+        nf->fd = -1;
+        goto out;
+    }
+    nf->cap = cap;
+
+    pthread_mutex_lock(&m->mtx);
+    nf->off   = __atomic_exchange_n(&of->off, LM_SEALED, __ATOMIC_SEQ_CST);
+    nf->alloc = of->alloc;
+    pthread_mutex_unlock(&m->mtx);
+    __atomic_store_n(&m->cur, nf, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&of->users, __ATOMIC_SEQ_CST))
+        sched_yield();
+    pthread_mutex_lock(&m->mtx);            // 旧槽位的写入者可能在替换之后又预分配过
+    if(of->alloc > nf->alloc)
+        __atomic_store_n(&nf->alloc, of->alloc, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&m->mtx);
+    _lmUnmap(of);
+out:
+    pthread_mutex_unlock(&m->swapmtx);
+}
+
+static void _lmLimit(struct LogMap* m, size_t maxsize)
+{
+    _lmGrow(m, _lmCap(m->chunk, maxsize));
+}
+
+/* ---------------------------- shared mode ----------------------------------- */
+/* 多进程共享模式 (logSetShared):
+ * 多个进程各自打开同一个文件 (O_APPEND), 每条记录 (或刷新缓冲区中的一批完整记录) 一次 write 写入, 内核保证追加写入
+ * 不会交错, 所以写记录时不需要加锁. 文件大小, 轮转和清空由映射自 path.shm 的控制块协调:
+ *      各进程写入后把字节数原子累加到控制块的 size, 超过上限时由某个进程的后台线程持有控制块的锁轮转或清空文件,
+ *      并把代数 gen 加 1; 其它进程发现 gen 变化 (或随后也请求轮转, 拿到锁时发现 gen 已变) 后只切换到新文件.
+ * 切换之前其它进程仍会把完整的记录追加到已归档的文件中, 这部分计入了新文件的 size, 所以大小只是近似值.
+ * 锁是 robust 的, 持有锁的进程崩溃时下一个进程可以继续使用.
+ */
+
+static bool _lpLock(LogPtr log)
+{
+    struct LogShared* s = log->shared;
+    struct stat a, b;
+
+    if(EOWNERDEAD == pthread_mutex_lock(&s->m->mtx))   // 上一个持有者崩溃了, 文件最多只是少轮转一次
+        pthread_mutex_consistent(&s->m->mtx);
+    if(__atomic_load_n(&s->m->gen, __ATOMIC_ACQUIRE) == s->gen)
+        return true;
+    /* 轮转后 path 是新的文件, 清空时仍是原来的文件 */
+    if(stat(log->path, &a) || fstat(fileno(log->fp), &b) || a.st_ino != b.st_ino || a.st_dev != b.st_dev)
+        _logReopen(log);
+    else
+        _logSizeSync(log);
+    s->gen = s->m->gen;
+    return false;
+}
+
+static void _lpUnlock(LogPtr log, bool done)
+{
+    struct LogShared* s = log->shared;
+
+    if(done)
+    {
+        __atomic_store_n(&s->m->size, __atomic_load_n(&log->cursize, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&s->m->gen, s->m->gen + 1, __ATOMIC_RELEASE);
+        s->gen = s->m->gen;
+    }
+    pthread_mutex_unlock(&s->m->mtx);
+}
+
+/* 打开并映射 path.shm, 第一个打开的进程持有文件锁初始化控制块 */
+static struct LogShm* _lpMap(const char* path)
+{
+    struct LogShm* m = (struct LogShm*)MAP_FAILED;
+    pthread_mutexattr_t attr;
+    struct stat st;
+    int fd;
+
+    if((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+        return NULL;
+    flock(fd, LOCK_EX);
+    if(0 == fstat(fd, &st) && (st.st_size >= (off_t)sizeof(*m) || 0 == ftruncate(fd, sizeof(*m))))
+        m = (struct LogShm*)mmap(NULL, sizeof(*m), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(m != MAP_FAILED && memcmp(m->magic, LP_MAGIC, 8))
+    {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&m->mtx, &attr);
+        pthread_mutexattr_destroy(&attr);
+        m->size = 0;
+        m->gen  = 0;
+        memcpy(m->magic, LP_MAGIC, 8);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return m == MAP_FAILED ? NULL : m;
+}
+
+/**
+ * @brief logSetShared - 开启/关闭多进程共享模式
+ * 共享同一个文件的每个进程在创建日志之后都要调用; fork 出的子进程应在 fork 之后自己创建日志
+ * @param log
+ * @param on
+ * @return 成功返回 LOG_OK, 失败返回 LOG_ERR
+ * @note  需在没有其它线程写此日志时调用; 不能用于内存映射, 二进制和块压缩模式;
+ *        各进程应设置相同的大小限制和轮转方式 (logSetFileSize, logSetRotate)
+ */
+int logSetShared(LogPtr log, bool on)
+{
+    struct LogShared* s;
+    char path[PATH_MAX];
+
+    if(!log)    return LOG_ERR;
+    if(!on)
+    {
+        if((s = log->shared))
+        {
+            log->shared = NULL;
+            munmap(s->m, sizeof(*s->m));
+            free(s);
+        }
+        return LOG_OK;
+    }
+    if(log->shared) return LOG_OK;
+    if(log->lazy)
+        _logOpenLazy(log);
+    if(!log->fp || log->map || log->bin || log->lz)
+    {
+        logsysAdd(log, "set shared err: only for text logs written through a file\n");
+        return LOG_ERR;
+    }
+
+    snprintf(path, sizeof(path), "%s.shm", log->path);
+    if(!(s = (struct LogShared*)calloc(1, sizeof(*s))) || !(s->m = _lpMap(path)))
+    {
+        logsysAdd(log, "set shared err: \"%s\" %s\n", path, strerror(errno));
+        free(s);
+        return LOG_ERR;
+    }
+    s->gen = ~s->m->gen;                    // 与当前代数不同, _lpLock 会检查打开的是否仍是 path, 并同步大小
+    log->shared = s;
+    _lpLock(log);
+    __atomic_store_n(&s->m->size, __atomic_load_n(&log->cursize, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    _lpUnlock(log, false);
+    logsysAdd(log, "shared with other processes, control block: \"%s\"\n", path);
+    return LOG_OK;
+}
+
+/* ---------------------------- service thread -------------------------------- */
+/* 后台服务线程, 处理文件轮转, 定时写入计数等不应该在写日志的线程中进行的操作.
+ * 写日志的线程只需把日志挂到待处理链表上, 在第一次需要时才启动 */
+static LogPtr          _svc_list    = NULL;     // 待轮转的日志
+static LogPtr          _svc_cur     = NULL;     // 正在轮转的日志
+static bool            _svc_running = false;
+static pthread_t       _svc_thread;
+static pthread_mutex_t _svc_mtx  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  _svc_cond = PTHREAD_COND_INITIALIZER;    // 有新的请求
+static pthread_cond_t  _svc_done = PTHREAD_COND_INITIALIZER;    // 一次轮转已完成
+static int             _svc_dumpint  = 0;       // 定时写入计数的间隔, 单位为秒, 为 0 表示不写入
+static time_t          _svc_dumpnext = 0;       // 下次写入计数的时间
+static pthread_mutex_t _svc_dumpmtx  = PTHREAD_MUTEX_INITIALIZER;  // 写入计数期间持有, 停止时用于等待
+static struct LogFlush* _svc_flush = NULL;      // 需要定时写出或同步到磁盘的刷新策略
+static struct LogFlush* _svc_fcur  = NULL;      // 正在处理的刷新策略
+
+/**
+ * @brief _logRotate - 轮转日志文件, 只在后台线程中调用
+ * 重命名 path -> path.1 -> ... -> path.N, 打开新的 path, 再替换 log->fp;
+ * 共享模式下持有控制块的锁进行, 若其它进程已经轮转过, 只切换到新文件
+ */
+static void _logRotate(LogPtr log)
+{
+    char  from[PATH_MAX], to[PATH_MAX];
+    bool  done = false;
+    int   i;
+
+    if(log->shared && !_lpLock(log))        // 其它进程已经轮转或清空了文件, 已切换过去
+    {
+        _lpUnlock(log, false);
+        return;
+    }
+    if(!log->rotkeep)                       // 只按时间 (共享模式下也按大小) 清空文件
+    {
+        done = _logEmpty(log) >= 0;
+        goto out;
+    }
+
+    for(i = log->rotkeep - 1; i >= 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", log->path, i);
+        snprintf(to,   sizeof(to),   "%s.%d", log->path, i + 1);
+        rename(from, to);                   // 归档不存在时失败, 忽略即可
+    }
+    snprintf(to, sizeof(to), "%s.1", log->path);
+    if(rename(log->path, to))
+    {
+        logsysAdd(log, "%s(%d)-[rotate]: \"%s\" %s\n", __FILE__, __LINE__, log->path, strerror(errno));
+        goto out;
+    }
+
+    if(log->map)
+    {
+        if(LOG_ERR == _lmSwap(log))
+        {
+            logsysAdd(log, "%s(%d)-[rotate]: \"%s\" %s\n", __FILE__, __LINE__, log->path, strerror(errno));
+            goto out;
+        }
+    }
+    else if(!_logReopen(log))
+        goto out;
+
+    done = true;
+    __atomic_fetch_add(&log->nrot, 1, __ATOMIC_RELAXED);
+    logsysAdd(log, "Log file rotated, archive: \"%s\"\n", to);
+out:
+    if(log->shared)
+        _lpUnlock(log, done);
+}
+
+/**
+ * @brief _logReopen - 打开新的 path, 再替换 log->fp
+ * 原来的文件流可能仍有线程在写入, 留到下次轮转时, 等 _logPin 登记在它那一代的写入者都退出后再关闭
+ * (那时早已退出, 一般不需要等待), 不在持有控制块的锁时阻塞在正在写入的线程上;
+ * 只由持有轮转请求的线程 (共享模式下还持有控制块的锁) 调用, 不会并发
+ */
+static bool _logReopen(LogPtr log)
+{
+    FILE*    nfp;
+    FILE*    ofp;
+    unsigned g;
+
+    if(!(nfp = fopen(log->path, "a+")))
+    {
+        logsysAdd(log, "%s(%d)-[rotate]: \"%s\" %s\n", __FILE__, __LINE__, log->path, strerror(errno));
+        return false;
+    }
+    if(log->bin)
+        _lbNewFile(log, fileno(nfp));       // 在替换之前写入文件头, 保证它在文件的最前面
+    if(log->lz)
+        _lzNewFile(log, fileno(nfp));
+    g = __atomic_load_n(&log->fgen, __ATOMIC_RELAXED);
+    while(__atomic_load_n(&log->fusers[(g + 1) & 1], __ATOMIC_SEQ_CST))    // 上一个文件的写入者, 该槽即将给新文件使用
+        sched_yield();
+    if(log->oldfp)
+        fclose(log->oldfp);
+    ofp = __atomic_exchange_n(&log->fp, nfp, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&log->fgen, g + 1, __ATOMIC_SEQ_CST);
+    log->oldfp = ofp;                       // 可能仍有登记在槽 g & 1 上的线程在写入
+    _logSizeSync(log);
+    return true;
+}
+
+/* 处理到期的刷新策略, 返回最早的下一次到期时间 (单调时钟), 只在持有 _svc_mtx 时调用 */
+static uint64_t _svcFlushTick()
+{
+    struct LogFlush* f;
+    uint64_t due, next;
+
+again:
+    next = UINT64_MAX;
+    for(f = _svc_flush; f; f = f->next)
+    {
+        if((due = _lfDue(f, _statNow())) <= _statNow())
+        {
+            _svc_fcur = f;
+            pthread_mutex_unlock(&_svc_mtx);
+            _lfTick(f);
+            pthread_mutex_lock(&_svc_mtx);
+            _svc_fcur = NULL;
+            pthread_cond_broadcast(&_svc_done);
+            goto again;                     // 解锁期间链表可能已改变
+        }
+        if(due < next)
+            next = due;
+    }
+    return next;
+}
+
+/* 计算等待的绝对时间 (CLOCK_REALTIME): 定时写入计数的时间和刷新策略的到期时间 due (单调时钟) 中较早的一个 */
+static void _svcDeadline(struct timespec* ts, uint64_t due)
+{
+    uint64_t now, wait;
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    if(due != UINT64_MAX)
+    {
+        now  = _statNow();
+        wait = due > now ? due - now : 0;
+        if(_svc_dumpint <= 0 || (time_t)(ts->tv_sec + wait / 1000000000) < _svc_dumpnext)
+        {
+            ts->tv_sec  += wait / 1000000000;
+            ts->tv_nsec += wait % 1000000000;
+            if(ts->tv_nsec >= 1000000000)
+            {
+                ts->tv_sec++;
+                ts->tv_nsec -= 1000000000;
+            }
+            return;
+        }
+    }
+    ts->tv_sec  = _svc_dumpnext;
+    ts->tv_nsec = 0;
+}
+
+/* 轮转一个已从待处理链表中取下的日志, 然后允许再次请求 */
+static void _svcDoRotate(LogPtr log)
+{
+    time_t now;
+
+    _logRotate(log);
+    if(log->rotint)
+    {
+        now = time(NULL);
+        log->rotnext = (now / log->rotint + 1) * log->rotint;
+    }
+    __atomic_store_n(&log->rotating, 0, __ATOMIC_RELEASE);
+}
+
+static void* _svcThread(void* arg)
+{
+    LogPtr log;
+    time_t now;
+    uint64_t due;
+    struct timespec ts;
+
+    (void)arg;
+    pthread_mutex_lock(&_svc_mtx);
+    for(;;)
+    {
+        while(!_svc_list)
+        {
+            if(_svc_dumpint > 0 && (now = time(NULL)) >= _svc_dumpnext)
+            {
+                _svc_dumpnext = now + _svc_dumpint;
+                pthread_mutex_lock(&_svc_dumpmtx);
+                pthread_mutex_unlock(&_svc_mtx);
+                logsysDump();
+                pthread_mutex_unlock(&_svc_dumpmtx);
+                pthread_mutex_lock(&_svc_mtx);
+                continue;
+            }
+            due = _svcFlushTick();
+            if(_svc_list)
+                break;
+            if(_svc_dumpint > 0 || due != UINT64_MAX)
+            {
+                _svcDeadline(&ts, due);
+                pthread_cond_timedwait(&_svc_cond, &_svc_mtx, &ts);
+            }
+            else
+                pthread_cond_wait(&_svc_cond, &_svc_mtx);
+        }
+
+        log       = _svc_list;
+        _svc_list = log->svcnext;
+        _svc_cur  = log;
+        pthread_mutex_unlock(&_svc_mtx);
+
+        _svcDoRotate(log);
+
+        pthread_mutex_lock(&_svc_mtx);
+        _svc_cur = NULL;
+        pthread_cond_broadcast(&_svc_done);
+    }
+    return NULL;
+}
+
+/* fork 时持有 _svc_mtx, 子进程中没有后台线程, 清除继承来的请求, 需要时重新启动 */
+static void _svcForkPrepare()
+{
+    pthread_mutex_lock(&_svc_mtx);
+}
+
+static void _svcForkParent()
+{
+    pthread_mutex_unlock(&_svc_mtx);
+}
+
+static void _svcForkChild()
+{
+    LogPtr log;
+
+    for(log = _svc_list; log; log = log->svcnext)
+        log->rotating = 0;
+    if(_svc_cur)
+        _svc_cur->rotating = 0;
+    _svc_list    = NULL;
+    _svc_cur     = NULL;
+    _svc_running = false;
+    pthread_cond_init(&_svc_cond, NULL);
+    pthread_cond_init(&_svc_done, NULL);
+    pthread_mutex_unlock(&_svc_mtx);
+}
+
+/* 启动后台线程 (若还未启动), 只在持有 _svc_mtx 时调用 */
+static bool _svcStart()
+{
+    static bool atfork = false;
+
+    if(_svc_running)
+        return true;
+    if(!atfork)
+        atfork = 0 == pthread_atfork(_svcForkPrepare, _svcForkParent, _svcForkChild);
+    if(pthread_create(&_svc_thread, NULL, _svcThread, NULL))
+        return false;
+    pthread_detach(_svc_thread);
+    _svc_running = true;
+    return true;
+}
+
+static void _svcRotate(LogPtr log)
+{
+    if(__atomic_exchange_n(&log->rotating, 1, __ATOMIC_ACQ_REL))
+        return;                             // 已经请求过了
+
+    pthread_mutex_lock(&_svc_mtx);
+    if(!_svcStart())
+    {
+        pthread_mutex_unlock(&_svc_mtx);
+        __atomic_store_n(&log->rotating, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    log->svcnext = _svc_list;
+    _svc_list    = log;
+    pthread_cond_signal(&_svc_cond);
+    pthread_mutex_unlock(&_svc_mtx);
+}
+
+/**
+ * @brief _svcFinish - 完成日志的轮转请求
+ * 还在待处理链表中的请求取下后在调用者线程中轮转, 后台线程正在处理的等待其完成;
+ * 用于 logFlush 和 logDestroy, 不丢弃请求, 否则文件会一直超出大小限制, 也不会产生归档
+ */
+static void _svcFinish(LogPtr log)
+{
+    LogPtr* pp;
+    bool    pending = false;
+
+    if(!__atomic_load_n(&log->rotating, __ATOMIC_ACQUIRE))
+        return;                             // 没有请求, 也没有正在进行的轮转
+    pthread_mutex_lock(&_svc_mtx);
+    for(pp = &_svc_list; *pp; pp = &(*pp)->svcnext)
+    {
+        if(*pp == log)
+        {
+            *pp = log->svcnext;
+            pending = true;
+            break;
+        }
+    }
+    while(_svc_cur == log)
+        pthread_cond_wait(&_svc_done, &_svc_mtx);
+    pthread_mutex_unlock(&_svc_mtx);
+    if(pending)
+        _svcDoRotate(log);
+}
+
+/**
+ * @brief logsysSetDumpInterval - 设置定时将各日志的计数写入系统日志 (logsysDump)
+ * @param sec   间隔, 单位为秒, 为 0 时停止
+ * @note  由后台线程写入, 不影响写日志的线程; logsysStop 时会停止
+ */
+void logsysSetDumpInterval(int sec)
+{
+    if(sec <= 0)
+    {
+        _svcDumpStop();
+        return;
+    }
+
+    pthread_mutex_lock(&_svc_mtx);
+    if(_svcStart())
+    {
+        _svc_dumpint  = sec;
+        _svc_dumpnext = time(NULL) + sec;
+        pthread_cond_signal(&_svc_cond);
+    }
+    pthread_mutex_unlock(&_svc_mtx);
+}
+
+static void _svcFlushAdd(struct LogFlush* f)
+{
+    bool timed = (f->bytes && f->ms) || f->syncms;
+
+    pthread_mutex_lock(&_svc_mtx);
+    if(timed && !f->listed && _svcStart())
+    {
+        f->next    = _svc_flush;
+        _svc_flush = f;
+        f->listed  = true;
+    }
+    pthread_cond_signal(&_svc_cond);        // 间隔可能变短了, 重新计算等待时间
+    pthread_mutex_unlock(&_svc_mtx);
+}
+
+static void _svcFlushDel(struct LogFlush* f)
+{
+    struct LogFlush** pp;
+
+    pthread_mutex_lock(&_svc_mtx);
+    for(pp = &_svc_flush; *pp; pp = &(*pp)->next)
+    {
+        if(*pp == f)
+        {
+            *pp = f->next;
+            break;
+        }
+    }
+    f->listed = false;
+    while(_svc_fcur == f)
+        pthread_cond_wait(&_svc_done, &_svc_mtx);
+    pthread_mutex_unlock(&_svc_mtx);
+}
+
+static void _svcDumpStop()
+{
+    pthread_mutex_lock(&_svc_mtx);
+    _svc_dumpint = 0;
+    pthread_mutex_unlock(&_svc_mtx);
+
+    pthread_mutex_lock(&_svc_dumpmtx);      // 等待正在进行的一次写入完成
+    pthread_mutex_unlock(&_svc_dumpmtx);
+}
+
+/* ---------------------------- statistics ----------------------------------- */
+/* 每条记录都要更新的计数 (记录数) 和延迟直方图按线程分片, 线程第一次写日志时轮流分配一个分片下标,
+ * 各分片独占缓存行, 线程数不超过 LOG_STAT_SHARDS 时互不竞争; 超过时共用分片, 仍是原子操作, 只是可能竞争.
+ * 读取时把各分片相加, 可以在写日志的同时进行. 其它很少变化的计数直接放在 Log 中.
+ * 直方图: 小于 LOG_HIST_SUB 的值各占一个区间, 之后每个 [2^k, 2^(k+1)) 再等分为 LOG_HIST_SUB 个子区间.
+ */
+static __thread int _stat_idx = -1;         // 本线程使用的分片下标
+static int          _stat_next = 0;
+
+static void _statFree(LogPtr log)
+{
+    int i;
+
+    for(i = 0; i < LOG_STAT_SHARDS; i++)
+    {
+        free(log->shards[i].add);
+        free(log->shards[i].disk);
+    }
+}
+
+static struct LogShard* _logShard(LogPtr log)
+{
+    if(_stat_idx < 0)
+        _stat_idx = __atomic_fetch_add(&_stat_next, 1, __ATOMIC_RELAXED) & (LOG_STAT_SHARDS - 1);
+    return &log->shards[_stat_idx];
+}
+
+static uint64_t _statNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int _histBucket(uint64_t v)
+{
+    int msb;
+
+    if(v < LOG_HIST_SUB)
+        return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - 2) * LOG_HIST_SUB + (int)((v >> (msb - 3)) & (LOG_HIST_SUB - 1));
+}
+
+/* 区间 b 的下界, 上界为 _histLow(b + 1) */
+static uint64_t _histLow(int b)
+{
+    if(b < LOG_HIST_SUB)
+        return b;
+    return (uint64_t)(LOG_HIST_SUB + b % LOG_HIST_SUB) << (b / LOG_HIST_SUB - 1);
+}
+
+static void _histAdd(LogHist* h, uint64_t v)
+{
+    size_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->bucket[_histBucket(v)], 1, __ATOMIC_RELAXED);
+    while(v > max && !__atomic_compare_exchange_n(&h->max, &max, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void _histMerge(LogHist* dst, const LogHist* src)
+{
+    size_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    int i;
+
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum   += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    if(max > dst->max)
+        dst->max = max;
+    for(i = 0; i < LOG_HIST_BUCKETS; i++)
+        dst->bucket[i] += __atomic_load_n(&src->bucket[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief logSetStats - 开启或关闭日志的延迟统计
+ * 开启后每次 logAdd* 多两次读取单调时钟 (各约 20 ns), 异步模式下还会记录放入队列到写入文件的耗时;
+ * 记录数, 字节数等计数不需要开启, 总是有效
+ * @param log
+ * @param on
+ * @note  关闭后已有的直方图保留, 再次开启时继续累计
+ */
+void logSetStats(LogPtr log, bool on)
+{
+    int i;
+
+    if(!log || !log->shards)    return;
+    if(on)
+    {
+        for(i = 0; i < LOG_STAT_SHARDS; i++)
+        {
+            if(!log->shards[i].add)     log->shards[i].add  = (LogHist*)calloc(1, sizeof(LogHist));
+            if(!log->shards[i].disk)    log->shards[i].disk = (LogHist*)calloc(1, sizeof(LogHist));
+            if(!log->shards[i].add || !log->shards[i].disk)
+                return;
+        }
+    }
+    __atomic_store_n(&log->stats, on ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief logStats - 获取日志的计数和延迟直方图
+ * @param log
+ * @param st    输出, 未开启延迟统计时直方图为空
+ * @note  不加锁, 可以在其它线程写日志时调用, 各项之间可能有少量出入
+ */
+void logStats(LogPtr log, LogStats* st)
+{
+    int i;
+
+    if(!st)     return;
+    memset(st, 0, sizeof(*st));
+    if(!log)    return;
+
+    logGetCounters(log, &st->cnt);
+    if(log->shards)
+    {
+        for(i = 0; i < LOG_STAT_SHARDS; i++)
+        {
+            LogHist* add  = __atomic_load_n(&log->shards[i].add, __ATOMIC_ACQUIRE);
+            LogHist* disk = __atomic_load_n(&log->shards[i].disk, __ATOMIC_ACQUIRE);
+            if(add)     _histMerge(&st->add, add);
+            if(disk)    _histMerge(&st->disk, disk);
+        }
+    }
+}
+
+/**
+ * @brief logHistPercentile - 直方图的百分位数
+ * @param h
+ * @param pct   0 ~ 100, 如 50, 99, 99.9
+ * @return 该百分位所在区间的上界 (不超过最大值), 单位为纳秒; 没有样本时返回 0
+ */
+size_t logHistPercentile(const LogHist* h, double pct)
+{
+    size_t want, seen = 0;
+    uint64_t hi;
+    int i;
+
+    if(!h || !h->count)     return 0;
+    want = (size_t)(h->count * (pct / 100.0));
+    if(want >= h->count)    return h->max;
+    for(i = 0; i < LOG_HIST_BUCKETS; i++)
+    {
+        seen += h->bucket[i];
+        if(seen > want)
+        {
+            hi = i + 1 < LOG_HIST_BUCKETS ? _histLow(i + 1) - 1 : h->max;
+            return hi < h->max ? hi : h->max;
+        }
+    }
+    return h->max;
+}
+
+static int _logStatsLine(LogPtr log, char* buf, size_t cap)
+{
+    LogStats* st = (LogStats*)malloc(sizeof(LogStats));
+    int n;
+
+    if(!st)     return snprintf(buf, cap, "stats unavailable");
+    logStats(log, st);
+    n = snprintf(buf, cap, "records %zu, bytes %zu, dropped %zu, suppressed %zu, errors %zu, rotations %zu, limits %zu, flushes %zu, syncs %zu",
+                 st->cnt.records, st->cnt.bytes, st->cnt.dropped, st->cnt.suppressed, st->cnt.errors, st->cnt.rotations,
+                 st->cnt.limits, st->cnt.flushes, st->cnt.syncs);
+    if(st->cnt.fallbacks && n > 0 && (size_t)n < cap)
+        n += snprintf(buf + n, cap - n, ", mmap fallbacks %zu", st->cnt.fallbacks);
+    if(st->add.count && n > 0 && (size_t)n < cap)
+        n += snprintf(buf + n, cap - n, ", add ns p50 %zu p99 %zu p99.9 %zu max %zu",
+                      logHistPercentile(&st->add, 50), logHistPercentile(&st->add, 99),
+                      logHistPercentile(&st->add, 99.9), st->add.max);
+    if(st->disk.count && n > 0 && (size_t)n < cap)
+        n += snprintf(buf + n, cap - n, ", disk ns p50 %zu p99 %zu p99.9 %zu max %zu",
+                      logHistPercentile(&st->disk, 50), logHistPercentile(&st->disk, 99),
+                      logHistPercentile(&st->disk, 99.9), st->disk.max);
+    free(st);
+    return n;
+}
+
+static void _logStatsDumpOne(LogPtr log, void* arg)
+{
+    char buf[512];
+
+    _logStatsLine(log, buf, sizeof(buf));
+    fprintf((FILE*)arg, "[%s] %s\n", log->name, buf);
+}
+
+/**
+ * @brief logStatsDump - 将所有已注册 (创建时指定了名称) 日志的统计信息输出到 out, 每个日志一行
+ * @param out   如 stdout, 不需要初始化系统日志; 写入系统日志请使用 logsysDump
+ */
+void logStatsDump(FILE* out)
+{
+    if(out)
+        _regEach(_logStatsDumpOne, out);
+}
+
+/* ---------------------------- directory cache ------------------------------ */
+/* 已确认存在的目录 (开放寻址哈希表, 存放 strdup 的路径), 由 _mkdir 使用.
+ * 启动时批量创建日志时, 同一目录下的日志只在第一次创建时调用 mkdir, 之后不需要任何系统调用.
+ * 只增不删; 目录被外部删除后打开文件会失败 (ENOENT), 由 _logOpen 清空缓存重试 */
+static char**  _dir_tab = NULL;
+static size_t  _dir_cap = 0;                // 槽位数, 为 2 的幂
+static size_t  _dir_n   = 0;
+static pthread_mutex_t _dir_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t _dirHash(const char* dir, size_t len)    // FNV-1a
+{
+    size_t h = (size_t)14695981039346656037ULL;
+    while(len--)
+    {
+        h ^= (unsigned char)*dir++;
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+/* 查找 dir 的前 len 个字符, 返回槽位; 不存在时返回应插入的空槽位. 只在持有 _dir_mtx 时调用 */
+static size_t _dirSlot(const char* dir, size_t len)
+{
+    size_t i = _dirHash(dir, len) & (_dir_cap - 1);
+    while(_dir_tab[i] && (strncmp(_dir_tab[i], dir, len) || _dir_tab[i][len]))
+        i = (i + 1) & (_dir_cap - 1);
+    return i;
+}
+
+static bool _dirHas(const char* dir, size_t len)
+{
+    bool r;
+
+    pthread_mutex_lock(&_dir_mtx);
+    r = _dir_tab && _dir_tab[_dirSlot(dir, len)];
+    pthread_mutex_unlock(&_dir_mtx);
+    return r;
+}
+
+static void _dirAdd(const char* dir, size_t len)
+{
+    char** old;
+    size_t ocap, i;
+    char*  d;
+
+    pthread_mutex_lock(&_dir_mtx);
+    if((_dir_n + 1) * 2 > _dir_cap)         // 装载率不超过 1/2
+    {
+        old  = _dir_tab;
+        ocap = _dir_cap;
+        if(!(_dir_tab = (char**)calloc(ocap ? ocap * 2 : 64, sizeof(char*))))
+        {
+            _dir_tab = old;                 // 内存不足, 不缓存, 下次仍会调用 mkdir
+            goto out;
+        }
+        _dir_cap = ocap ? ocap * 2 : 64;
+        for(i = 0; i < ocap; i++)
+            if(old[i])
+                _dir_tab[_dirSlot(old[i], strlen(old[i]))] = old[i];
+        free(old);
+    }
+    i = _dirSlot(dir, len);
+    if(!_dir_tab[i] && (d = strndup(dir, len)))
+    {
+        _dir_tab[i] = d;
+        _dir_n++;
+    }
+out:
+    pthread_mutex_unlock(&_dir_mtx);
+}
+
+static void _dirClear()
+{
+    size_t i;
+
+    pthread_mutex_lock(&_dir_mtx);
+    for(i = 0; i < _dir_cap; i++)
+        free(_dir_tab[i]);
+    free(_dir_tab);
+    _dir_tab = NULL;
+    _dir_cap = _dir_n = 0;
+    pthread_mutex_unlock(&_dir_mtx);
+}
+
+/* ---------------------------- log registry --------------------------------- */
+/* 名称 -> 日志结构 的哈希表 (开放寻址, 线性探测):
+ * 注册和注销时加锁, 查找时不加锁, 只需原子地读取表指针和槽位.
+ * 扩容时生成一张新表再替换表指针, 旧表可能仍在被查找的线程使用, 所以不释放, 只挂到 _reg_old 上;
+ * 表每次扩大一倍, 所以旧表的总大小不会超过当前表.
+ * 注意: 与直接使用 LogPtr 一样, 销毁日志和使用该日志不能同时进行.
+ */
+#define REG_TOMB    ((LogPtr)1)             // 已注销的槽位, 查找时跳过, 注册时可复用
+#define REG_MINCAP  64
+
+typedef struct RegEnt{
+    size_t hash;
+    LogPtr log;                             // NULL 表示空槽位
+}RegEnt;
+
+typedef struct RegTab{
+    size_t cap;                             // 槽位数, 为 2 的幂
+    size_t used;                            // 已使用的槽位数, 包括 REG_TOMB
+    size_t count;                           // 注册的日志数
+    struct RegTab* old;                     // 被替换掉的旧表
+    RegEnt ents[];
+}RegTab;
+
+static RegTab* _reg     = NULL;
+static size_t  _reg_gen = 1;                // 每次注销日志时加 1, 使调用处缓存的 LogHandle 失效
+static pthread_mutex_t _reg_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t _regHash(const char* name)    // FNV-1a
+{
+    size_t h = (size_t)14695981039346656037ULL;
+    while(*name)
+    {
+        h ^= (unsigned char)*name++;
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+static RegTab* _regAlloc(size_t cap)
+{
+    RegTab* t = (RegTab*)calloc(1, sizeof(RegTab) + cap * sizeof(RegEnt));
+    if(t)   t->cap = cap;
+    return t;
+}
+
+/* 放入一个必定不存在的日志, 只在持有 _reg_mtx 时调用 */
+static void _regPut(RegTab* t, size_t hash, LogPtr log)
+{
+    size_t i = hash & (t->cap - 1);
+    LogPtr cur;
+
+    while((cur = t->ents[i].log) && cur != REG_TOMB)
+        i = (i + 1) & (t->cap - 1);
+    if(!cur)    t->used++;
+    t->count++;
+    t->ents[i].hash = hash;
+    __atomic_store_n(&t->ents[i].log, log, __ATOMIC_RELEASE);
+}
+
+static bool _regAdd(LogPtr log)
+{
+    size_t  hash = _regHash(log->name);
+    RegTab* t;
+    RegTab* nt;
+    size_t  i;
+    bool    ok = false;
+
+    pthread_mutex_lock(&_reg_mtx);
+    if(logGet(log->name))
+        goto out;
+
+    t = _reg;
+    if(!t || (t->used + 1) * 4 > t->cap * 3)   // 负载超过 3/4 时扩容 (墓碑较多时只是重建)
+    {
+        nt = _regAlloc(!t ? REG_MINCAP : (t->count + 1) * 2 > t->cap ? t->cap << 1 : t->cap);
+        if(!nt)
+            goto out;
+        if(t)
+        {
+            for(i = 0; i < t->cap; i++)
+                if(t->ents[i].log && t->ents[i].log != REG_TOMB)
+                    _regPut(nt, t->ents[i].hash, t->ents[i].log);
+            nt->old = t;
+        }
+        __atomic_store_n(&_reg, nt, __ATOMIC_RELEASE);
+        t = nt;
+    }
+    _regPut(t, hash, log);
+    ok = true;
+
+out:
+    pthread_mutex_unlock(&_reg_mtx);
+    return ok;
+}
+
+static void _regDel(LogPtr log)
+{
+    RegTab* t;
+    size_t  i;
+    LogPtr  cur;
+
+    pthread_mutex_lock(&_reg_mtx);
+    t = _reg;
+    if(t)
+    {
+        i = _regHash(log->name) & (t->cap - 1);
+        while((cur = t->ents[i].log))
+        {
+            if(cur == log)
+            {
+                __atomic_store_n(&t->ents[i].log, REG_TOMB, __ATOMIC_RELEASE);
+                __atomic_fetch_add(&_reg_gen, 1, __ATOMIC_RELEASE);
+                t->count--;
+                break;
+            }
+            i = (i + 1) & (t->cap - 1);
+        }
+    }
+    pthread_mutex_unlock(&_reg_mtx);
+}
+
+/**
+ * @brief logGet - 根据名称获取日志结构
+ * @param name  日志名称, 即 logCreate 时指定的名称
+ * @return 日志结构指针, 不存在时返回 NULL
+ * @note   查找不加锁, 可以在任意线程中调用
+ */
+LogPtr logGet(const char* name)
+{
+    RegTab* t = __atomic_load_n(&_reg, __ATOMIC_ACQUIRE);
+    size_t  hash, i;
+    LogPtr  cur;
+
+    if(!t || !name)     return NULL;
+
+    hash = _regHash(name);
+    i    = hash & (t->cap - 1);
+    while((cur = __atomic_load_n(&t->ents[i].log, __ATOMIC_ACQUIRE)))
+    {
+        if(cur != REG_TOMB && t->ents[i].hash == hash && 0 == strcmp(cur->name, name))
+            return cur;
+        i = (i + 1) & (t->cap - 1);
+    }
+    return NULL;
+}
+
+static void _regEach(void (*fn)(LogPtr log, void* arg), void* arg)
+{
+    RegTab* t;
+    size_t  i;
+
+    pthread_mutex_lock(&_reg_mtx);
+    if((t = _reg))
+        for(i = 0; i < t->cap; i++)
+            if(t->ents[i].log && t->ents[i].log != REG_TOMB)
+                fn(t->ents[i].log, arg);
+    pthread_mutex_unlock(&_reg_mtx);
+}
+
+/**
+ * @brief logGetCached - 根据名称获取日志结构, 若 h 中缓存的结构仍有效, 则直接返回
+ * @param h     调用处的缓存, 一般为 static 变量, 初始化为 0 即可, 也可以直接使用 logHandle(name)
+ * @param name  日志名称, 同一个 h 应总是使用相同的名称
+ * @return 日志结构指针, 不存在时返回 NULL
+ * @note   只要没有日志被销毁, 就只需比较一次版本号.
+ *         h->log 和 h->gen 由 h->seq 保护 (seqlock): 读到的一对前后 seq 不变且为偶数时才使用, 否则重新查找;
+ *         同时只有一个线程能更新缓存, 其它线程直接返回查找的结果, 所以不会把旧的结构与新的版本号配成一对
+ */
+LogPtr logGetCached(LogHandle* h, const char* name)
+{
+    size_t   gen = __atomic_load_n(&_reg_gen, __ATOMIC_ACQUIRE);
+    unsigned seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+    LogPtr   log;
+
+    if(!(seq & 1))
+    {
+        log = __atomic_load_n(&h->log, __ATOMIC_RELAXED);
+        if(log && __atomic_load_n(&h->gen, __ATOMIC_RELAXED) == gen)
+        {
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+                return log;
+        }
+    }
+
+    log = logGet(name);
+    if(!(seq & 1) && __atomic_compare_exchange_n(&h->seq, &seq, seq + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&h->log, log, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->gen, gen, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+    return log;
+}
+
+/* ---------------------------- async queue --------------------------------- */
+/* 有界无锁队列 (Dmitry Vyukov 的有界 MPMC 队列):
+ * 每个槽位带一个序号, 生产者和消费者分别通过 CAS 推进 head 和 tail, 不需要加锁.
+ * 正常情况下只有写线程一个消费者, 但 LOG_BP_DROPOLD 策略下生产者也要从队头弹出最旧的记录,
+ * 所以消费端同样使用 CAS.
+ */
+typedef struct LogSlot{
+    size_t   seq;                   // 槽位序号, 用于判断槽位当前是否可写/可读
+    unsigned len;                   // 记录长度
+    unsigned flags;                 // LR_CONSOLE, LR_SYNC, LR_BLOB, LR_KEEP
+    char*    ext;                   // 长度超出 LOG_QSLOT_SIZE 的记录存放在此处 (缓冲区池或另行分配), 否则为 NULL
+    uint64_t t;                     // 放入队列的时间, 开启延迟统计时才记录, 否则为 0
+    char     data[LOG_QSLOT_SIZE];
+}LogSlot;
+
+#define LQ_CACHELINE    64
+#define LQ_XBUFS        32          // 每个队列预先分配的长记录缓冲区个数, 每个 LOG_REC_SIZE 字节
+
+struct LogQueue{
+    LogSlot* slots;
+    size_t   mask;                  // 槽位数 - 1, 槽位数为 2 的幂
+    int      policy;                // 队列满时的处理策略
+    LogPtr   log;                   // 所属日志
+    struct LogSink* sink;           // 不为 NULL 时写线程把记录交给此输出, 而不是写入日志文件
+    char     _pad0[LQ_CACHELINE];
+    size_t   head;                  // 生产者位置, 与 tail 分开放置, 避免伪共享
+    char     _pad1[LQ_CACHELINE];
+    size_t   tail;                  // 消费者位置
+    char     _pad2[LQ_CACHELINE];
+    size_t   drop_new;              // LOG_BP_DROPNEW 策略下丢弃的记录数
+    size_t   drop_old;              // LOG_BP_DROPOLD 策略下丢弃的记录数
+    int      waiting;               // 写线程正在等待新记录, 此时生产者需要唤醒它
+    int      busy;                  // 写线程正在处理已取出的记录
+    int      stop;                  // 通知写线程写完剩余记录后退出
+    char*    xbuf;                  // 长记录的缓冲区池, 长度不超过 LOG_REC_SIZE 的记录不必另行分配
+    uint64_t xfree;                 // 空闲缓冲区组成的栈: 高 32 位为版本号 (避免 ABA), 低 32 位为栈顶下标 + 1
+    uint32_t xnext[LQ_XBUFS];       // 栈中下一个空闲缓冲区的下标 + 1, 0 表示栈底
+    char*    xb;                    // 写线程编码 logAddBlob 记录的缓冲区, 按最长的记录增长
+    size_t   xbcap;
+    pthread_t       thread;
+    pthread_mutex_t mtx;
+    pthread_cond_t  cond;
+    struct LogQueue* next;          // 所有异步队列组成的链表, 用于 logsysStop 时写完所有队列
+};
+
+static struct LogQueue* _lq_list = NULL;
+static pthread_mutex_t  _lq_mtx  = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief _lqReserve - 生产者获取一个可写的槽位
+ * @return 槽位指针, 队列已满时返回 NULL
+ */
+static LogSlot* _lqReserve(struct LogQueue* q, size_t* pos)
+{
+    size_t p = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for(;;)
+    {
+        LogSlot* s    = &q->slots[p & q->mask];
+        size_t   seq  = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)p;
+        if(0 == diff)
+        {
+            if(__atomic_compare_exchange_n(&q->head, &p, p + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = p;
+                return s;
+            }
+        }
+        else if(diff < 0)
+            return NULL;
+        else
+            p = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief _lqTake - 消费者取出一个可读的槽位, 用完后需调用 _lqRelease 归还
+ * @return 槽位指针, 队列为空时返回 NULL
+ */
+static LogSlot* _lqTake(struct LogQueue* q, size_t* pos)
+{
+    size_t p = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for(;;)
+    {
+        LogSlot* s    = &q->slots[p & q->mask];
+        size_t   seq  = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(p + 1);
+        if(0 == diff)
+        {
+            if(__atomic_compare_exchange_n(&q->tail, &p, p + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = p;
+                return s;
+            }
+        }
+        else if(diff < 0)
+            return NULL;
+        else
+            p = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief _lqEvict - DROPOLD 策略下生产者取出最早的记录以便丢弃, 同 _lqTake, 但不取出不能丢弃的记录 (LR_KEEP)
+ * 核对 flags 与取得槽位是同一次 CAS 之前的同一个槽位, 所以不会误取
+ * @param keep  最早的记录不能丢弃时置为 true
+ * @return 槽位指针, 队列为空或最早的记录不能丢弃时返回 NULL
+ */
+static LogSlot* _lqEvict(struct LogQueue* q, size_t* pos, bool* keep)
+{
+    size_t p = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    *keep = false;
+    for(;;)
+    {
+        LogSlot* s    = &q->slots[p & q->mask];
+        size_t   seq  = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(p + 1);
+        if(0 == diff)
+        {
+            if(s->flags & LR_KEEP)
+            {
+                *keep = true;
+                return NULL;
+            }
+            if(__atomic_compare_exchange_n(&q->tail, &p, p + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = p;
+                return s;
+            }
+        }
+        else if(diff < 0)
+            return NULL;
+        else
+            p = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief _lqXGet - 从缓冲区池取出一个长记录缓冲区
+ * @return 缓冲区, 大小为 LOG_REC_SIZE; 池已空时返回 NULL
+ */
+static char* _lqXGet(struct LogQueue* q)
+{
+    uint64_t h = __atomic_load_n(&q->xfree, __ATOMIC_ACQUIRE), n;
+    uint32_t i;
+
+    do{
+        if(!(i = (uint32_t)h))
+            return NULL;
+        n = ((h >> 32) + 1) << 32 | __atomic_load_n(&q->xnext[i - 1], __ATOMIC_RELAXED);
+    }while(!__atomic_compare_exchange_n(&q->xfree, &h, n, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return q->xbuf + (size_t)(i - 1) * LOG_REC_SIZE;
+}
+
+/* 归还长记录缓冲区, 不是池中的 (超出 LOG_REC_SIZE 的记录) 则释放 */
+static void _lqXPut(struct LogQueue* q, char* p)
+{
+    uintptr_t off = (uintptr_t)p - (uintptr_t)q->xbuf;
+    uint64_t  h, n;
+    uint32_t  i;
+
+    if(!p)  return;
+    if(off >= (uintptr_t)LQ_XBUFS * LOG_REC_SIZE)
+    {
+        free(p);
+        return;
+    }
+    i = off / LOG_REC_SIZE + 1;
+    h = __atomic_load_n(&q->xfree, __ATOMIC_RELAXED);
+    do{
+        __atomic_store_n(&q->xnext[i - 1], (uint32_t)h, __ATOMIC_RELAXED);
+        n = ((h >> 32) + 1) << 32 | i;
+    }while(!__atomic_compare_exchange_n(&q->xfree, &h, n, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void _lqRelease(struct LogQueue* q, LogSlot* s, size_t pos)
+{
+    if(s->ext)
+    {
+        _lqXPut(q, s->ext);
+        s->ext = NULL;
+    }
+    __atomic_store_n(&s->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+}
+
+static bool _lqEmpty(struct LogQueue* q)
+{
+    size_t p = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&q->slots[p & q->mask].seq, __ATOMIC_ACQUIRE) != p + 1;
+}
+
+static void _lqBackoff(int* spins)
+{
+    if(*spins < 64)
+    {
+        (*spins)++;
+        sched_yield();
+    }
+    else
+    {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * @brief _lqWake - 若写线程正在等待, 则唤醒它
+ * 与 _lqWait 中的 waiting 标记配对, 两边都使用 SEQ_CST 栅栏, 保证不会错过唤醒
+ */
+static void _lqWake(struct LogQueue* q)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&q->waiting, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&q->mtx);
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->mtx);
+    }
+}
+
+/* 有 logFlush 请求写出块缓冲区 (块压缩模式) */
+static bool _lqSealReq(struct LogQueue* q)
+{
+    struct LogLz* z = q->sink ? NULL : __atomic_load_n(&q->log->lz, __ATOMIC_ACQUIRE);
+    return z && __atomic_load_n(&z->sealreq, __ATOMIC_ACQUIRE);
+}
+
+static void _lqWait(struct LogQueue* q)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&q->mtx);
+    __atomic_store_n(&q->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(_lqEmpty(q) && !__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE) && !_lqSealReq(q))
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);     // 定时醒来一次, 作为兜底
+        ts.tv_nsec += 100 * 1000000;
+        if(ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&q->cond, &q->mtx, &ts);
+    }
+    __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->mtx);
+}
+
+/**
+ * @brief _lqFull - 队列或长记录缓冲区池已满时按 policy 处理
+ * @param policy    q->policy, 不能丢弃的记录 (LR_KEEP) 为 LOG_BP_BLOCK
+ * @return 可以重试返回 true, 应丢弃新记录返回 false
+ */
+static bool _lqFull(struct LogQueue* q, int policy, int* spins)
+{
+    LogSlot* old;
+    size_t   opos;
+    bool     keep;
+
+    switch(policy)
+    {
+        case LOG_BP_DROPNEW:
+            __atomic_fetch_add(&q->drop_new, 1, __ATOMIC_RELAXED);
+            return false;
+        case LOG_BP_DROPOLD:
+            if((old = _lqEvict(q, &opos, &keep)))
+            {
+                _lqRelease(q, old, opos);
+                __atomic_fetch_add(&q->drop_old, 1, __ATOMIC_RELAXED);
+            }
+            else if(keep)                   // 最早的记录不能丢弃, 等写线程按顺序写出它, 同 BLOCK
+            {
+                _lqWake(q);
+                _lqBackoff(spins);
+            }
+            return true;
+        default:
+            _lqWake(q);
+            _lqBackoff(spins);
+            return true;
+    }
+}
+
+static void _iovCopy(char* dst, const struct iovec* iov, int cnt)
+{
+    int i;
+
+    for(i = 0; i < cnt; i++)
+    {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+}
+
+/**
+ * @brief _lqPushV - 放入一条记录, 队列满时按 policy 处理
+ * @param iov   记录的各段, 拼接后长度超出 LOG_QSLOT_SIZE 时存放在缓冲区池中, 超出 LOG_REC_SIZE 时另行分配
+ * @note  各段只拷贝一次, 直接拷贝到槽位或缓冲区中
+ */
+static void _lqPushV(struct LogQueue* q, const struct iovec* iov, int cnt, unsigned flags)
+{
+    LogSlot* s;
+    size_t pos, len = 0;
+    char*  ext = NULL;
+    int spins = 0, i, policy = (flags & LR_KEEP) ? LOG_BP_BLOCK : q->policy;
+
+    for(i = 0; i < cnt; i++)
+        len += iov[i].iov_len;
+    if(len > LOG_REC_SIZE)
+    {
+        if(!(ext = (char*)malloc(len)))
+            return;
+    }
+    else if(len > LOG_QSLOT_SIZE)
+    {
+        /* 池已空时 DROPOLD 也只丢弃这条记录: 最早的记录多半是不占用池中缓冲区的短记录, 丢弃它们腾不出缓冲区 */
+        while(!(ext = _lqXGet(q)))
+            if(!_lqFull(q, LOG_BP_DROPOLD == policy ? LOG_BP_DROPNEW : policy, &spins))
+                return;
+    }
+    if(ext)
+        _iovCopy(ext, iov, cnt);
+
+    while(!(s = _lqReserve(q, &pos)))
+    {
+        if(!_lqFull(q, policy, &spins))
+        {
+            _lqXPut(q, ext);
+            return;
+        }
+    }
+
+    s->len   = len;
+    s->flags = flags;
+    s->ext   = ext;
+    s->t     = __atomic_load_n(&q->log->stats, __ATOMIC_RELAXED) ? _statNow() : 0;
+    if(!ext)
+        _iovCopy(s->data, iov, cnt);
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+    _lqWake(q);
+}
+
+static void _lqPush(struct LogQueue* q, const char* rec, unsigned len, unsigned flags)
+{
+    struct iovec v = {(void*)rec, len};
+    _lqPushV(q, &v, 1, flags);
+}
+
+/**
+ * @brief _lqBlob - 写线程编码 logAddBlob 的记录
+ * 槽位中为: u32 前缀长度, 已格式化的前缀 ("[time] [name] :"), 原始数据; 编码到 q->xb
+ * @param len   槽位中的长度, 返回编码后记录的长度
+ * @return 编码后的记录, 内存不足时返回 NULL
+ */
+static char* _lqBlob(struct LogQueue* q, const char* data, size_t* len, unsigned flags)
+{
+    uint32_t hlen;
+    size_t   n, need;
+    char*    p;
+
+    memcpy(&hlen, data, 4);
+    n    = *len - 4 - hlen;
+    need = hlen + _blobLen(flags, n);
+    if(need > q->xbcap)
+    {
+        if(!(p = (char*)realloc(q->xb, need)))
+            return NULL;
+        q->xb    = p;
+        q->xbcap = need;
+    }
+    memcpy(q->xb, data + 4, hlen);
+    *len = hlen + _blobText(q->xb + hlen, flags, (const unsigned char*)data + 4 + hlen, n);
+    return q->xb;
+}
+
+#define LQ_TBATCH   256             // 一批中最多记录多少条的入队时间, 满了就先写入
+
+/**
+ * @brief _lqWrite - 写线程写入一批记录, 并记录这批记录从放入队列到写入文件的耗时
+ * @param tq    这批记录的入队时间, 共 *nt 个, 写入后清零
+ */
+static void _lqWrite(LogPtr log, const char* buf, size_t len, LogHist* lat, const uint64_t* tq, size_t* nt)
+{
+    uint64_t now;
+    size_t   i;
+
+    if(__atomic_load_n(&log->lz, __ATOMIC_ACQUIRE)) // 块压缩模式下放入块缓冲区, 满了再压缩写入
+        _lzAppend(log, buf, len);
+    else
+    {
+        _logFileShrink(log);
+        _logWrite(log, buf, len);
+    }
+    __atomic_fetch_add(&log->nflush, 1, __ATOMIC_RELAXED);
+    if(lat && *nt)
+    {
+        now = _statNow();
+        for(i = 0; i < *nt; i++)
+            _histAdd(lat, now - tq[i]);
+    }
+    *nt = 0;
+}
+
+/**
+ * @brief _lqDrain - 取出队列中当前所有记录, 合并后一次写入文件, 需要时输出到控制台
+ * @return 处理的记录数
+ */
+static size_t _lqDrain(struct LogQueue* q, char* batch)
+{
+    LogPtr   log = q->log;
+    LogSlot* s;
+    LogHist* lat = NULL;
+    uint64_t tq[LQ_TBATCH];
+    size_t   pos, n = 0, blen = 0, nt = 0, len;
+    char*    data;
+    bool     sync = false;
+
+    if(q->sink)
+        return _lsDrain(q, batch);
+    if(log->shards && __atomic_load_n(&log->stats, __ATOMIC_ACQUIRE))
+        lat = _logShard(log)->disk;
+
+    while((s = _lqTake(q, &pos)))
+    {
+        data = s->ext ? s->ext : s->data;
+        len  = s->len;
+        if((s->flags & LR_BLOB) && !(data = _lqBlob(q, data, &len, s->flags)))
+            goto next;                      // 内存不足, 丢弃
+
+        if(s->flags & LR_CONSOLE)
+            _writeAll(STDERR_FILENO, data, len);
+        if(s->flags & LR_SYNC)
+            sync = true;
+
+        if(log->fp)
+        {
+            if(blen && (blen + len > LQ_BATCH || LQ_TBATCH == nt))
+            {
+                _lqWrite(log, batch, blen, lat, tq, &nt);
+                blen = 0;
+            }
+            if(lat && s->t)
+                tq[nt++] = s->t;
+            if(len > LQ_BATCH)
+                _lqWrite(log, data, len, lat, tq, &nt);
+            else
+            {
+                memcpy(batch + blen, data, len);
+                blen += len;
+            }
+        }
+
+next:
+        _lqRelease(q, s, pos);
+        n++;
+    }
+
+    if(blen)
+        _lqWrite(log, batch, blen, lat, tq, &nt);
+    if(sync && log->flush)                  // 这一批中有关键记录, 写完后同步到磁盘
+    {
+        if(log->lz)
+            _lzSeal(log);
+        _lfSync(log);
+    }
+
+    return n;
+}
+
+static void* _lqWriter(void* arg)
+{
+    struct LogQueue* q = (struct LogQueue*)arg;
+    char* batch = (char*)malloc(LQ_BATCH);
+    size_t n;
+
+    for(;;)
+    {
+        __atomic_store_n(&q->busy, 1, __ATOMIC_SEQ_CST);
+        n = _lqDrain(q, batch);
+        __atomic_store_n(&q->busy, 0, __ATOMIC_SEQ_CST);
+        if(!q->sink && __atomic_load_n(&q->log->lz, __ATOMIC_ACQUIRE))
+            _lzTick(q->log);                // 每批之后都检查, 生产者一直写入时 logFlush 和定时写出也不会被推迟
+        if(n)
+            continue;
+        if(__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+            break;
+        _lqWait(q);
+    }
+    if(!q->sink && q->log->lz)
+        _lzClose(q->log);
+
+    free(batch);
+    return NULL;
+}
+
+static struct LogQueue* _lqCreate(LogPtr log, struct LogSink* sink, size_t qsize, int policy)
+{
+    struct LogQueue* q;
+    size_t n = 2, i;
+
+    while(n < qsize)    n <<= 1;
+
+    q = (struct LogQueue*)calloc(1, sizeof(*q));
+    if(!q)  return NULL;
+    q->slots = (LogSlot*)calloc(n, sizeof(LogSlot));
+    q->xbuf  = (char*)malloc((size_t)LQ_XBUFS * LOG_REC_SIZE);
+    if(!q->slots || !q->xbuf)
+    {
+        free(q->slots);
+        free(q->xbuf);
+        free(q);
+        return NULL;
+    }
+    for(i = 0; i < n; i++)
+        q->slots[i].seq = i;
+    for(i = 0; i < LQ_XBUFS; i++)
+        q->xnext[i] = i + 1 < LQ_XBUFS ? i + 2 : 0;
+    q->xfree  = 1;
+    q->mask   = n - 1;
+    q->policy = policy;
+    q->log    = log;
+    q->sink   = sink;
+    pthread_mutex_init(&q->mtx, NULL);
+    pthread_cond_init(&q->cond, NULL);
+
+    if(pthread_create(&q->thread, NULL, _lqWriter, q))
+    {
+        pthread_mutex_destroy(&q->mtx);
+        pthread_cond_destroy(&q->cond);
+        free(q->slots);
+        free(q->xbuf);
+        free(q);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&_lq_mtx);
+    q->next  = _lq_list;
+    _lq_list = q;
+    pthread_mutex_unlock(&_lq_mtx);
+
+    return q;
+}
+
+static void _lqDestroy(struct LogQueue* q)
+{
+    struct LogQueue** pp;
+
+    pthread_mutex_lock(&_lq_mtx);
+    for(pp = &_lq_list; *pp; pp = &(*pp)->next)
+    {
+        if(*pp == q)
+        {
+            *pp = q->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_lq_mtx);
+
+    pthread_mutex_lock(&q->mtx);
+    __atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mtx);
+    pthread_join(q->thread, NULL);
+
+    pthread_mutex_destroy(&q->mtx);
+    pthread_cond_destroy(&q->cond);
+    free(q->slots);
+    free(q->xbuf);
+    free(q->xb);
+    free(q);
+}
+
+/**
+ * @brief _lqFlush - 等待队列为空, 并且写线程已处理完取出的记录
+ * @note  写线程在取出记录之前就已置 busy, 所以先判断队列为空再判断 busy 不会漏掉正在写的记录
+ */
+static void _lqFlush(struct LogQueue* q)
+{
+    int spins = 0;
+
+    while(!_lqEmpty(q) || __atomic_load_n(&q->busy, __ATOMIC_SEQ_CST))
+    {
+        _lqWake(q);
+        _lqBackoff(&spins);
+    }
+}
+
+static void _lqFlushAll()
+{
+    struct LogQueue* q;
+
+    pthread_mutex_lock(&_lq_mtx);
+    for(q = _lq_list; q; q = q->next)
+        _lqFlush(q);
+    pthread_mutex_unlock(&_lq_mtx);
+}
+
+/**
+ * @brief logDropped - 获取异步模式下因队列已满而被丢弃的记录数
+ * @param log
+ * @param newest    若不为 NULL, 存放 LOG_BP_DROPNEW 策略下丢弃的记录数
+ * @param oldest    若不为 NULL, 存放 LOG_BP_DROPOLD 策略下丢弃的记录数
+ * @return 丢弃的记录总数, 同步模式下为 0
+ */
+size_t logDropped(LogPtr log, size_t* newest, size_t* oldest)
+{
+    size_t n = 0, o = 0;
+
+    if(log && log->queue)
+    {
+        n = __atomic_load_n(&log->queue->drop_new, __ATOMIC_RELAXED);
+        o = __atomic_load_n(&log->queue->drop_old, __ATOMIC_RELAXED);
+    }
+    if(newest)  *newest = n;
+    if(oldest)  *oldest = o;
+    return n + o;
+}
+
+/* ---------------------------- sinks --------------------------------- */
+/* 增加的输出 (logAddSink):
+ * 日志原有的文件和控制台输出之外, 每个日志可以再增加若干个输出. 每个输出有自己的有界队列和写线程 (复用异步队列),
+ * 添加记录时只是把记录放入各输出的队列, 由写线程交给输出; 某个输出慢或阻塞时, 它的队列满后按 policy 阻塞或丢弃,
+ * 只影响这个输出自己. 输出只在 logAddSink 时加入链表, logDestroy 时才释放, 所以添加记录时遍历链表不需要加锁.
+ */
+
+static pthread_mutex_t _ls_mtx = PTHREAD_MUTEX_INITIALIZER;         // 串行化 logAddSink
+
+static struct LogSink* _lsNew(int type)
+{
+    struct LogSink* k = (struct LogSink*)calloc(1, sizeof(*k));
+
+    if(!k)  return NULL;
+    k->type = type;
+    k->fd   = -1;
+    return k;
+}
+
+static void _lsWrite(struct LogSink* k, const char* buf, size_t len)
+{
+    if(_writeAll(k->fd, buf, len) < len)
+        __atomic_fetch_add(&k->nerr, 1, __ATOMIC_RELAXED);
+}
+
+static void _lsMemPut(struct LogSink* k, const char* rec, size_t len)
+{
+    size_t idx, first;
+
+    if(len > k->size)                       // 只保留最后的部分
+    {
+        rec += len - k->size;
+        len  = k->size;
+    }
+    pthread_mutex_lock(&k->mtx);
+    idx   = k->head & (k->size - 1);
+    first = len < k->size - idx ? len : k->size - idx;
+    memcpy(k->ring + idx, rec, first);
+    memcpy(k->ring, rec + first, len - first);
+    k->head += len;
+    pthread_mutex_unlock(&k->mtx);
+}
+
+/**
+ * @brief _lsDrain - 输出的写线程取出队列中当前所有记录: 文件和控制台合并后一次写入, 套接字每条记录发送一个数据报
+ * @return 处理的记录数
+ */
+static size_t _lsDrain(struct LogQueue* q, char* batch)
+{
+    struct LogSink* k = q->sink;
+    LogSlot* s;
+    size_t   pos, n = 0, blen = 0;
+    char*    data;
+
+    while((s = _lqTake(q, &pos)))
+    {
+        data = s->ext ? s->ext : s->data;
+
+        switch(k->type)
+        {
+            case LOG_SINK_FILE:
+            case LOG_SINK_CONSOLE:
+                if(blen && blen + s->len > LQ_BATCH)
+                {
+                    _lsWrite(k, batch, blen);
+                    blen = 0;
+                }
+                if(s->len > LQ_BATCH)
+                    _lsWrite(k, data, s->len);
+                else
+                {
+                    memcpy(batch + blen, data, s->len);
+                    blen += s->len;
+                }
+                break;
+            case LOG_SINK_UNIX:
+                if(sendto(k->fd, data, s->len, MSG_NOSIGNAL, (struct sockaddr*)&k->addr, sizeof(k->addr)) != (ssize_t)s->len)
+                    __atomic_fetch_add(&k->nerr, 1, __ATOMIC_RELAXED);
+                break;
+            case LOG_SINK_MEMORY:
+                _lsMemPut(k, data, s->len);
+                break;
+            default:
+                k->fn(data, s->len, k->arg);
+        }
+
+        _lqRelease(q, s, pos);
+        n++;
+    }
+
+    if(blen)
+        _lsWrite(k, batch, blen);
+    if(n)
+        __atomic_fetch_add(&k->nrec, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+static void _lsOut(LogPtr log, const char* rec, size_t len, unsigned flags)
+{
+    struct LogSink* k;
+    int lv = LR_LVOF(flags);
+
+    for(k = __atomic_load_n(&log->sinks, __ATOMIC_ACQUIRE); k; k = k->next)
+        if(lv < 0 || lv >= k->level)
+            _lqPush(k->queue, rec, len, 0);
+}
+
+static void _lsDestroyAll(LogPtr log)
+{
+    struct LogSink* k;
+
+    while((k = log->sinks))
+    {
+        log->sinks = k->next;
+        _lqDestroy(k->queue);               // 写完队列中的记录
+        k->queue = NULL;
+        logSinkFree(k);
+    }
+}
+
+/**
+ * @brief logSinkFile - 创建文件输出
+ * @param path  文件路径, 以追加方式打开, 不存在则创建
+ * @return 输出, 失败时返回 NULL
+ * @note  文件输出不参与日志的大小限制和轮转
+ */
+LogSink* logSinkFile(const char* path)
+{
+    struct LogSink* k;
+
+    if(!path)   return NULL;
+    if(!(k = _lsNew(LOG_SINK_FILE)))
+        return NULL;
+    k->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(k->fd < 0)
+    {
+        free(k);
+        return NULL;
+    }
+    k->ownfd = true;
+    return k;
+}
+
+/**
+ * @brief logSinkConsole - 创建控制台输出
+ * @param fd    写入的文件描述符, 如 STDERR_FILENO, 释放输出时不会关闭
+ */
+LogSink* logSinkConsole(int fd)
+{
+    struct LogSink* k;
+
+    if(fd < 0 || !(k = _lsNew(LOG_SINK_CONSOLE)))
+        return NULL;
+    k->fd = fd;
+    return k;
+}
+
+/**
+ * @brief logSinkUnix - 创建 unix 数据报套接字输出, 每条记录 (包括结尾的换行) 发送一个数据报
+ * @param path  接收方绑定的地址, 发送时才使用, 所以接收方可以之后再启动; 接收方不存在时发送失败, 计入 errors
+ */
+LogSink* logSinkUnix(const char* path)
+{
+    struct LogSink* k;
+
+    if(!path || strlen(path) >= sizeof(k->addr.sun_path))
+        return NULL;
+    if(!(k = _lsNew(LOG_SINK_UNIX)))
+        return NULL;
+    k->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(k->fd < 0)
+    {
+        free(k);
+        return NULL;
+    }
+    k->ownfd = true;
+    k->addr.sun_family = AF_UNIX;
+    strcpy(k->addr.sun_path, path);
+    return k;
+}
+
+/**
+ * @brief logSinkMemory - 创建内存输出, 在环形缓冲区中保留最近的记录, 由 logSinkRead 读取
+ * @param size  缓冲区大小, 单位为字节, 向上取整为 2 的幂, 至少 4096
+ */
+LogSink* logSinkMemory(size_t size)
+{
+    struct LogSink* k;
+    size_t n = 4096;
+
+    if(!size || size > LOG_MAP_MAXCAP)
+        return NULL;
+    while(n < size)     n <<= 1;
+    if(!(k = _lsNew(LOG_SINK_MEMORY)))
+        return NULL;
+    k->ring = (char*)malloc(n);
+    if(!k->ring)
+    {
+        free(k);
+        return NULL;
+    }
+    k->size = n;
+    pthread_mutex_init(&k->mtx, NULL);
+    return k;
+}
+
+/**
+ * @brief logSinkCallback - 创建回调输出
+ * @param fn    在输出的写线程中对每条记录调用 fn(rec, len, arg), 同一输出的调用不会并发
+ */
+LogSink* logSinkCallback(LogSinkFn fn, void* arg)
+{
+    struct LogSink* k;
+
+    if(!fn || !(k = _lsNew(LOG_SINK_CALLBACK)))
+        return NULL;
+    k->fn  = fn;
+    k->arg = arg;
+    return k;
+}
+
+/**
+ * @brief logSinkFree - 释放输出
+ * @note  已加入日志的输出归日志所有, 由 logDestroy 释放, 这里直接返回
+ */
+void logSinkFree(LogSink* sink)
+{
+    if(!sink || sink->queue)    return;
+    if(sink->ownfd)
+        close(sink->fd);
+    if(LOG_SINK_MEMORY == sink->type)
+    {
+        pthread_mutex_destroy(&sink->mtx);
+        free(sink->ring);
+    }
+    free(sink);
+}
+
+/**
+ * @brief logAddSink - 为日志增加一个输出, 启动它的写线程
+ * @param log
+ * @param sink  输出, 成功后归日志所有, 失败时仍由调用者释放
+ * @param level 不低于此级别的分级记录写入此输出, 不分级的记录总是写入; 可以低于日志级别, 如 TRACE 记录只写入内存输出
+ * @param qsize 队列长度 (记录条数), 为 0 时使用 DF_LOG_QSIZE
+ * @param policy 队列已满时的处理策略 LOG_BP_*, 只影响这个输出
+ * @return LOG_OK / LOG_ERR
+ * @note  二进制模式下记录不写入增加的输出
+ */
+int logAddSink(LogPtr log, LogSink* sink, int level, size_t qsize, int policy)
+{
+    static const char* names[] = {"file", "console", "unix", "memory", "callback"};
+
+    if(!log || !sink || sink->queue || level < LOG_LV_TRACE || level > LOG_LV_OFF)
+        return LOG_ERR;
+    if(policy < LOG_BP_BLOCK || policy > LOG_BP_DROPOLD)
+        policy = LOG_BP_BLOCK;
+
+    sink->level = level;
+    sink->queue = _lqCreate(log, sink, qsize ? qsize : DF_LOG_QSIZE, policy);
+    if(!sink->queue)
+    {
+        logsysAdd(log, "Add sink err: %s\n", strerror(errno));
+        return LOG_ERR;
+    }
+
+    pthread_mutex_lock(&_ls_mtx);
+    sink->next = log->sinks;
+    __atomic_store_n(&log->sinks, sink, __ATOMIC_RELEASE);
+    _lrLevel(log);                          // 输出级别可能低于日志级别
+    pthread_mutex_unlock(&_ls_mtx);
+
+    logsysAdd(log, "Add %s sink, level %s\n", names[sink->type], level == LOG_LV_OFF ? "OFF" : _lv_name[level]);
+    return LOG_OK;
+}
+
+/**
+ * @brief logSinkRead - 读取内存输出中最近的记录
+ * @param sink  内存输出, 已加入日志时先等待其队列中的记录写入
+ * @param buf   输出, 以 '\0' 结尾; 缓冲区已回绕或 buf 放不下时, 丢弃开头不完整的记录
+ * @return 读取的长度, 不是内存输出时为 0
+ */
+size_t logSinkRead(LogSink* sink, char* buf, size_t cap)
+{
+    size_t n, pos, idx, first, skip = 0;
+
+    if(!sink || LOG_SINK_MEMORY != sink->type || !buf || !cap)
+        return 0;
+    if(sink->queue)
+        _lqFlush(sink->queue);
+
+    pthread_mutex_lock(&sink->mtx);
+    n = sink->head < sink->size ? sink->head : sink->size;
+    if(n > cap - 1)
+        n = cap - 1;
+    pos   = sink->head - n;
+    idx   = pos & (sink->size - 1);
+    first = n < sink->size - idx ? n : sink->size - idx;
+    memcpy(buf, sink->ring + idx, first);
+    memcpy(buf + first, sink->ring, n - first);
+    pthread_mutex_unlock(&sink->mtx);
+
+    if(pos)                                 // 从下一条记录开始
+    {
+        while(skip < n && buf[skip] != '\n')
+            skip++;
+        skip = skip < n ? skip + 1 : n;
+        memmove(buf, buf + skip, n - skip);
+        n -= skip;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief logSinkStats - 获取输出的计数
+ * @param records   若不为 NULL, 存放写入 (交给输出) 的记录数
+ * @param dropped   若不为 NULL, 存放因队列已满而丢弃的记录数
+ * @param errors    若不为 NULL, 存放写入或发送失败的次数
+ */
+void logSinkStats(LogSink* sink, size_t* records, size_t* dropped, size_t* errors)
+{
+    if(records)
+        *records = sink ? __atomic_load_n(&sink->nrec, __ATOMIC_RELAXED) : 0;
+    if(dropped)
+        *dropped = sink && sink->queue ? __atomic_load_n(&sink->queue->drop_new, __ATOMIC_RELAXED)
+                                       + __atomic_load_n(&sink->queue->drop_old, __ATOMIC_RELAXED) : 0;
+    if(errors)
+        *errors = sink ? __atomic_load_n(&sink->nerr, __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * @brief logGetCounters - 获取日志的运行计数
+ * @param log
+ * @param c     输出
+ * @note  各计数分别原子地读取, 并发写入时彼此之间可能有少量出入
+ */
+void logGetCounters(LogPtr log, LogCounters* c)
+{
+    int i;
+
+    if(!c)  return;
+    memset(c, 0, sizeof(*c));
+    if(!log)    return;
+
+    if(log->shards)
+        for(i = 0; i < LOG_STAT_SHARDS; i++)
+            c->records += __atomic_load_n(&log->shards[i].nrec, __ATOMIC_RELAXED);
+    c->bytes     = __atomic_load_n(&log->wbase, __ATOMIC_RELAXED) + __atomic_load_n(&log->cursize, __ATOMIC_RELAXED);
+    c->dropped   = logDropped(log, NULL, NULL);
+    c->errors    = __atomic_load_n(&log->nerr, __ATOMIC_RELAXED);
+    c->rotations = __atomic_load_n(&log->nrot, __ATOMIC_RELAXED);
+    c->limits    = __atomic_load_n(&log->nlimit, __ATOMIC_RELAXED);
+    c->flushes   = __atomic_load_n(&log->nflush, __ATOMIC_RELAXED);
+    c->syncs     = __atomic_load_n(&log->nsync, __ATOMIC_RELAXED);
+    c->suppressed = __atomic_load_n(&log->nsupp, __ATOMIC_RELAXED);
+    c->fallbacks = log->map ? __atomic_load_n(&log->map->nfall, __ATOMIC_RELAXED) : 0;
+}
+
+/* ------------------------- private functions ------------------------------ */
 #ifdef TESTMODE
 
+/* 替换 malloc 等分配函数, 统计本线程在 _test_nalloc 不小于 0 期间分配的次数, 用于检查添加日志时不分配内存 */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void* __libc_memalign(size_t align, size_t size);
+static __thread long _test_nalloc = -1;
+
+void* malloc(size_t size)
+{
+    if(_test_nalloc >= 0)   _test_nalloc++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    if(_test_nalloc >= 0)   _test_nalloc++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    if(_test_nalloc >= 0)   _test_nalloc++;
+    return __libc_realloc(p, size);
+}
+
+int posix_memalign(void** p, size_t align, size_t size)
+{
+    if(_test_nalloc >= 0)   _test_nalloc++;
+    return (*p = __libc_memalign(align, size)) ? 0 : ENOMEM;
+}
+
+/* 很慢的回调输出, 用于测试输出之间互不影响 */
+static void _testSlowSink(const char* rec, size_t len, void* arg)
+{
+    struct timespec ts = {0, 2000000};
+
+    (void)rec;
+    (void)len;
+    (void)arg;
+    nanosleep(&ts, NULL);
+}
+
+/* 调用处统计的测试: 写入长度不同的记录的调用处, 以及在第一次执行之前就被关闭的调用处 */
+static void _testSiteBig(LogPtr log, int i)
+{
+    logAt(log, "test_log_site big %d %s\n", i, "................................................................");
+}
+
+static void _testSiteSmall(LogPtr log, int i)
+{
+    logAtLevel(log, LOG_LV_INFO, "test_log_site small %d\n", i);
+}
+
+static void _testSiteLazy(LogPtr log, int i)
+{
+    logAt(log, "test_log_site lazy %d\n", i);
+}
+
+static int _testLines(FILE* fp, const char* want)      // 统计包含 want 的行数
+{
+    char*  line = NULL;
+    size_t cap = 0;
+    int    n = 0;
+
+    rewind(fp);
+    while(getline(&line, &cap, fp) > 0)
+        n += NULL != strstr(line, want);
+    free(line);
+    return n;
+}
+
+/* 分别用 _fmtV 和 vsnprintf 格式化, 不同时输出并返回 1 */
+static int _testFmt(const char* fmt, ...)
+{
+    char fast[128], ref[128];
+    int  nf, nr;
+    va_list ap, cp;
+
+    va_start(ap, fmt);
+    va_copy(cp, ap);
+    nf = _fmtV(fast, sizeof(fast), fmt, ap);
+    nr = vsnprintf(ref, sizeof(ref), fmt, cp);
+    va_end(cp);
+    va_end(ap);
+    if(nf == nr && 0 == strcmp(fast, ref))
+        return 0;
+    logShow("formatter mismatch: \"%s\" -> \"%s\", printf \"%s\"\n", fmt, fast, ref);
+    return 1;
+}
+
 void logTest()
 {
     logShow("------- logShowAPI test ------\n");
     logShowTime();
     logShowText("[logShowText]\n");
     logShow("[logShow] This is a test logshow\n");
+    logSetTimePrecision(LOG_TS_MS);
+    logShow("[logShow] This is a test logshow with milliseconds\n");
+    logSetTimePrecision(LOG_TS_US);
+    logShow("[logShow] This is a test logshow with microseconds\n");
+    logSetTimePrecision(LOG_TS_SEC);
     logShow("[logShow] Get a temp file path: %s\n\n", _logPath(DF_LOG_DIR, "test"));
 
     logShow("----- logsysAPI test -----\n");
@@ -676,8 +7154,558 @@ void logTest()
 
     logAddNMute(test_log_nmute,"test_log_nmute in logAddNMute[out ok]\n");
 
+    logShow("----- logLevelAPI test -----\n");
+    int test_level_eval = 0;
+    logSetLevel(test_log_mute, LOG_LV_WARN);
+    logDebug(test_log_mute, "test_log_mute in logDebug[out not ok] %d\n", ++test_level_eval);
+    logWarn(test_log_mute, "test_log_mute in logWarn[out ok] %d\n", ++test_level_eval);
+    logError(test_log_mute, "test_log_mute in logError[out ok] %d\n", ++test_level_eval);
+    logShow("filtered arguments evaluated: %s\n", 2 == test_level_eval ? "ok" : "err");
+    logSetLevel(test_log_mute, LOG_LV_TRACE);
+
+    logShow("----- logByNameAPI test -----\n");
+    logAddByName("a_nomute_test_Log", "test_log_nmute in logAddByName[out not ok]\n");
+    logAdd(logHandle("a_mute_test_Log"), "test_log_mute in logHandle[out ok]\n");
+    logShow("logGet: %s\n", logGet("a_mute_test_Log") == test_log_mute ? "ok" : "err");
+
+    LogCounters test_counters;
+    logGetCounters(test_log_nmute, &test_counters);
+    logShow("test_log_nmute counters: records %zu, bytes %zu\n", test_counters.records, test_counters.bytes);
+    logsysDump();
+
     logDestroy(test_log_nmute);
     logDestroy(test_log_mute);
+    logShow("logGet after destroy: %s\n", logGet("a_mute_test_Log") ? "err" : "ok");
+
+    logShow("----- logRotateAPI test -----\n");
+    LogPtr test_log_rotate = logCreate("a_rotate_test_Log", "./test_log_rotate.out", MUTE);
+    logSetRotate(test_log_rotate, 3, 0);
+    test_log_rotate->maxsize = 4096;
+    int i;
+    for(i = 0; i < 1000; i++)
+    {
+        logAdd(test_log_rotate, "test_log_rotate %d\n", i);
+        logFlush(test_log_rotate);          // 完成已请求的轮转, 不依赖后台线程的调度
+    }
+    logDestroy(test_log_rotate);
+    logShow("test_log_rotate archives: %s %s %s\n", access("./test_log_rotate.out.1", F_OK) ? "err" : "ok",
+            access("./test_log_rotate.out.3", F_OK) ? "err" : "ok", access("./test_log_rotate.out.4", F_OK) ? "ok" : "err");
+
+    logShow("----- logMmapAPI test -----\n");
+    LogPtr test_log_mmap = logCreateMmap("a_mmap_test_Log", "./test_log_mmap.out", MUTE, 1);
+    for(i = 0; i < 1000; i++)
+        logAdd(test_log_mmap, "test_log_mmap %d\n", i);
+    logShow("test_log_mmap size: %u\n", (unsigned int)logFileSize(test_log_mmap));
+    logDestroy(test_log_mmap);
+    unlink("./test_log_mmap_grow.out");
+    LogPtr test_log_mmap_grow = logCreateMmap("a_mmap_grow_test_Log", "./test_log_mmap_grow.out", MUTE, 1);
+    logSetFileSize(test_log_mmap_grow, 1);
+    logSetFileSize(test_log_mmap_grow, 16); // 映射范围随之加大, 超过最初的 1 M + 4 个 chunk 时不改用 pwrite
+    char test_mmap_pad[201];
+    memset(test_mmap_pad, 'g', 200);
+    test_mmap_pad[200] = '\0';
+    for(i = 0; i < 40000; i++)
+        logAdd(test_log_mmap_grow, "%s %d\n", test_mmap_pad, i);
+    logGetCounters(test_log_mmap_grow, &test_counters);
+    logShow("test_log_mmap grow: size %zu, fallbacks %zu: %s\n", logFileSize(test_log_mmap_grow), test_counters.fallbacks,
+            logFileSize(test_log_mmap_grow) > (6 << 20) && 0 == test_counters.fallbacks ? "ok" : "err");
+    logDestroy(test_log_mmap_grow);
+    int  test_hole_fd = open("./test_log_mmap_hole.out", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    char test_hole[16] = "abc\n\0\0\0\0def\n";  // 中间是崩溃时未写入的空洞, 末尾是预分配的部分
+    if(write(test_hole_fd, test_hole, sizeof(test_hole)) != sizeof(test_hole))
+        logShow("test_log_mmap hole write: err\n");
+    close(test_hole_fd);
+    logDestroy(logCreateMmap("a_mmap_hole_test_Log", "./test_log_mmap_hole.out", MUTE, 1));
+    memset(test_hole, 0, sizeof(test_hole));
+    test_hole_fd = open("./test_log_mmap_hole.out", O_RDONLY);
+    logShow("test_log_mmap hole: %s\n", 12 == read(test_hole_fd, test_hole, sizeof(test_hole)) && 0 == memcmp(test_hole, "abc\n   \ndef\n", 12) ? "ok" : "err");
+    close(test_hole_fd);
+
+    logShow("----- logAsyncAPI test -----\n");
+    LogPtr test_log_async = logCreateAsync("a_async_test_Log", "./test_log_async.out", MUTE, 64, LOG_BP_DROPOLD);
+    logAddNMute(test_log_async, "test_log_async in logAddNMute[out ok]\n");
+    for(i = 0; i < 1000; i++)
+        logAdd(test_log_async, "test_log_async %d\n", i);
+    logFlush(test_log_async);
+    logShow("test_log_async dropped: %u\n", (unsigned int)logDropped(test_log_async, NULL, NULL));
+    LogStats* test_stats = (LogStats*)malloc(sizeof(LogStats));
+    logSetStats(test_log_async, true);
+    for(i = 0; i < 1000; i++)
+        logAdd(test_log_async, "test_log_async stats %d\n", i);
+    logFlush(test_log_async);
+    logStats(test_log_async, test_stats);
+    logShow("test_log_async stats: records %zu, add samples %zu, disk samples %zu, add p99 %zu ns\n",
+            test_stats->cnt.records, test_stats->add.count, test_stats->disk.count, logHistPercentile(&test_stats->add, 99));
+    logStatsDump(stdout);
+    free(test_stats);
+    logDestroy(test_log_async);
+    unlink("./test_log_async_pool.out");
+    LogPtr test_log_pool = logCreateAsync("a_async_pool_test_Log", "./test_log_async_pool.out", MUTE, 256, LOG_BP_DROPOLD);
+    char test_pool_pad[1001];
+    memset(test_pool_pad, 'l', 1000);
+    test_pool_pad[1000] = '\0';
+    for(i = 0; i < 10; i++)
+        logAdd(test_log_pool, "test_log_pool short %d\n", i);
+    for(i = 0; i < 100; i++)                // 长记录用完缓冲区池后只丢弃长记录本身, 不挤掉前面的短记录
+        logAdd(test_log_pool, "test_log_pool long %d %s\n", i, test_pool_pad);
+    logDestroy(test_log_pool);
+    FILE* test_pool_fp = fopen("./test_log_async_pool.out", "r");
+    char  test_pool_line[1100];
+    int   test_pool_short = 0;
+    while(test_pool_fp && fgets(test_pool_line, sizeof(test_pool_line), test_pool_fp))
+        test_pool_short += NULL != strstr(test_pool_line, "test_log_pool short ");
+    if(test_pool_fp)    fclose(test_pool_fp);
+    logShow("test_log_async pool exhausted, short records kept: %d: %s\n", test_pool_short, 10 == test_pool_short ? "ok" : "err");
+
+    logShow("----- logBinaryAPI test -----\n");
+    unlink("./test_log_binary.out");
+    LogPtr test_log_binary = logCreate("a_binary_test_Log", "./test_log_binary.out", MUTE);
+    logSetBinary(test_log_binary);
+    logAddTime(test_log_binary);
+    for(i = 0; i < 3; i++)
+        logAdd(test_log_binary, "test_log_binary %d %s %5.2f %lld %-*.*s|%c%%%x\n", i, "str", i / 3.0, -1099511627776LL, 6, 2, "abcdef", 'z', 255);
+    logAdd(test_log_binary, "test_log_binary %ls unsupported\n", L"wide");
+    logAddNMute(test_log_binary, "test_log_binary in logAddNMute[out ok] %s\n", (char*)NULL);
+    logWarn(test_log_binary, "test_log_binary in logWarn %d\n", 42);
+    logDestroy(test_log_binary);
+    const char* test_log_binary_path = "./test_log_binary.out";
+    logDecode(&test_log_binary_path, 1, stdout);
+    unlink("./test_log_binary_async.out");
+    LogPtr test_log_bin_async = logCreateAsync("a_binary_async_test_Log", "./test_log_binary_async.out", MUTE, 16, LOG_BP_DROPOLD);
+    logSetBinary(test_log_bin_async);
+    for(i = 0; i < 2000; i++)               // 队列很小, 格式串定义常常是最早的记录, 但不能被丢弃
+        logAdd(test_log_bin_async, i % 3 ? "test_log_binary async %d\n" : "test_log_binary async %d %s\n", i, "x");
+    logDestroy(test_log_bin_async);
+    const char* test_log_bin_async_path = "./test_log_binary_async.out";
+    FILE* test_bin_out = tmpfile();
+    char  test_bin_line[256];
+    int   test_bin_n = 0, test_bin_bad = 0;
+    logDecode(&test_log_bin_async_path, 1, test_bin_out);
+    rewind(test_bin_out);
+    while(fgets(test_bin_line, sizeof(test_bin_line), test_bin_out))
+    {
+        test_bin_n++;
+        test_bin_bad += NULL != strstr(test_bin_line, "bad record");
+    }
+    fclose(test_bin_out);
+    logShow("test_log_binary async dropold: %d records, %d bad: %s\n", test_bin_n, test_bin_bad, test_bin_n > 0 && !test_bin_bad ? "ok" : "err");
+
+    logShow("----- logFlushAPI test -----\n");
+    LogPtr test_log_flush = logCreate("a_flush_test_Log", "./test_log_flush.out", MUTE);
+    logSetFlush(test_log_flush, 4096, 50, LOG_LV_ERROR, 100);
+    size_t test_flush_size = logFileSize(test_log_flush);
+    logInfo(test_log_flush, "test_log_flush buffered\n");
+    logShow("buffered record not written: %s\n", logFileSize(test_log_flush) == test_flush_size ? "ok" : "err");
+    logError(test_log_flush, "test_log_flush durable\n");
+    logGetCounters(test_log_flush, &test_counters);
+    logShow("durable record written and synced: %s\n",
+            logFileSize(test_log_flush) > test_flush_size && test_counters.syncs ? "ok" : "err");
+    logInfo(test_log_flush, "test_log_flush buffered again\n");
+    test_flush_size = logFileSize(test_log_flush);
+    usleep(200000);
+    logGetCounters(test_log_flush, &test_counters);
+    logShow("background write and sync: %s, syncs %zu\n", logFileSize(test_log_flush) > test_flush_size ? "ok" : "err", test_counters.syncs);
+    logDestroy(test_log_flush);
+
+    logShow("----- logStormAPI test -----\n");
+    LogPtr test_log_storm = logCreate("a_storm_test_Log", "./test_log_storm.out", MUTE);
+    int test_storm_eval = 0;
+    for(i = 0; i < 1000; i++)
+        logAddRate(test_log_storm, 1, 5, "test_log_storm rate %d\n", ++test_storm_eval);
+    logShow("rate limited arguments evaluated: %s\n", 5 == test_storm_eval ? "ok" : "err");
+    for(i = 0; i < 1000; i++)
+        logAddSample(test_log_storm, 100, "test_log_storm sample %d\n", i);
+    logSetDedup(test_log_storm, true);
+    for(i = 0; i < 100; i++)
+        logAdd(test_log_storm, "test_log_storm dedup\n");
+    logAdd(test_log_storm, "test_log_storm dedup end\n");
+    logGetCounters(test_log_storm, &test_counters);
+    logShow("test_log_storm suppressed: %zu\n", test_counters.suppressed);
+    logSiteDump(stdout);
+    logDestroy(test_log_storm);
+
+    logShow("----- formatter test -----\n");
+    static const char* test_fmt_int[] = {"%d", "%-8d|", "%+05d", "% d", "%.0d", "%.5i", "%hhd", "%hd", "%u", "%#x", "%08X", "%#o", "%c|%5c"};
+    static const char* test_fmt_ll[]  = {"%ld", "%lld", "%zd", "%jd", "%-#10lx", "%llu", "%zu", "%p", "%-20p|"};
+    static const char* test_fmt_dbl[] = {"%f", "%.0f", "%#.0f", "%+.3f", "%012.4f", "%-12.17f|", "% .1f", "%e", "%g", "%10.3a"};
+    static const char* test_fmt_str[] = {"%s", "%-10s|", "%.3s", "%8.2s|", "%.7s", "%%%s%%"};
+    int test_fmt_bad = 0, test_fmt_tot = 0, j;
+    for(i = 0; i < 3000; i++)
+    {
+        long long v = (long long)(((unsigned long long)rand() << 42) ^ ((unsigned long long)rand() << 21) ^ rand()) >> (i % 64);
+        double d = (i & 1 ? -1 : 1) * (double)v / (1ULL << (i % 60)) + (i % 3 ? 0 : 0.5);
+        for(j = 0; j < (int)(sizeof(test_fmt_int) / sizeof(test_fmt_int[0])); j++, test_fmt_tot++)
+            test_fmt_bad += _testFmt(test_fmt_int[j], (int)v, (int)(v >> 8));
+        for(j = 0; j < (int)(sizeof(test_fmt_ll) / sizeof(test_fmt_ll[0])); j++, test_fmt_tot++)
+            test_fmt_bad += _testFmt(test_fmt_ll[j], v);
+        for(j = 0; j < (int)(sizeof(test_fmt_dbl) / sizeof(test_fmt_dbl[0])); j++, test_fmt_tot++)
+            test_fmt_bad += _testFmt(test_fmt_dbl[j], d);
+        for(j = 0; j < (int)(sizeof(test_fmt_str) / sizeof(test_fmt_str[0])); j++, test_fmt_tot++)
+            test_fmt_bad += _testFmt(test_fmt_str[j], i % 7 ? "log text" : NULL);
+    }
+    test_fmt_bad += _testFmt("%s %d %5.2f %x", "mixed", 1, 2.0, 3);
+    test_fmt_bad += _testFmt("%2$s %1$d", 1, "positional");     // 交给 vsnprintf
+    test_fmt_tot += 2;
+    logShow("formatter conformance: %d/%d %s\n", test_fmt_tot - test_fmt_bad, test_fmt_tot, test_fmt_bad ? "err" : "ok");
+
+    logShow("----- logRecorderAPI test -----\n");
+    unlink("./test_log_recorder.out");
+    LogPtr test_log_rec = logCreate("a_recorder_test_Log", "./test_log_recorder.out", MUTE);
+    logSetLevel(test_log_rec, LOG_LV_WARN);
+    logSetRecorder(test_log_rec, 1, LOG_LV_TRACE, "./test_log_recorder.crash");
+    logTrace(test_log_rec, "test_log_recorder in logTrace[recorder only]\n");
+    logWarn(test_log_rec, "test_log_recorder in logWarn[file and recorder]\n");
+    logShow("trace record not in file: %s\n", logFileSize(test_log_rec) < 150 ? "ok" : "err");   // 只有一条 WARN 记录
+    logDumpRecorder(test_log_rec, NULL);
+    pid_t test_pid = fork();
+    if(0 == test_pid)                       // 子进程中崩溃, 由信号处理函数写出
+    {
+        logSetCrashHandler(true);
+        logTrace(test_log_rec, "test_log_recorder before crash\n");
+        raise(SIGSEGV);
+        _exit(0);
+    }
+    waitpid(test_pid, NULL, 0);
+    FILE* test_fp = fopen("./test_log_recorder.crash", "r");
+    char  test_line[256];
+    int   test_found = 0;
+    while(test_fp && fgets(test_line, sizeof(test_line), test_fp))
+        test_found += NULL != strstr(test_line, "before crash") || NULL != strstr(test_line, "signal 11");
+    if(test_fp)     fclose(test_fp);
+    logShow("crash dump: %s\n", 2 == test_found ? "ok" : "err");
+    logDestroy(test_log_rec);
+
+    logShow("----- logKVAPI test -----\n");
+    LogPtr test_log_kv = logCreate("a_kv_test_Log", "./test_log_kv.out", NMUTE);
+    logAddKV(test_log_kv, LOG_LV_INFO, "request done", LOG_INT("latency_us", -42), LOG_STR("peer", "10.0.0.1:80"),
+             LOG_DBL("ratio", 0.1), LOG_BOOL("ok", 1), LOG_STR("note", "say \"hi\"\n\tbye"));
+    logSetFormat(test_log_kv, LOG_FMT_LOGFMT);
+    logAddKV(test_log_kv, LOG_LV_WARN, "request done", LOG_UINT("bytes", 18446744073709551615ULL), LOG_STR("peer", NULL));
+    logSetFormat(test_log_kv, LOG_FMT_JSON);
+    logAddKV(test_log_kv, LOG_LV_ERROR, "request failed", LOG_INT("code", 502), LOG_DBL("nan", 0.0 / 0.0),
+             LOG_STR("body", "{\"long\":\"string with \\ backslash and \x01 control past sixteen bytes\"}"));
+    logAddKV(test_log_kv, LOG_LV_INFO, NULL);
+    logAdd(test_log_kv, "printf record %d in json\n", 1);
+    logDestroy(test_log_kv);
+
+    logShow("----- logSinkAPI test -----\n");
+    unlink("./test_log_sink.out");
+    unlink("./test_log_sink.sock");
+    LogPtr  test_log_sink = logCreate("a_sink_test_Log", "./test_log_sink.out", MUTE);
+    LogSink* test_mem  = logSinkMemory(64 << 10);
+    LogSink* test_slow = logSinkCallback(_testSlowSink, NULL);
+    LogSink* test_unix = logSinkUnix("./test_log_sink.sock");
+    int     test_sock  = socket(AF_UNIX, SOCK_DGRAM, 0);
+    struct sockaddr_un test_addr = {.sun_family = AF_UNIX, .sun_path = "./test_log_sink.sock"};
+    char    test_buf[64 << 10];
+    bind(test_sock, (struct sockaddr*)&test_addr, sizeof(test_addr));
+    logSetLevel(test_log_sink, LOG_LV_WARN);
+    logAddSink(test_log_sink, test_mem, LOG_LV_TRACE, 0, LOG_BP_BLOCK);
+    logAddSink(test_log_sink, test_slow, LOG_LV_INFO, 4, LOG_BP_DROPNEW);
+    logAddSink(test_log_sink, test_unix, LOG_LV_WARN, 0, LOG_BP_DROPOLD);
+    logAddSink(test_log_sink, logSinkConsole(STDERR_FILENO), LOG_LV_ERROR, 0, LOG_BP_BLOCK);
+    logTrace(test_log_sink, "test_log_sink in logTrace[memory only]\n");
+    logError(test_log_sink, "test_log_sink in logError[file, memory, unix, console]\n");
+    uint64_t test_t0 = _statNow();
+    for(i = 0; i < 100; i++)                // 慢的回调输出只丢弃自己的记录, 不会阻塞添加
+        logInfo(test_log_sink, "test_log_sink in logInfo %d\n", i);
+    logShow("slow sink does not block: %s\n", _statNow() - test_t0 < 50000000 ? "ok" : "err");
+    logSinkRead(test_mem, test_buf, sizeof(test_buf));
+    logShow("memory sink: %s\n", strstr(test_buf, "[memory only]") && strstr(test_buf, "logInfo 99") ? "ok" : "err");
+    logFlush(test_log_sink);
+    ssize_t test_n = recv(test_sock, test_buf, sizeof(test_buf) - 1, MSG_DONTWAIT);
+    test_buf[test_n > 0 ? test_n : 0] = '\0';
+    logShow("unix sink: %s\n", strstr(test_buf, "[file, memory, unix") ? "ok" : "err");
+    size_t test_rec, test_drop, test_err;
+    logSinkStats(test_slow, &test_rec, &test_drop, &test_err);
+    logShow("slow sink records %zu, dropped %zu: %s\n", test_rec, test_drop, test_rec + test_drop == 101 && test_drop ? "ok" : "err");
+    logDestroy(test_log_sink);
+    close(test_sock);
+    unlink("./test_log_sink.sock");
+
+    logShow("----- logCompressAPI test -----\n");
+    unlink("./test_log_lz.out");
+    LogPtr test_log_lz = logCreateAsync("a_lz_test_Log", "./test_log_lz.out", MUTE, 0, LOG_BP_BLOCK);
+    logSetCompress(test_log_lz, 4);
+    for(i = 0; i < 2000; i++)
+        logAdd(test_log_lz, "test_log_lz compressed record %d\n", i);
+    logAddText(test_log_lz, "test_log_lz text line\n");
+    logFlush(test_log_lz);
+    logShow("compressed size: %zu (%s)\n", logFileSize(test_log_lz), logFileSize(test_log_lz) < 2000 * 40 / 4 ? "ok" : "err");
+    logDestroy(test_log_lz);
+    const char* test_lz_path = "./test_log_lz.out";
+    FILE* test_lz_fp = fopen("./test_log_lz.txt", "w+");
+    logDecodeRange(&test_lz_path, 1, "2000-01-01", NULL, test_lz_fp);
+    rewind(test_lz_fp);
+    test_found = 0;
+    while(fgets(test_line, sizeof(test_line), test_lz_fp))
+        test_found += NULL != strstr(test_line, "compressed record") || NULL != strstr(test_line, "text line");
+    fclose(test_lz_fp);
+    logShow("compressed decode: %d/2001 %s\n", test_found, 2001 == test_found ? "ok" : "err");
+    unlink("./test_log_lz_range.out");
+    LogPtr test_log_lzr = logCreateAsync("a_lz_range_test_Log", "./test_log_lz_range.out", MUTE, 0, LOG_BP_BLOCK);
+    char test_lz_pad[1401];
+    memset(test_lz_pad, 'r', 1400);
+    test_lz_pad[1400] = '\0';
+    logSetCompress(test_log_lzr, 4);
+    for(i = 0; i < 60; i++)                 // 每秒 3 条约 1.4 K 的记录, 块边界落在各个位置上, 有的记录跨越两个块
+        logAddText(test_log_lzr, "[2030-01-01 00:00:%02d] test_log_lz range %d %s\n", i / 3, i, test_lz_pad + i % 7 * 100);
+    logDestroy(test_log_lzr);
+    const char* test_lzr_path = "./test_log_lz_range.out";
+    char test_lz_from[32];
+    int  test_lz_full[20] = {0}, test_lz_bad = 0, test_lz_total = 0, test_lz_n;
+    test_lz_fp = tmpfile();
+    logDecode(&test_lzr_path, 1, test_lz_fp);
+    rewind(test_lz_fp);
+    while(fgets(test_line, sizeof(test_line), test_lz_fp))
+        if(1 == sscanf(test_line, "[2030-01-01 00:00:%d] test_log_lz range ", &test_lz_n) && test_lz_n >= 0 && test_lz_n < 20)
+            test_lz_full[test_lz_n]++;
+    fclose(test_lz_fp);
+    for(i = 0; i < 20; i++)                 // 按秒还原, 与完整还原中该秒的记录数相同
+    {
+        snprintf(test_lz_from, sizeof(test_lz_from), "2030-01-01 00:00:%02d", i);
+        test_lz_fp = tmpfile();
+        logDecodeRange(&test_lzr_path, 1, test_lz_from, test_lz_from, test_lz_fp);
+        rewind(test_lz_fp);
+        test_lz_n = 0;
+        while(fgets(test_line, sizeof(test_line), test_lz_fp))
+            if(strstr(test_line, test_lz_from) && strstr(test_line, "test_log_lz range "))
+                test_lz_n++;
+        fclose(test_lz_fp);
+        test_lz_total += test_lz_n;
+        test_lz_bad   += test_lz_full[i] != test_lz_n;
+    }
+    logShow("compressed range decode: %d/60 records, %d seconds differ from full decode: %s\n", test_lz_total, test_lz_bad,
+            0 == test_lz_bad && 60 == test_lz_total ? "ok" : "err");
+
+    logShow("----- zero allocation test -----\n");
+    LogPtr test_log_za = logCreate("a_za_test_Log", "./test_log_za.out", MUTE);
+    LogPtr test_log_zq = logCreateAsync("a_zq_test_Log", "./test_log_zq.out", MUTE, 64, LOG_BP_BLOCK);
+    char test_long[2048];
+    int  test_round, test_nalloc = -1;
+    memset(test_long, 'z', sizeof(test_long) - 1);
+    test_long[sizeof(test_long) - 1] = '\0';
+    logSetLevel(test_log_za, LOG_LV_INFO);
+    logSetDedup(test_log_zq, true);
+    for(test_round = 0; test_round < 2; test_round++)      // 第一轮预热 (时区, 线程的计数分片等), 第二轮计数
+    {
+        _test_nalloc = test_round ? 0 : -1;
+        for(i = 0; i < 1000; i++)
+        {
+            logAdd(test_log_za, "test_log_za %d %s %.3f\n", i, "str", i / 7.0);
+            logInfo(test_log_za, "test_log_za info %d\n", i);
+            logDebug(test_log_za, "test_log_za debug %d\n", i);
+            logAddKV(test_log_za, LOG_LV_WARN, "test_log_za kv", LOG_INT("i", i), LOG_STR("s", "v"), LOG_DBL("d", 0.5));
+            logAddByName("a_za_test_Log", "test_log_za by name %d\n", i);
+            logAdd(test_log_zq, "test_log_zq %d\n", i);
+            logAdd(test_log_zq, "test_log_zq long %d %s\n", i, test_long);   // 超出槽位, 使用缓冲区池
+            logAdd(test_log_zq, "test_log_zq repeated\n");
+        }
+        test_nalloc  = _test_nalloc;
+        _test_nalloc = -1;
+    }
+    logShow("steady state allocations: %d %s\n", test_nalloc, 0 == test_nalloc ? "ok" : "err");
+    logFlush(test_log_zq);
+    logShow("async long records: %s\n", 0 == logDropped(test_log_zq, NULL, NULL) ? "ok" : "err");
+    logDestroy(test_log_za);
+    logDestroy(test_log_zq);
+
+    logShow("----- logSiteAPI test -----\n");
+    LogPtr test_log_site = logCreate("a_site_test_Log", "./test_log_site.out", MUTE);
+    LogSiteStat test_top[8];
+    int test_ntop;
+    logSiteEnable("_testSiteLazy", false);          // 此时还没有登记
+    for(i = 0; i < 100; i++)
+    {
+        _testSiteBig(test_log_site, i);
+        _testSiteSmall(test_log_site, i);
+        _testSiteLazy(test_log_site, i);
+    }
+    test_ntop = logSiteTop(test_top, 8);
+    logShow("site top: %d sites, first %s() %zu records: %s\n", test_ntop, test_ntop ? test_top[0].site->func : "-", test_ntop ? test_top[0].records : 0,
+            2 == test_ntop && 0 == strcmp(test_top[0].site->func, "_testSiteBig") && 100 == test_top[0].records ? "ok" : "err");
+    logShow("site disable: %s\n", 1 == logSiteEnable("_testSiteBig", false) ? "ok" : "err");
+    for(i = 0; i < 100; i++)
+    {
+        _testSiteBig(test_log_site, i);
+        _testSiteSmall(test_log_site, i);
+    }
+    test_ntop = logSiteTop(test_top, 8);
+    logShow("site disabled count: %s\n", 2 == test_ntop && 100 == (0 == strcmp(test_top[0].site->func, "_testSiteBig") ? test_top[0] : test_top[1]).records ? "ok" : "err");
+    logSiteTopDump(stderr, 8);
+    logSiteEnable("_testSiteBig", true);
+    logSiteEnable("_testSiteLazy", true);
+    logDestroy(test_log_site);
+
+    logShow("----- logSharedAPI test -----\n");
+    char  test_mp_path[64], test_mp_pad[61], test_mp_word[64];
+    int   test_mp_files = 0, test_mp_bad = 0, test_mp_c, test_mp_i;
+    pid_t test_mp_pid[4];
+    FILE* test_mp_fp;
+    memset(test_mp_pad, 'p', 60);
+    test_mp_pad[60] = '\0';
+    for(i = 0; i <= 30; i++)
+    {
+        snprintf(test_mp_path, sizeof(test_mp_path), i ? "./test_log_mp.out.%d" : "./test_log_mp.out", i);
+        unlink(test_mp_path);
+    }
+    unlink("./test_log_mp.out.shm");
+    for(test_mp_c = 0; test_mp_c < 4; test_mp_c++)     // 每个子进程写 20000 条, 共约 9 MB, 每 1 MB 轮转一次
+    {
+        if(0 == (test_mp_pid[test_mp_c] = fork()))
+        {
+            LogPtr test_log_mp = logCreate("a_mp_test_Log", "./test_log_mp.out", MUTE);
+            logSetFileSize(test_log_mp, 1);
+            logSetRotate(test_log_mp, 30, 0);
+            logSetShared(test_log_mp, true);
+            for(i = 0; i < 20000; i++)
+                logAdd(test_log_mp, "test_log_mp %d %d %s\n", test_mp_c, i, test_mp_pad);
+            logDestroy(test_log_mp);
+            _exit(0);
+        }
+    }
+    for(test_mp_c = 0; test_mp_c < 4; test_mp_c++)
+        waitpid(test_mp_pid[test_mp_c], NULL, 0);
+    test_found = 0;
+    for(i = 0; i <= 30; i++)
+    {
+        snprintf(test_mp_path, sizeof(test_mp_path), i ? "./test_log_mp.out.%d" : "./test_log_mp.out", i);
+        if(!(test_mp_fp = fopen(test_mp_path, "r")))
+            continue;
+        test_mp_files++;
+        while(fgets(test_line, sizeof(test_line), test_mp_fp))
+        {
+            if(strstr(test_line, "test_log_mp ") && 3 == sscanf(strstr(test_line, "test_log_mp "), "test_log_mp %d %d %61s", &test_mp_c, &test_mp_i, test_mp_word)
+               && 0 == strcmp(test_mp_word, test_mp_pad))
+                test_found++;
+            else
+                test_mp_bad++;
+        }
+        fclose(test_mp_fp);
+    }
+    logShow("shared records: %d/80000 in %d files, %d broken: %s\n", test_found, test_mp_files, test_mp_bad,
+            80000 == test_found && 0 == test_mp_bad && test_mp_files > 4 ? "ok" : "err");
+
+    logShow("----- logCreateMany test -----\n");
+    char   test_many_path[200][64], test_many_name[200][32];
+    const char* test_many_paths[200];
+    const char* test_many_names[200];
+    LogPtr test_many[200];
+    int    test_many_ok;
+    for(i = 0; i < 200; i++)            // 20 个目录, 每个目录 10 个日志
+    {
+        snprintf(test_many_path[i], sizeof(test_many_path[i]), "./test_many_logs/t%d/x%d.out", i / 10, i % 10);
+        snprintf(test_many_name[i], sizeof(test_many_name[i]), "a_many_test_Log%d", i);
+        test_many_paths[i] = test_many_path[i];
+        test_many_names[i] = test_many_name[i];
+    }
+    test_many_ok = logCreateMany(test_many, test_many_names, test_many_paths, 200, MUTE, 4, false);
+    test_found = 0;
+    for(i = 0; i < 200; i++)
+        if(test_many[i] && test_many[i]->fp && 0 == access(test_many_path[i], F_OK) && logGet(test_many_name[i]) == test_many[i])
+            test_found++;
+    logShow("logCreateMany: %d created, %d opened: %s\n", test_many_ok, test_found, 200 == test_many_ok && 200 == test_found ? "ok" : "err");
+    for(i = 0; i < 200; i++)
+    {
+        logDestroy(test_many[i]);
+        unlink(test_many_path[i]);
+        if(9 == i % 10)
+        {
+            snprintf(test_many_path[i], sizeof(test_many_path[i]), "./test_many_logs/t%d", i / 10);
+            rmdir(test_many_path[i]);
+        }
+    }
+    rmdir("./test_many_logs");
+
+    for(i = 0; i < 200; i++)            // 延迟打开: 创建时不访问文件系统
+        snprintf(test_many_path[i], sizeof(test_many_path[i]), "./test_many_lazy/x%d.out", i);
+    test_many_ok = logCreateMany(test_many, NULL, test_many_paths, 200, MUTE, 4, true);
+    logShow("logCreateMany lazy: %s\n", 200 == test_many_ok && test_many[0]->lazy && !test_many[0]->fp
+            && 0 == logFileSize(test_many[0]) && 0 != access("./test_many_lazy", F_OK) ? "ok" : "err");
+    logAdd(test_many[7], "test_many_lazy\n");
+    test_found = 0;
+    if((test_fp = fopen(test_many_path[7], "r")))
+    {
+        while(fgets(test_line, sizeof(test_line), test_fp))
+            test_found += NULL != strstr(test_line, "test_many_lazy");
+        fclose(test_fp);
+    }
+    logShow("lazy open on first write: %s\n", 1 == test_found && !test_many[7]->lazy && test_many[7]->fp
+            && logFileSize(test_many[7]) > 0 && 0 != access(test_many_path[8], F_OK) ? "ok" : "err");
+    for(i = 0; i < 200; i++)
+    {
+        logDestroy(test_many[i]);
+        unlink(test_many_path[i]);
+    }
+    rmdir("./test_many_lazy");
+    test_many[0] = logCreate(NULL, "./test_many_lazy/again.out", MUTE);    // 缓存中的目录已被删除
+    logShow("directory cache stale entry: %s\n", test_many[0] && 0 == access("./test_many_lazy/again.out", F_OK) ? "ok" : "err");
+    logDestroy(test_many[0]);
+    unlink("./test_many_lazy/again.out");
+    rmdir("./test_many_lazy");
+
+    logShow("----- logAddBlob test -----\n");
+    const char*   test_blob_dump = "Hello world\n\0\0\0\0ABCD";
+    const char*   test_blob_path = "./test_log_blob.out";
+    unsigned char test_blob[200000];
+    char  test_blob_want[3][512], test_blob_big[64];
+    int   test_blob_r[3];
+    for(i = 0; i < (int)sizeof(test_blob); i++)
+        test_blob[i] = (unsigned char)(i * 37 + 5);
+    test_found = snprintf(test_blob_want[0], sizeof(test_blob_want[0]), ":blob 37 ");
+    for(i = 0; i < 37; i++)                 // 两个 16 字节的块加上尾部
+        test_found += snprintf(test_blob_want[0] + test_found, sizeof(test_blob_want[0]) - test_found, "%02x", test_blob[i]);
+    snprintf(test_blob_want[0] + test_found, sizeof(test_blob_want[0]) - test_found, "\n");
+    snprintf(test_blob_want[1], sizeof(test_blob_want[1]), "%-60s|Hello world.....|\n", "00000000  48 65 6c 6c 6f 20 77 6f  72 6c 64 0a 00 00 00 00");
+    snprintf(test_blob_want[2], sizeof(test_blob_want[2]), "%-60s|ABCD|\n", "00000010  41 42 43 44");
+    for(test_mp_c = 0; test_mp_c < 2; test_mp_c++)     // 文本模式, 二进制模式 (还原后应相同)
+    {
+        unlink(test_blob_path);
+        LogPtr test_log_blob = logCreate("a_blob_test_Log", test_blob_path, MUTE);
+        if(test_mp_c)
+            logSetBinary(test_log_blob);
+        logAddBlob(test_log_blob, test_blob, 37);
+        logAddHexdump(test_log_blob, test_blob_dump, 20);
+        logDestroy(test_log_blob);
+        if(test_mp_c && (test_fp = tmpfile()))
+            logDecode(&test_blob_path, 1, test_fp);
+        else
+            test_fp = fopen(test_blob_path, "r");
+        memset(test_blob_r, 0, sizeof(test_blob_r));
+        if(test_fp)
+        {
+            for(i = 0; i < 3; i++)
+                test_blob_r[i] = _testLines(test_fp, test_blob_want[i]);
+            test_found = _testLines(test_fp, "[a_blob_test_Log] :hexdump 20\n");
+            fclose(test_fp);
+        }
+        logShow("%s blob and hexdump: %s\n", test_mp_c ? "binary" : "text",
+                1 == test_blob_r[0] && 1 == test_blob_r[1] && 1 == test_blob_r[2] && 1 == test_found ? "ok" : "err");
+    }
+
+    unlink(test_blob_path);                 // 异步模式: 调用者只拷贝数据, 由写线程编码
+    LogPtr test_log_ablob = logCreateAsync("a_ablob_test_Log", test_blob_path, MUTE, 0, LOG_BP_BLOCK);
+    for(test_round = 0; test_round < 2; test_round++)
+    {
+        _test_nalloc = test_round ? 0 : -1;
+        for(i = 0; i < 500; i++)
+            logAddBlob(test_log_ablob, test_blob, 37);
+        test_nalloc  = _test_nalloc;
+        _test_nalloc = -1;
+    }
+    logAddBlob(test_log_ablob, test_blob, sizeof(test_blob));
+    logDestroy(test_log_ablob);
+    snprintf(test_blob_big, sizeof(test_blob_big), ":blob %d %02x%02x", (int)sizeof(test_blob), test_blob[0], test_blob[1]);
+    test_blob_r[0] = test_blob_r[1] = 0;
+    if((test_fp = fopen(test_blob_path, "r")))
+    {
+        test_blob_r[0] = _testLines(test_fp, test_blob_want[0]);
+        test_blob_r[1] = _testLines(test_fp, test_blob_big);
+        fclose(test_fp);
+    }
+    logShow("async blob: %d records, %d allocations, large %d: %s\n", test_blob_r[0], test_nalloc, test_blob_r[1],
+            1000 == test_blob_r[0] && 0 == test_nalloc && 1 == test_blob_r[1] ? "ok" : "err");
+    unlink(test_blob_path);
 
 
 
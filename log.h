@@ -12,6 +12,29 @@
  *          2.1 使用 独立日志输出API, 输出日志到屏幕, 此部分API只负责输出, 不进行任何记录
  *          2.2 使用 创建及修改相关 API 创建和修改 相关日志结构
  *              然后使用 logAdd* 添加日志
+ *          2.3 创建时指定了名称的日志会由内部维护, 之后可以使用 logGet / logAddByName 通过名称使用,
+ *              频繁调用的地方可以使用 logHandle(name) 在调用处缓存日志结构, 避免每次都查找
+ *          2.4 对性能要求高的日志可以使用 logSetBinary 切换为二进制模式, 添加日志时不再格式化,
+ *              文件需使用 logdecode 工具 (或 logDecode) 还原为文本
+ *          2.5 默认每条记录直接 write 到文件, 但不保证落盘; logSetFlush 可以设置缓冲写入, 以及哪些级别的记录
+ *              需要立即 fdatasync, 其余记录由后台线程定时 fdatasync
+ *          2.6 可能在故障时大量重复的调用处可以使用 logAddRate / logAddSample (或 logRateOn / logSampleOn) 限流,
+ *              logSetDedup 合并连续重复的记录, 丢弃的条数会写入日志并计入 LogCounters.suppressed
+ *          2.7 需要被程序解析的日志可以使用 logSetFormat 输出 JSON Lines 或 logfmt, 并用 logAddKV 添加带类型的字段
+ *          2.8 logSetRecorder 可以在内存中保留更详细 (如 TRACE 级别) 的最近记录而不写入文件,
+ *              配合 logSetCrashHandler 在崩溃时写出, 或由 logDumpRecorder 主动写出
+ *          2.9 logAddSink 可以为日志增加输出 (文件, 控制台, unix 数据报套接字, 内存, 回调函数), 每个输出有自己的
+ *              队列和写线程, 慢的输出只会延迟或丢弃自己的记录; 如控制台可能很慢, 可以静默日志并增加控制台输出
+ *          2.10 logSetCompress 可以让异步日志的写线程把记录压缩为独立的块写入, 文件末尾有块的时间索引,
+ *               logdecode 工具 (或 logDecode / logDecodeRange) 还原为文本, 可以只解压某个时间范围
+ *          2.11 多个进程 (如 fork 出的工作进程) 各自创建同一路径的日志时, 都调用 logSetShared, 每条记录一次 O_APPEND
+ *               write 写入, 不会交错; 文件大小和轮转由映射自 path.shm 的共享控制块协调, 写记录时不加锁
+ *          2.12 logAt / logAtLevel (或在包含 log.h 之前定义 LOG_SITES) 按调用处统计记录数和字节数, logSiteTopDump
+ *               列出每秒写入字节数最多的调用处, logSiteEnable 可以在运行时按文件, 行号或函数关闭这些调用处
+ *          2.13 启动时要创建大量日志 (如每个租户一个) 时使用 logCreateMany 批量创建, 可以多线程并行打开文件,
+ *               或用 logCreateLazy (lazy 参数) 延迟到第一次写入时再打开; 已确认存在的目录会被缓存, 不会重复 mkdir
+ *          2.14 logAddBlob / logAddHexdump 记录原始数据 (如报文), 不必先转换为十六进制字符串; 异步模式下由写线程编码,
+ *               二进制模式下原样保存, 由 logdecode 还原为文本
  *
  * 编者语: 考虑到使用起来不太方便, 添加日志必须知道具体的 日志 结构, 这意味着在函数中使用时 要么传入一个日志结构,
  * 要么新建一个日志结构, 而新建的日志结构和原先的必然不一样, 所以最好的方法是传入一个日志结构, 这样无疑所有
@@ -30,14 +53,26 @@
 #include <time.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
 #include <limits.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
+#include <sys/uio.h>    // writev
 
 #ifndef LOG_H
 #define LOG_H
@@ -48,30 +83,204 @@
 
 #define DF_LOG_DIR      "./logs/"              // 默认的日志文件存放地点
 #define DF_LOG_SIZE    100                     // 默认日志文件大小 100 M
+#define LOG_MANY_THREADS 32                     // logCreateMany 并行打开文件的最大线程数
 
 #define NMUTE false
 #define MUTE  true
 
+/* 日志时间的精度, 即 "[YYYY-MM-DD HH:MM:SS.xxx] " 中小数的位数 */
+#define LOG_TS_SEC      0                       // 精确到秒 (默认)
+#define LOG_TS_MS       3                       // 精确到毫秒
+#define LOG_TS_US       6                       // 精确到微秒
+
+/* 异步模式下, 队列已满时的处理策略 */
+#define LOG_BP_BLOCK    0                       // 阻塞等待, 直到队列中有空位
+#define LOG_BP_DROPNEW  1                       // 丢弃最新的记录 (即本次要添加的记录)
+#define LOG_BP_DROPOLD  2                       // 丢弃队列中最旧的记录
+
+#define DF_LOG_QSIZE    4096                    // 默认的异步队列长度 (记录条数)
+#define LOG_QSLOT_SIZE  512                     // 异步队列中每个槽位可直接容纳的记录长度, 超出的放入队列预先分配的缓冲区
+#define LOG_REC_SIZE    4096                    // 每个线程用于格式化记录的缓冲区大小, 不超过此长度的记录添加时不分配内存
+#define LOG_BLOB_MAX    (64UL << 20)            // logAddBlob / logAddHexdump 一条记录最多的数据长度, 超出的部分不记录
+
+#define DF_LOG_MAPCHUNK 16                      // 内存映射模式下, 每次预分配的文件大小, 16 M
+#define LOG_MAP_MAXCAP  (1UL << 30)             // 内存映射模式下, 不限制文件大小时最初映射的地址空间, 1 G, 写满后加倍
+
+#define LOG_BIN_MAXFMT  4096                    // 二进制模式下最多可记录的格式串数, 超出的记录按文本格式化后保存
+#define LOG_BIN_MAXARGS 32                      // 二进制模式下每个格式串最多的参数个数, 超出的同上
+
+#define LOG_STAT_SHARDS 8                       // 计数和直方图按线程分片的个数, 为 2 的幂, 线程数不多于此值时互不竞争
+#define LOG_HIST_SUB    8                       // 直方图每个 2 的幂区间内的子区间数, 相对误差约 1/8
+#define LOG_HIST_BUCKETS 496                    // 直方图的区间数, 覆盖 0 ~ 2^64 ns
+
+/* 记录格式 (logSetFormat), 结构化记录 (logAddKV) 的字段按此格式输出; JSON 和 logfmt 格式下 logAdd* 的记录也同样输出 */
+#define LOG_FMT_TEXT    0                       // "[time] [name] [LEVEL] :msg key=value ..." (默认)
+#define LOG_FMT_JSON    1                       // JSON Lines: {"ts":"...","name":"...","level":"INFO","msg":"...","key":value}
+#define LOG_FMT_LOGFMT  2                       // logfmt: ts="..." name=... level=INFO msg=... key=value
+
+/* 输出 (logAddSink) 的类型 */
+#define LOG_SINK_FILE   0                       // 追加写入文件, 不参与日志的大小限制和轮转
+#define LOG_SINK_CONSOLE 1                      // 写入文件描述符, 如 STDERR_FILENO
+#define LOG_SINK_UNIX   2                       // unix 数据报套接字, 每条记录一个数据报
+#define LOG_SINK_MEMORY 3                       // 内存环形缓冲区, 由 logSinkRead 读取最近的记录
+#define LOG_SINK_CALLBACK 4                     // 用户回调函数, 在输出的写线程中调用
+
+/* 结构化记录的字段类型 */
+#define LOG_KV_INT      0
+#define LOG_KV_UINT     1
+#define LOG_KV_DBL      2
+#define LOG_KV_STR      3
+#define LOG_KV_BOOL     4
+
+/* 日志级别, 低于日志结构当前级别的记录在格式化之前就被丢弃 */
+#define LOG_LV_TRACE    0
+#define LOG_LV_DEBUG    1
+#define LOG_LV_INFO     2
+#define LOG_LV_WARN     3
+#define LOG_LV_ERROR    4
+#define LOG_LV_FATAL    5
+#define LOG_LV_OFF      6                       // 用于 logSetLevel, 关闭所有分级记录
+
+/* 编译期的最低级别, 低于此级别的 logTrace/logDebug... 调用在编译时即被删除, 参数也不会求值
+ * 如 gcc -DLOG_MIN_LEVEL=LOG_LV_INFO ... */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL   LOG_LV_TRACE
+#endif
+
 typedef struct Log{
     char* name;         // 本日志的名称, 每次输出的时候都会附带, 以区分不同的日志信息
     char* path;         // 存储日志文件的位置
     FILE* fp;           // 文件流指针, 指向存储日志的本地文件
     size_t maxsize;     // 最大文件大小, 默认为 0, 表示不设限制
+    size_t cursize;     // 当前文件大小, 由写入的字节数累加得到, 只在打开和清空文件时与实际文件同步
     bool mutetype;      // 静默属性, 决定在添加日志时是否显示到控制台上
+    struct LogQueue* queue; // 异步队列, 为 NULL 时表示同步模式
+    struct LogMap* map; // 内存映射写入, 为 NULL 时表示通过 fp 写入文件
+    FILE* oldfp;        // 轮转前使用的文件流, 可能仍有线程在写入, 下次轮转时等其写入者退出后才关闭
+    int   fusers[2];    // 正在写入文件的线程数, 按 fgen 的奇偶分两个槽, 旧文件的槽归零后才能关闭它
+    unsigned fgen;      // 文件的代数, 每次 _logReopen 替换 fp 后加 1
+    int   rotkeep;      // 轮转时保留的归档文件数 (path.1 ~ path.N), 为 0 时超出大小限制则清空文件
+    int   rotint;       // 按时间轮转的间隔, 单位为秒, 为 0 表示不按时间轮转
+    time_t rotnext;     // 下次按时间轮转的时间
+    int   rotating;     // 已请求轮转, 正在等待后台线程处理
+    struct Log* svcnext;// 后台线程待处理链表
+    bool  bin;          // 二进制模式, 只记录格式串编号, 时间和参数, 由 logDecode 还原为文本
+    unsigned  bingen;   // 二进制模式下当前文件的编号, 每换一个新文件加 1, 新文件中需要重新写入格式串定义
+    unsigned* fmtgen;   // 二进制模式下, 各格式串已在哪个文件中定义过, 下标为格式串编号
+    int   level;        // 分级记录的门限, 低于此级别的记录被丢弃, 为 filelevel 和飞行记录器级别中较低的一个
+    int   filelevel;    // 日志级别 (logSetLevel), 低于此级别的分级记录不写入文件, 默认为 LOG_LV_TRACE (全部记录)
+    struct LogRecorder* rec; // 飞行记录器 (logSetRecorder), 为 NULL 时不记录
+    struct LogShard* shards; // 计数: 按线程分片的记录数和延迟直方图, 共 LOG_STAT_SHARDS 个
+    int    stats;       // 已开启延迟统计 (logSetStats)
+    size_t wbase;       // 计数: 写入的总字节数 = wbase + cursize, 换文件时把旧文件的 cursize 计入 wbase
+    size_t nerr;        // 计数: 写入失败 (未写完) 的次数
+    size_t nrot;        // 计数: 轮转和清空文件的次数
+    size_t nlimit;      // 计数: 文件达到大小限制的次数
+    size_t nflush;      // 计数: 刷新的次数
+    size_t nsync;       // 计数: 同步到磁盘 (fdatasync) 的次数
+    struct LogFlush* flush; // 刷新策略 (logSetFlush), 为 NULL 时每条记录直接写入, 不主动同步到磁盘
+    size_t nsupp;       // 计数: 被限流, 采样或去重丢弃的记录数
+    struct LogDedup* dedup; // 合并连续重复记录 (logSetDedup), 为 NULL 时不合并
+    int    format;      // 记录格式, LOG_FMT_*
+    struct LogSink* sinks; // 增加的输出 (logAddSink), 每个输出有自己的队列和写线程
+    struct LogLz* lz;   // 块压缩 (logSetCompress), 为 NULL 时不压缩, 只用于异步模式
+    struct LogShared* shared; // 多进程共享模式 (logSetShared), 为 NULL 时文件大小和轮转只由本进程管理
+    bool  lazy;         // 延迟打开 (logCreateLazy), 还未打开文件, 第一次写入时打开
 }* LogPtr;
 
+typedef struct LogSink LogSink;                 // 日志的一个输出, 由 logSink* 创建, logAddSink 之后归日志所有
+typedef void (*LogSinkFn)(const char* rec, size_t len, void* arg); // 回调输出, rec 为一条完整的记录 (不以 '\0' 结尾)
+
+/* 调用处缓存的日志句柄, 配合 logGetCached() / logHandle() 使用 */
+typedef struct LogHandle{
+    LogPtr log;         // 缓存的日志结构
+    size_t gen;         // 缓存时的注册表版本, 有日志被销毁后版本会变化, 缓存随之失效
+    unsigned seq;       // 更新 log 和 gen 时为奇数, 读取前后不变时二者是一致的一对
+}LogHandle;
+
+/* 结构化记录的一个字段, 一般用 LOG_INT() / LOG_STR() 等宏构造 */
+typedef struct LogField{
+    const char* key;    // 字段名, 不做转义, 应只包含字母, 数字和下划线
+    int  type;          // LOG_KV_*
+    union{
+        long long i;
+        unsigned long long u;
+        double d;
+        const char* s;  // 为 NULL 时输出 null (JSON) 或空值
+    }v;
+}LogField;
+
+#define LOG_INT(k, x)   ((LogField){.key = (k), .type = LOG_KV_INT,  .v.i = (long long)(x)})
+#define LOG_UINT(k, x)  ((LogField){.key = (k), .type = LOG_KV_UINT, .v.u = (unsigned long long)(x)})
+#define LOG_DBL(k, x)   ((LogField){.key = (k), .type = LOG_KV_DBL,  .v.d = (double)(x)})
+#define LOG_STR(k, x)   ((LogField){.key = (k), .type = LOG_KV_STR,  .v.s = (x)})
+#define LOG_BOOL(k, x)  ((LogField){.key = (k), .type = LOG_KV_BOOL, .v.i = !!(x)})
+
+/* 调用处的状态, 配合 logRateOn() / logSampleOn() (限流/采样) 或 logAt() / logAtLevel() (计数/开关) 使用, 每个调用处一个静态结构 */
+typedef struct LogSite{
+    const char* file;   // 调用处所在的文件和行号, 用于报告
+    int      line;
+    int      listed;    // 已加入调用处链表 (第一次调用时加入)
+    uint64_t tat;       // 令牌桶 (GCRA) 的理论到达时间, 单位为纳秒
+    size_t   hits;      // 调用次数
+    size_t   suppressed;// 被丢弃的次数
+    size_t   pending;   // 上次写入之后被丢弃的次数, 下次写入前报告
+    const char* func;   // 调用处所在的函数
+    const char* fmt;    // 第一次调用时的格式串, 用于报告
+    int      off;       // 为 1 时 logAt / logAtLevel 不求值参数直接返回, 由 logSiteEnable 设置
+    size_t   nrec;      // logAt / logAtLevel 写入的记录数
+    size_t   nbytes;    // 写入的字节数
+    uint64_t t0;        // 登记 (或 logSiteReset) 的时间, 用于计算速率, 单位为纳秒
+    struct LogSite* next;
+}LogSite;
+
+/* 调用处的计数, 由 logSiteTop 获取 */
+typedef struct LogSiteStat{
+    const LogSite* site;
+    size_t records;     // 写入的记录数
+    size_t bytes;       // 写入的字节数
+    double bytes_per_sec; // 登记 (或 logSiteReset) 以来平均每秒写入的字节数
+}LogSiteStat;
+
+/* 日志的运行计数, 由 logGetCounters 获取, 或由 logsysDump / logStatsDump 输出 */
+typedef struct LogCounters{
+    size_t records;     // 添加的记录数 (异步模式下包括被丢弃的)
+    size_t bytes;       // 写入文件的总字节数, 包括已轮转/清空的部分
+    size_t dropped;     // 异步模式下被丢弃的记录数
+    size_t errors;      // 写入失败 (未写完) 的次数
+    size_t rotations;   // 轮转和清空文件的次数
+    size_t limits;      // 文件达到大小限制的次数
+    size_t flushes;     // 刷新的次数: logFlush 调用, 以及异步模式下写线程的批量写入
+    size_t syncs;       // 同步到磁盘 (fdatasync) 的次数
+    size_t suppressed;  // 被限流, 采样或去重丢弃的记录数
+    size_t fallbacks;   // 内存映射模式下超出映射范围, 改用 pwrite 写入的记录数
+}LogCounters;
+
+/* 延迟直方图 (HDR 风格, 对数区间再等分为 LOG_HIST_SUB 个子区间), 单位为纳秒 */
+typedef struct LogHist{
+    size_t count;       // 样本数
+    size_t sum;         // 总和, 用于计算平均值
+    size_t max;         // 最大值
+    size_t bucket[LOG_HIST_BUCKETS];
+}LogHist;
+
+/* 日志的统计信息, 由 logStats 获取 */
+typedef struct LogStats{
+    LogCounters cnt;    // 各项计数
+    LogHist add;        // logAdd* 调用的耗时 (格式化并写入文件或放入队列), 需先 logSetStats 开启
+    LogHist disk;       // 异步模式下, 记录从放入队列到写入文件的耗时, 需先 logSetStats 开启
+}LogStats;
+
 /* ------------------------------- logsys API ------------------------------------*/
 #define LOGSYS_PATH     "./logs/sys.out"
 #define LOGSYS_SIZE     1                       // 系统日志大小, 默认为 1 M
 
-static LogPtr _sys = NULL;                      // 系统日志结构指针
-static bool _logsys_service = false;                  // 系统日志初始化状态, 只有为 true , 以下 SET API 才有效
-static bool LOGSYS_MUTETYPE = MUTE;
-
 int  logsysInit();
 void logsysStop();
-void logsysSetMutetype(bool mutetype) {if(_logsys_service) _sys->mutetype = mutetype; LOGSYS_MUTETYPE = mutetype;}
-void logsysSetFileSize(size_t size_mb) {if(_logsys_service)  _sys->maxsize = size_mb<<20;}
+void logsysSetMutetype(bool mutetype);          // 设置系统日志的静默属性, 在 logsysInit 之前设置也有效
+void logsysSetFileSize(size_t size_mb);         // 设置系统日志文件大小限制, 单位为 MB, 只在 logsysInit 之后有效
+void logsysDump();                              // 将所有已注册 (有名称) 日志的计数写入系统日志
+void logsysSetDumpInterval(int sec);            // 每 sec 秒由后台线程调用一次 logsysDump, 为 0 时停止
 
 void logsysAdd(LogPtr log, const char* text, ...);
 void logsysAddMute(LogPtr log, const char* text, ...);
@@ -85,11 +294,79 @@ void logShow(const char* text, ...);        // 打印时间和内容到控制台
 
 // 创建及修改相关API
 LogPtr logCreate(const char* name, const char* path, bool mutetype);    // 创建一个 日志 结构
-void   logDestroy(LogPtr log);                          // 销毁一个 日志 结构
+LogPtr logCreateAsync(const char* name, const char* path, bool mutetype, size_t qsize, int policy); // 创建一个 异步日志 结构, 由后台线程写入文件
+LogPtr logCreateMmap(const char* name, const char* path, bool mutetype, size_t chunk_mb); // 创建一个 内存映射 日志结构, 记录直接拷贝到映射的文件中
+LogPtr logCreateLazy(const char* name, const char* path, bool mutetype); // 创建一个 日志 结构, 第一次写入时才创建目录和打开文件
+int    logCreateMany(LogPtr* logs, const char* const* names, const char* const* paths, int n, bool mutetype, int threads, bool lazy); // 批量创建 n 个日志结构, threads 个线程并行打开文件, 返回成功的个数
+void   logDestroy(LogPtr log);                          // 销毁一个 日志 结构, 异步模式下会先写完队列中的记录
+void   logFlush(LogPtr log);                            // 刷新日志, 异步模式下等待队列中的记录全部写入
+size_t logDropped(LogPtr log, size_t* newest, size_t* oldest); // 获取异步模式下被丢弃的记录数
 size_t logFileSize(LogPtr log);                         // 获取日志结构所指文件的大小
 int    logSetFileSize(LogPtr log, size_t size_mb);      // 设置文件大小限制, 单位为 MB
 void   logSetMutetype(LogPtr log, bool mutetype);       // 设置日志结构的 静默 属性
+void   logSetLevel(LogPtr log, int level);              // 设置日志结构的级别, LOG_LV_TRACE ~ LOG_LV_OFF
+void   logGetCounters(LogPtr log, LogCounters* c);      // 获取日志的运行计数, 只读取原子计数器, 不产生 I/O
+int    logSetFlush(LogPtr log, size_t bytes, int ms, int level, int sync_ms); // 设置刷新策略: 缓冲字节数, 最长停留毫秒数, 立即落盘的级别, 后台落盘间隔
+void   logSetStats(LogPtr log, bool on);                // 开启/关闭延迟统计, 开启后每条记录多两次读取时钟
+void   logStats(LogPtr log, LogStats* st);              // 获取日志的计数和延迟直方图, 可以在其它线程写日志时调用
+size_t logHistPercentile(const LogHist* h, double pct); // 直方图的百分位数 (0 ~ 100), 单位为纳秒
+void   logStatsDump(FILE* out);                         // 将所有已注册 (有名称) 日志的统计信息输出到 out, 每个日志一行
+int    logSetRotate(LogPtr log, int keep, int interval_sec); // 设置文件轮转: 保留 keep 个归档, 每 interval_sec 秒轮转一次 (为 0 则只按大小)
+void   logSetTimePrecision(int digits);                 // 设置日志时间的精度 (小数位数), 对所有日志有效
 int    logFlieEmpty(LogPtr log);                        // 清空结构所指日志文件
+int    logSetBinary(LogPtr log);                        // 切换为二进制模式, 文件必须为空或已是二进制日志文件
+int    logDecode(const char* const* paths, int n, FILE* out); // 将二进制或块压缩日志文件 (按时间顺序) 还原为文本格式, 输出到 out
+int    logDecodeRange(const char* const* paths, int n, const char* from, const char* to, FILE* out); // 同 logDecode, 只输出时间在 [from, to] 内的记录
+int    logSetCompress(LogPtr log, size_t block_kb);     // 异步日志切换为块压缩模式, 由写线程按块压缩写入, 文件带块的时间索引
+int    logSetShared(LogPtr log, bool on);               // 开启多进程共享模式: 多个进程写同一个文件, 由 path.shm 协调大小和轮转
+
+// 名称查找API, 创建时指定了名称的日志会自动注册, 销毁时自动注销; 名称重复时只有第一个会注册
+LogPtr logGet(const char* name);                        // 根据名称获取日志结构, 不存在则返回 NULL, 查找时不加锁
+LogPtr logGetCached(LogHandle* h, const char* name);    // 同 logGet, 若 h 中缓存的结构仍有效则直接返回, 不再查找
+#define logHandle(name) ({ static LogHandle _log_h; logGetCached(&_log_h, (name)); })   // 在调用处缓存日志结构, 如 logAdd(logHandle("net"), "...")
+
+// 飞行记录器API: 在内存环形缓冲区中保留最近的记录 (可以比日志级别更详细), 崩溃时或需要时再写入文件
+int  logSetRecorder(LogPtr log, size_t size_mb, int level, const char* dump_path); // 开启飞行记录器, size_mb 为 0 时关闭; dump_path 为 NULL 时用 "<path>.crash"
+int  logDumpRecorder(LogPtr log, const char* path);     // 将飞行记录器中的记录写入 path (为 NULL 时用 dump_path)
+int  logSetCrashHandler(bool on);                       // 安装/卸载 SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL 处理函数, 崩溃时写出所有飞行记录器
+
+// 输出API: 每个输出有自己的队列和写线程, 记录按 logAddSink 时指定的级别过滤; 二进制模式下不写入这些输出
+LogSink* logSinkFile(const char* path);                 // 创建文件输出, 以追加方式打开 path
+LogSink* logSinkConsole(int fd);                        // 创建控制台输出, 写入 fd (如 STDERR_FILENO), 不会关闭 fd
+LogSink* logSinkUnix(const char* path);                 // 创建 unix 数据报套接字输出, 发往 path, 接收方可以之后再启动
+LogSink* logSinkMemory(size_t size);                    // 创建内存输出, 保留最近 size 字节 (向上取整为 2 的幂) 的记录
+LogSink* logSinkCallback(LogSinkFn fn, void* arg);      // 创建回调输出, 每条记录调用一次 fn(rec, len, arg)
+void     logSinkFree(LogSink* sink);                    // 释放未加入日志的输出, 已加入的由 logDestroy 释放
+int      logAddSink(LogPtr log, LogSink* sink, int level, size_t qsize, int policy); // 为日志增加输出, 不低于 level 的分级记录和不分级的记录写入此输出
+size_t   logSinkRead(LogSink* sink, char* buf, size_t cap); // 读取内存输出中最近的记录 (从一条记录的开头起), 以 '\0' 结尾, 返回长度
+void     logSinkStats(LogSink* sink, size_t* records, size_t* dropped, size_t* errors); // 获取输出写入的记录数, 队列已满丢弃的记录数, 写入失败的次数
+
+// 结构化日志API: 字段按类型直接序列化, 不经过 printf 格式串解析
+int  logSetFormat(LogPtr log, int format);              // 设置记录格式 LOG_FMT_TEXT / LOG_FMT_JSON / LOG_FMT_LOGFMT
+void logAddKVn(LogPtr log, int level, const char* msg, const LogField* fields, int n); // 添加一条结构化记录, 包含 n 个字段
+#define logAddKV(log, level, msg, ...) do{ LogPtr _kv_log = (log); if(logLevelOn(_kv_log, level)) \
+            logAddKVn(_kv_log, (level), (msg), (const LogField[]){__VA_ARGS__}, sizeof((LogField[]){__VA_ARGS__}) / sizeof(LogField)); }while(0) // 如 logAddKV(log, LOG_LV_INFO, "done", LOG_INT("us", t), LOG_STR("peer", p))
+
+// 日志风暴控制API: 限流和采样在格式化之前判断, 被丢弃的调用不求值参数; 恢复写入时先写一条记录报告丢弃的条数
+bool logSiteRate(LogSite* s, LogPtr log, double per_sec, int burst); // 令牌桶: 平均每秒 per_sec 条, 最多连续 burst 条, 返回是否写入
+bool logSiteSample(LogSite* s, LogPtr log, unsigned n); // 采样: 每 n 次调用写入一次 (第 1, n+1, ... 次)
+void logSiteDump(FILE* out);                            // 将有丢弃的调用处及其调用/丢弃次数输出到 out, 每个调用处一行
+int  logSetDedup(LogPtr log, bool on);                  // 开启/关闭合并连续重复记录, 重复的只记录 "last message repeated N times"
+#define logRateOn(log, per_sec, burst) ({ static LogSite _log_s = {.file = __FILE__, .line = __LINE__}; logSiteRate(&_log_s, (log), (per_sec), (burst)); }) // 如 if(logRateOn(log, 10, 20)) logWarn(log, ...)
+#define logSampleOn(log, n) ({ static LogSite _log_s = {.file = __FILE__, .line = __LINE__}; logSiteSample(&_log_s, (log), (n)); })
+#define logAddRate(log, per_sec, burst, ...) do{ LogPtr _rl_log = (log); if(logRateOn(_rl_log, per_sec, burst)) logAdd(_rl_log, __VA_ARGS__); }while(0)
+#define logAddSample(log, n, ...) do{ LogPtr _rl_log = (log); if(logSampleOn(_rl_log, n)) logAdd(_rl_log, __VA_ARGS__); }while(0)
+
+// 调用处统计API: logAt / logAtLevel 的每个调用处第一次调用时登记, 之后按调用处计数, 关闭的调用处只有一次读取
+void logSiteAdd(LogSite* s, LogPtr log, int level, const char* text, ...); // 通过调用处 s 添加记录, level 小于 0 时同 logAdd, 否则同 logAddLevel
+int  logSiteEnable(const char* spec, bool on);          // 打开/关闭匹配 spec ("file.c", "file.c:line" 或函数名) 的调用处, 之后登记的也生效; 返回已登记的匹配数
+int  logSiteTop(LogSiteStat* out, int n);               // 按每秒字节数从大到小取前 n 个调用处, 返回个数
+void logSiteTopDump(FILE* out, int n);                  // 将每秒字节数最多的 n 个调用处输出到 out, 每个调用处一行
+void logSiteReset();                                    // 清零所有调用处的记录数和字节数, 重新开始计算速率
+#define logAt(log, ...) do{ static LogSite _log_s = {.file = __FILE__, .line = __LINE__, .func = __func__}; \
+            if(!__atomic_load_n(&_log_s.off, __ATOMIC_RELAXED)) logSiteAdd(&_log_s, (log), -1, __VA_ARGS__); }while(0) // 同 logAdd, 按调用处计数
+#define logAtLevel(log, lv, ...) do{ static LogSite _log_s = {.file = __FILE__, .line = __LINE__, .func = __func__}; LogPtr _at_log = (log); \
+            if(logLevelOn(_at_log, lv) && !__atomic_load_n(&_log_s.off, __ATOMIC_RELAXED)) logSiteAdd(&_log_s, _at_log, (lv), __VA_ARGS__); }while(0) // 同 logAddLevel
 
 // 日志添加API
 void logAddTime(LogPtr log);                            // 添加当前时间到 日志 中, 由 (*log).mute 决定是否静默处理
@@ -101,6 +378,26 @@ void logAddTextNMute(LogPtr log, const char* text, ...);// 添加 text 到 日
 void logAdd(LogPtr log, const char* text, ...);         // 添加 时间 和 text 到 日志中, 由 (*log).mute 决定是否静默处理
 void logAddMute(LogPtr log, const char* text, ...);     // 添加 时间 和 text 到 日志中, 强制静默处理
 void logAddNMute(LogPtr log, const char* text, ...);    // 添加 时间 和 text 到 日志中, 强制非静默处理
+void logAddByName(const char* name, const char* text, ...); // 添加 时间 和 text 到 名称为 name 的日志中, 由其 mute 属性决定是否静默处理
+void logAddLevel(LogPtr log, int level, const char* text, ...); // 添加 时间, 级别 和 text 到 日志中, 低于日志级别时直接返回
+void logAddBlob(LogPtr log, const void* data, size_t len);    // 添加 时间 和 二进制数据 (十六进制) 到 日志中, 异步模式下由写线程编码
+void logAddHexdump(LogPtr log, const void* data, size_t len); // 同 logAddBlob, 编码为 hexdump -C 格式的多行
+
+// 分级日志宏: 先比较级别再求值参数, 被过滤的调用只有一次比较; 低于 LOG_MIN_LEVEL 的调用在编译时删除
+#define logLevelOn(log, lv) ((lv) >= LOG_MIN_LEVEL && (log) && (lv) >= __atomic_load_n(&(log)->level, __ATOMIC_RELAXED))
+#ifdef LOG_SITES       // 在包含 log.h 之前定义, 则此文件中的 logAdd 和 logTrace ~ logFatal 都按调用处计数, 可以单独关闭
+#define _logLevelAdd(lv, log, ...) do{ if((lv) >= LOG_MIN_LEVEL) logAtLevel(log, lv, __VA_ARGS__); }while(0)
+#define logAdd(log, ...)    logAt(log, __VA_ARGS__)
+#else
+#define _logLevelAdd(lv, log, ...) do{ if((lv) >= LOG_MIN_LEVEL){ LogPtr _lv_log = (log); \
+            if(__builtin_expect(logLevelOn(_lv_log, lv), (lv) >= LOG_LV_WARN)) logAddLevel(_lv_log, (lv), __VA_ARGS__); } }while(0)
+#endif
+#define logTrace(log, ...)  _logLevelAdd(LOG_LV_TRACE, log, __VA_ARGS__)
+#define logDebug(log, ...)  _logLevelAdd(LOG_LV_DEBUG, log, __VA_ARGS__)
+#define logInfo(log, ...)   _logLevelAdd(LOG_LV_INFO,  log, __VA_ARGS__)
+#define logWarn(log, ...)   _logLevelAdd(LOG_LV_WARN,  log, __VA_ARGS__)
+#define logError(log, ...)  _logLevelAdd(LOG_LV_ERROR, log, __VA_ARGS__)
+#define logFatal(log, ...)  _logLevelAdd(LOG_LV_FATAL, log, __VA_ARGS__)
 
 /* ------------------------------- Test Function ------------------------------------*/
 void logTest();
@@ -0,0 +1,251 @@
+/*  logbench - 日志系统性能测试
+ *  测量 logAdd, logAddMute, logAddText, logsysAdd 的吞吐量 (条/秒) 和单次调用延迟 (p50/p99/p99.9/max),
+ *  覆盖 1 ~ N 个线程, 静默/输出到控制台, 多种消息长度, 系统日志开/关, 以及同步/异步/内存映射三种写入方式.
+ *  每个测试输出一行 JSON (JSON Lines), 便于保存后与其它版本比较.
+ *  用法:
+ *      logbench [-t 最大线程数] [-n 每线程次数] [-s 长度,长度...] [-m sync,async,mmap] [-d 目录] [-o 输出文件]
+ *  输出到控制台的测试会把 stderr 重定向到 /dev/null, 测得的是写入的开销而不是终端的显示速度.
+ */
+#include "log.h"
+
+#define BENCH_MAXSIZES  8
+
+static const char* _apis[] = {"logAdd", "logAddMute", "logAddText", "logsysAdd"};   // 下标即 BenchArg.api
+
+typedef struct BenchCase{
+    const char* api;            // 被测接口
+    const char* mode;           // sync, async, mmap
+    int    threads;
+    int    size;                // 消息长度 (不含时间和名称)
+    bool   console;
+    bool   logsys;
+}BenchCase;
+
+typedef struct BenchArg{
+    const BenchCase* c;
+    int       api;              // 被测接口在 _apis 中的下标, 在计时之前确定
+    LogPtr    log;
+    const char* msg;
+    long      iters;
+    uint64_t* lat;              // 每次调用的耗时, 单位为纳秒
+    uint64_t  t0, t1;           // 本线程开始和结束调用的时间
+    pthread_barrier_t* start;
+}BenchArg;
+
+static uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int _cmp(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void* _benchThread(void* p)
+{
+    BenchArg* a = (BenchArg*)p;
+    uint64_t t0;
+    long i;
+
+    pthread_barrier_wait(a->start);
+    a->t0 = _now();
+    for(i = 0; i < a->iters; i++)
+    {
+        t0 = _now();
+        switch(a->api)                      // logAdd 是记录调用点的宏, 不能取函数指针
+        {
+            case 0:     logAdd(a->log, "%s %ld\n", a->msg, i);      break;
+            case 1:     logAddMute(a->log, "%s %ld\n", a->msg, i);  break;
+            case 2:     logAddText(a->log, "%s %ld\n", a->msg, i);  break;
+            default:    logsysAdd(a->log, "%s %ld\n", a->msg, i);   break;
+        }
+        a->lat[i] = _now() - t0;
+    }
+    a->t1 = _now();
+    return NULL;
+}
+
+/**
+ * @brief _benchRun - 运行一个测试, 输出一行 JSON
+ */
+static void _benchRun(const BenchCase* c, long iters, const char* dir, FILE* out)
+{
+    char path[PATH_MAX];
+    pthread_t* th;
+    BenchArg*  args;
+    uint64_t*  lat;
+    char*      msg;
+    pthread_barrier_t start;
+    LogPtr   log;
+    uint64_t t0, t1;
+    size_t   n = (size_t)iters * c->threads;
+    int      i, api, err = -1, devnull;
+
+    snprintf(path, sizeof(path), "%s/bench.out", dir);
+    unlink(path);
+
+    if(c->console)                          // 控制台输出到 /dev/null, 包括系统日志的创建和销毁记录
+    {
+        fflush(stderr);
+        err = dup(STDERR_FILENO);
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        close(devnull);
+    }
+
+    logsysSetMutetype(c->console ? NMUTE : MUTE);
+    if(c->logsys)
+        logsysInit();
+
+    if(0 == strcmp(c->mode, "async"))
+        log = logCreateAsync("bench", path, c->console ? NMUTE : MUTE, 0, LOG_BP_BLOCK);
+    else if(0 == strcmp(c->mode, "mmap"))
+        log = logCreateMmap("bench", path, c->console ? NMUTE : MUTE, 0);
+    else
+        log = logCreate("bench", path, c->console ? NMUTE : MUTE);
+    if(!log)
+    {
+        logsysStop();
+        if(err >= 0)
+        {
+            dup2(err, STDERR_FILENO);
+            close(err);
+        }
+        fprintf(stderr, "logbench: cannot create log \"%s\"\n", path);
+        return;
+    }
+
+    th   = (pthread_t*)malloc(sizeof(pthread_t) * c->threads);
+    args = (BenchArg*)malloc(sizeof(BenchArg) * c->threads);
+    lat  = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    msg  = (char*)malloc(c->size + 1);
+    if(!th || !args || !lat || !msg)
+        goto out;
+    memset(msg, 'x', c->size);
+    msg[c->size] = '\0';
+
+    for(api = 0; api < (int)(sizeof(_apis) / sizeof(_apis[0])) - 1 && strcmp(c->api, _apis[api]); api++)
+        ;
+    pthread_barrier_init(&start, NULL, c->threads + 1);
+    for(i = 0; i < c->threads; i++)
+    {
+        args[i].c     = c;
+        args[i].api   = api;
+        args[i].log   = log;
+        args[i].msg   = msg;
+        args[i].iters = iters;
+        args[i].lat   = lat + (size_t)iters * i;
+        args[i].start = &start;
+        pthread_create(&th[i], NULL, _benchThread, &args[i]);
+    }
+    pthread_barrier_wait(&start);
+    for(i = 0; i < c->threads; i++)
+        pthread_join(th[i], NULL);
+    logFlush(log);                          // 异步模式下包括写完队列的时间
+    t1 = _now();
+    pthread_barrier_destroy(&start);
+    /* 从最早开始调用的线程算起, 主线程从屏障返回时各线程可能已经调用了很多次 */
+    for(t0 = args[0].t0, i = 1; i < c->threads; i++)
+        if(args[i].t0 < t0)
+            t0 = args[i].t0;
+
+    qsort(lat, n, sizeof(uint64_t), _cmp);
+    fprintf(out, "{\"api\":\"%s\",\"mode\":\"%s\",\"threads\":%d,\"size\":%d,\"console\":%s,\"logsys\":%s,"
+                 "\"records\":%zu,\"msgs_per_sec\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+            c->api, c->mode, c->threads, c->size, c->console ? "true" : "false", c->logsys ? "true" : "false",
+            n, n / ((t1 - t0) / 1e9),
+            (unsigned long long)lat[n / 2], (unsigned long long)lat[n * 99 / 100],
+            (unsigned long long)lat[n * 999 / 1000], (unsigned long long)lat[n - 1]);
+    fflush(out);
+
+out:
+    logDestroy(log);
+    logsysStop();
+    if(err >= 0)
+    {
+        dup2(err, STDERR_FILENO);
+        close(err);
+    }
+    unlink(path);
+    free(th);
+    free(args);
+    free(lat);
+    free(msg);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* modes   = "sync,async,mmap";
+    const char* dir     = "./bench_logs";
+    const char* output  = NULL;
+    char        modebuf[64];
+    char*       mode;
+    char*       save;
+    int   sizes[BENCH_MAXSIZES] = {16, 128, 1024};
+    int   nsize = 3, maxthreads = 8, opt, a, t, z, con, sys;
+    long  iters = 50000;
+    FILE* out = stdout;
+    BenchCase c;
+
+    while(-1 != (opt = getopt(argc, argv, "t:n:s:m:d:o:h")))
+    {
+        switch(opt)
+        {
+            case 't':   maxthreads = atoi(optarg);  break;
+            case 'n':   iters = atol(optarg);       break;
+            case 'm':   modes = optarg;             break;
+            case 'd':   dir = optarg;               break;
+            case 'o':   output = optarg;            break;
+            case 's':
+                for(nsize = 0, mode = strtok_r(optarg, ",", &save); mode && nsize < BENCH_MAXSIZES; mode = strtok_r(NULL, ",", &save))
+                    sizes[nsize++] = atoi(mode);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t maxthreads] [-n iters] [-s size,...] [-m sync,async,mmap] [-d dir] [-o output]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(maxthreads < 1 || iters < 1 || nsize < 1)
+        return 1;
+    if(output && !(out = fopen(output, "w")))
+    {
+        fprintf(stderr, "%s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    mkdir(dir, 0755);
+
+    snprintf(modebuf, sizeof(modebuf), "%s", modes);
+    for(mode = strtok_r(modebuf, ",", &save); mode; mode = strtok_r(NULL, ",", &save))
+    {
+        c.mode = mode;
+        for(a = 0; a < (int)(sizeof(_apis) / sizeof(_apis[0])); a++)
+        {
+            c.api = _apis[a];
+            for(t = 1; t <= maxthreads; t <<= 1)
+            {
+                c.threads = t;
+                for(z = 0; z < nsize; z++)
+                {
+                    c.size = sizes[z];
+                    for(con = 0; con < 2; con++)
+                    {
+                        c.console = con;
+                        for(sys = 0; sys < 2; sys++)
+                        {
+                            c.logsys = sys;
+                            _benchRun(&c, iters, dir, out);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
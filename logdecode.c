@@ -0,0 +1,55 @@
+/*  logdecode - 二进制日志还原工具
+ *  将 logSetBinary 模式或 logSetCompress 模式下写入的日志文件还原为文本格式, 与文本模式下写入的内容相同
+ *  用法:
+ *      logdecode <file>... [-o output] [-s from] [-e to]
+ *  -s / -e 只输出这段时间内的记录, 可以只给出前缀 (如 "2024-05-01 13"), 两端都包含; 块压缩文件只解压这段时间的块.
+ *  有轮转的归档时按时间顺序给出文件, 如 logdecode x.out.3 x.out.2 x.out.1 x.out,
+ *  这样轮转瞬间写入的记录也能找到前一个文件中的格式串定义
+ */
+#include "log.h"
+
+int main(int argc, char* argv[])
+{
+    const char** paths;
+    const char*  output = NULL;
+    const char*  from = NULL;
+    const char*  to = NULL;
+    FILE* out = stdout;
+    int   i, n = 0, ret;
+
+    paths = (const char**)malloc(sizeof(char*) * argc);
+    if(!paths)  return 1;
+    for(i = 1; i < argc; i++)
+    {
+        if(0 == strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if(0 == strcmp(argv[i], "-s") && i + 1 < argc)
+            from = argv[++i];
+        else if(0 == strcmp(argv[i], "-e") && i + 1 < argc)
+            to = argv[++i];
+        else
+            paths[n++] = argv[i];
+    }
+    if(0 == n)
+    {
+        fprintf(stderr, "usage: %s <file>... [-o output] [-s from] [-e to]\n", argv[0]);
+        free(paths);
+        return 1;
+    }
+
+    if(output && !(out = fopen(output, "w")))
+    {
+        fprintf(stderr, "%s: %s\n", output, strerror(errno));
+        free(paths);
+        return 1;
+    }
+
+    ret = logDecodeRange(paths, n, from, to, out);
+    if(LOG_ERR == ret)
+        fprintf(stderr, "%s: some files could not be decoded (missing, not a binary or compressed log, or damaged)\n", argv[0]);
+
+    if(out != stdout)
+        fclose(out);
+    free(paths);
+    return LOG_OK == ret ? 0 : 2;
+}
@@ -0,0 +1,619 @@
+/*  logq - 日志查询工具
+ *  查询本模块写入的文本日志 (包括 JSON Lines 和 logfmt 格式), 文件通过内存映射读取:
+ *      1. 按记录开头的时间 "[YYYY-MM-DD HH:MM:SS" (JSON 和 logfmt 格式为 ts 字段) 二分查找, 直接定位到时间范围,
+ *         多线程写入时记录的时间顺序可能有少量交错, 所以查找结果前后多扫描 Q_SLACK 字节, 每条记录再逐一比较时间
+ *      2. 时间范围内的内容按记录边界分块, 由多个线程并行扫描 (SSE2 子串查找), 按文件和块的顺序输出
+ *      3. 一条记录包括带时间的一行和其后不带时间的行 (消息中的换行), 整条输出
+ *  用法:
+ *      logq [-s 开始时间] [-e 结束时间] [-n 名称] [-p 子串] [-j 线程数] [-c] [-f] <file>...
+ *      -s / -e 可以只给出前缀, 如 "2024-05-01 13", 按给出的精度比较, 两端都包含;
+ *      -n 只输出名称为 name 的日志的记录; -p 只输出包含子串的记录; -c 只输出匹配的记录数;
+ *      -f 输出完已有内容后继续跟踪文件的新内容, 文件被轮转或清空后从头读取新文件.
+ *  有轮转的归档时按时间顺序给出文件, 如 logq -s "2024-05-01 13:00" x.out.2 x.out.1 x.out
+ *  二进制模式的文件需先用 logdecode 还原.
+ */
+#include "log.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define Q_CHUNK     (4 << 20)           // 并行扫描时每块的大小
+#define Q_SLACK     (64 << 10)          // 二分查找的结果前后多扫描的范围
+#define Q_WINDOW    4                   // 每个线程最多领先输出的块数, 限制缓存的结果
+#define Q_POLL_MS   200                 // 跟踪模式下检查文件的间隔
+#define Q_TSMAX     26                  // 时间的最大长度 "YYYY-MM-DD HH:MM:SS.uuuuuu"
+
+typedef struct QFilter{
+    const char* from;   // 开始时间的前缀, 为 NULL 时不限制
+    size_t flen;
+    const char* to;     // 结束时间的前缀, 为 NULL 时不限制
+    size_t tlen;
+    const char* name;   // 日志名称, 为 NULL 时不限制
+    size_t nlen;
+    const char* pat;    // 子串, 为 NULL 时不限制
+    size_t plen;
+    bool   count;       // 只计数, 不输出记录
+}QFilter;
+
+typedef struct QBuf{
+    char*  p;
+    size_t len;
+    size_t cap;
+}QBuf;
+
+typedef struct QChunk{
+    const char* p;      // 块的范围, 从一条记录的开头开始
+    const char* end;
+    QBuf   out;         // 匹配的记录
+    size_t n;           // 匹配的记录数
+    int    done;
+}QChunk;
+
+typedef struct QJob{
+    const QFilter* f;
+    QChunk* chunks;
+    size_t  nchunk;
+    size_t  next;       // 下一个要扫描的块
+    size_t  printed;    // 已输出的块数
+    size_t  window;     // 扫描最多领先输出的块数
+    pthread_mutex_t mtx;
+    pthread_cond_t  cond;
+}QJob;
+
+static void _qPut(QBuf* b, const char* p, size_t len)
+{
+    char* n;
+
+    if(b->len + len > b->cap)
+    {
+        b->cap = b->cap ? b->cap : 4096;
+        while(b->len + len > b->cap)
+            b->cap <<= 1;
+        n = (char*)realloc(b->p, b->cap);
+        if(!n)
+        {
+            fprintf(stderr, "logq: out of memory\n");
+            exit(1);
+        }
+        b->p = n;
+    }
+    memcpy(b->p + b->len, p, len);
+    b->len += len;
+}
+
+static const char* _qNextLine(const char* p, const char* end)
+{
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static const char* _qLineStart(const char* p, const char* begin)
+{
+    while(p > begin && p[-1] != '\n')
+        p--;
+    return p;
+}
+
+static bool _qDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * @brief _qTime - 取出一行开头记录的时间
+ * @param tlen  输出时间的长度, 包括小数部分
+ * @return 时间的开头, 不是一条记录的开头时返回 NULL
+ */
+static const char* _qTime(const char* p, const char* end, size_t* tlen)
+{
+    const char* ts;
+    size_t n;
+
+    if(end - p > 1 && '[' == p[0])                          // [YYYY-MM-DD HH:MM:SS] [name] ...
+        ts = p + 1;
+    else if(end - p > 4 && 0 == memcmp(p, "ts=\"", 4))      // ts="YYYY-MM-DD HH:MM:SS" name=...
+        ts = p + 4;
+    else if(end - p > 7 && 0 == memcmp(p, "{\"ts\":\"", 7)) // {"ts":"YYYY-MM-DD HH:MM:SS","name":...
+        ts = p + 7;
+    else
+        return NULL;
+
+    if(end - ts < 19 || !_qDigit(ts[0]) || '-' != ts[4] || '-' != ts[7] || ' ' != ts[10] || ':' != ts[13] || ':' != ts[16])
+        return NULL;
+    for(n = 19; n < Q_TSMAX && ts + n < end && (_qDigit(ts[n]) || '.' == ts[n]); n++)
+        ;
+    *tlen = n;
+    return ts;
+}
+
+/**
+ * @brief _qName - 取出记录中日志的名称
+ * @return 名称的开头, 没有名称时返回 NULL
+ */
+static const char* _qName(const char* ts, size_t tlen, const char* end, size_t* nlen)
+{
+    const char* p = ts + tlen;
+    const char* e;
+    char stop;
+
+    if(end - p > 3 && 0 == memcmp(p, "] [", 3))
+    {
+        p += 3;
+        stop = ']';
+    }
+    else if(end - p > 7 && 0 == memcmp(p, "\" name=", 7))
+    {
+        p += 7;
+        stop = ' ';
+    }
+    else if(end - p > 10 && 0 == memcmp(p, "\",\"name\":\"", 10))
+    {
+        p += 10;
+        stop = '"';
+    }
+    else
+        return NULL;
+
+    for(e = p; e < end && *e != stop && *e != '\n'; e++)
+        ;
+    *nlen = e - p;
+    return p;
+}
+
+/* 按 key 给出的精度比较时间, 时间比 key 短 (精度低) 而前面相同时视为较小 */
+static int _qTsCmp(const char* ts, size_t tlen, const char* key, size_t klen)
+{
+    int r = memcmp(ts, key, tlen < klen ? tlen : klen);
+    return r ? r : (tlen < klen ? -1 : 0);
+}
+
+/* 记录 (从 p 开始的一行) 是否满足时间和名称的条件, 不带时间的行只在没有这些条件时满足 */
+static bool _qPass(const QFilter* f, const char* p, const char* end)
+{
+    const char* ts;
+    const char* name;
+    size_t tlen, nlen;
+
+    if(!(ts = _qTime(p, end, &tlen)))
+        return !f->from && !f->to && !f->name;
+    if(f->from && _qTsCmp(ts, tlen, f->from, f->flen) < 0)
+        return false;
+    if(f->to && _qTsCmp(ts, tlen < f->tlen ? tlen : f->tlen, f->to, f->tlen) > 0)
+        return false;
+    if(f->name)
+    {
+        name = _qName(ts, tlen, end, &nlen);
+        if(!name || nlen != f->nlen || memcmp(name, f->name, nlen))
+            return false;
+    }
+    return true;
+}
+
+/* 从行首 p 开始的第一条记录的开头, 没有则返回 end */
+static const char* _qNextRec(const char* p, const char* end)
+{
+    size_t tlen;
+
+    while(p < end && !_qTime(p, end, &tlen))
+        p = _qNextLine(p, end);
+    return p;
+}
+
+/**
+ * @brief _qFind - 查找子串
+ * @return 第一次出现的位置, 没有则返回 end
+ * @note  SSE2 下每次比较 16 个位置的首字节和末字节, 两者都相同的位置再比较中间部分
+ */
+static const char* _qFind(const char* p, const char* end, const char* pat, size_t m)
+{
+    const char* r;
+
+    if((size_t)(end - p) < m)
+        return end;
+    if(1 == m)
+        return (r = (const char*)memchr(p, pat[0], end - p)) ? r : end;
+#ifdef __SSE2__
+    {
+        const __m128i first = _mm_set1_epi8(pat[0]), last = _mm_set1_epi8(pat[m - 1]);
+        unsigned mask;
+        int i;
+
+        for(; p + m - 1 + 16 <= end; p += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)p);
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + m - 1));
+            mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while(mask)
+            {
+                i = __builtin_ctz(mask);
+                if(0 == memcmp(p + i + 1, pat + 1, m - 2))
+                    return p + i;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    for(; p + m <= end; p = r + 1)          // 剩余部分
+    {
+        r = (const char*)memchr(p, pat[0], end - m + 1 - p);
+        if(!r)
+            break;
+        if(0 == memcmp(r + 1, pat + 1, m - 1))
+            return r;
+    }
+    return end;
+}
+
+/**
+ * @brief _qScan - 扫描 [p, end) 中的记录, 满足条件的放入 out
+ * @param p     一条记录的开头
+ * @return 匹配的记录数
+ */
+static size_t _qScan(const QFilter* f, const char* p, const char* end, QBuf* out)
+{
+    const char* m;
+    const char* r;
+    const char* e;
+    size_t n = 0, tlen;
+
+    while(p < end)
+    {
+        if(f->pat)                          // 先找子串, 再找到它所在记录的开头
+        {
+            m = _qFind(p, end, f->pat, f->plen);
+            if(m == end)
+                break;
+            r = _qLineStart(m, p);
+            while(r > p && !_qTime(r, end, &tlen))
+                r = _qLineStart(r - 1, p);
+        }
+        else
+            r = p;
+        e = _qNextRec(_qNextLine(r, end), end);
+        if(_qPass(f, r, e))
+        {
+            n++;
+            if(!f->count)
+                _qPut(out, r, e - r);
+        }
+        p = e;
+    }
+    return n;
+}
+
+/**
+ * @brief _qBound - 二分查找时间不早于 (upper 时为晚于) key 的第一条记录
+ * @return 记录的开头, 或 end
+ */
+static const char* _qBound(const char* begin, const char* end, const char* key, size_t klen, bool upper)
+{
+    const char* lo = begin;
+    const char* hi = end;
+    const char* mid;
+    const char* r;
+    const char* ts;
+    size_t tlen;
+    int c;
+
+    while(hi - lo > Q_SLACK)
+    {
+        mid = lo + (hi - lo) / 2;
+        r   = _qNextRec(_qNextLine(mid, hi), hi);
+        if(r == hi)
+        {
+            hi = mid;
+            continue;
+        }
+        ts = _qTime(r, hi, &tlen);
+        c  = _qTsCmp(ts, upper && tlen > klen ? klen : tlen, key, klen);
+        if(upper ? c <= 0 : c < 0)
+            lo = r;
+        else
+            hi = mid;
+    }
+    return _qNextRec(lo, end);
+}
+
+static void* _qWorker(void* arg)
+{
+    QJob* j = (QJob*)arg;
+    QChunk* c;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&j->mtx);
+        while(j->next < j->nchunk && j->next >= j->printed + j->window)
+            pthread_cond_wait(&j->cond, &j->mtx);
+        if(j->next >= j->nchunk)
+        {
+            pthread_mutex_unlock(&j->mtx);
+            break;
+        }
+        c = &j->chunks[j->next++];
+        pthread_mutex_unlock(&j->mtx);
+
+        c->n = _qScan(j->f, c->p, c->end, &c->out);
+
+        pthread_mutex_lock(&j->mtx);
+        c->done = 1;
+        pthread_cond_broadcast(&j->cond);
+        pthread_mutex_unlock(&j->mtx);
+    }
+    return NULL;
+}
+
+/* 将 [p, end) 按记录边界分为约 Q_CHUNK 大小的块, 加入 chunks */
+static void _qSplit(const char* p, const char* end, QChunk** chunks, size_t* n, size_t* cap)
+{
+    const char* e;
+
+    while(p < end)
+    {
+        e = (size_t)(end - p) > Q_CHUNK ? _qNextRec(_qNextLine(p + Q_CHUNK, end), end) : end;
+        if(*n == *cap)
+        {
+            *cap   = *cap ? *cap * 2 : 64;
+            *chunks = (QChunk*)realloc(*chunks, *cap * sizeof(QChunk));
+            if(!*chunks)
+            {
+                fprintf(stderr, "logq: out of memory\n");
+                exit(1);
+            }
+        }
+        memset(&(*chunks)[*n], 0, sizeof(QChunk));
+        (*chunks)[*n].p   = p;
+        (*chunks)[*n].end = e;
+        (*n)++;
+        p = e;
+    }
+}
+
+/**
+ * @brief _qSearch - 查询所有文件中已有的内容
+ * @param sizes 输出各文件查询时的大小, 跟踪模式从此处开始
+ * @return 匹配的记录数
+ */
+static size_t _qSearch(const QFilter* f, char* const* paths, int nfile, int threads, size_t* sizes, ino_t* inos)
+{
+    const char** maps = (const char**)calloc(nfile, sizeof(char*));
+    QChunk*    chunks = NULL;
+    pthread_t* th = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    size_t     nchunk = 0, cap = 0, total = 0, i;
+    const char* a;
+    const char* b;
+    struct stat st;
+    QJob  j;
+    int   k, fd;
+
+    if(!maps || !th)
+    {
+        fprintf(stderr, "logq: out of memory\n");
+        exit(1);
+    }
+
+    for(k = 0; k < nfile; k++)
+    {
+        sizes[k] = 0;
+        inos[k]  = 0;
+        fd = open(paths[k], O_RDONLY | O_CLOEXEC);
+        if(fd < 0 || fstat(fd, &st))
+        {
+            fprintf(stderr, "logq: %s: %s\n", paths[k], strerror(errno));
+            if(fd >= 0)     close(fd);
+            continue;
+        }
+        sizes[k] = st.st_size;
+        inos[k]  = st.st_ino;
+        if(st.st_size > 0)
+        {
+            maps[k] = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(MAP_FAILED == maps[k])
+            {
+                fprintf(stderr, "logq: %s: %s\n", paths[k], strerror(errno));
+                maps[k] = NULL;
+            }
+        }
+        close(fd);
+        if(!maps[k])
+            continue;
+
+        a = maps[k];
+        b = maps[k] + sizes[k];
+        if(f->from)
+        {
+            a = _qBound(a, b, f->from, f->flen, false);
+            a = a - maps[k] > Q_SLACK ? a - Q_SLACK : maps[k];
+            a = _qNextRec(_qLineStart(a, maps[k]), b);
+        }
+        if(f->to)
+        {
+            b = _qBound(a, b, f->to, f->tlen, true);
+            b = maps[k] + sizes[k] - b > Q_SLACK ? b + Q_SLACK : maps[k] + sizes[k];
+            b = _qNextRec(_qNextLine(_qLineStart(b, a), maps[k] + sizes[k]), maps[k] + sizes[k]);
+        }
+        i = (a - maps[k]) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);  // 之后顺序读取, 预读时间范围内的部分
+        madvise((void*)(maps[k] + i), b - maps[k] - i, MADV_WILLNEED);
+        _qSplit(a, b, &chunks, &nchunk, &cap);
+    }
+
+    memset(&j, 0, sizeof(j));
+    j.f      = f;
+    j.chunks = chunks;
+    j.nchunk = nchunk;
+    j.window = (size_t)threads * Q_WINDOW;
+    pthread_mutex_init(&j.mtx, NULL);
+    pthread_cond_init(&j.cond, NULL);
+    for(k = 0; k < threads; k++)
+        pthread_create(&th[k], NULL, _qWorker, &j);
+
+    for(i = 0; i < nchunk; i++)             // 按顺序输出各块的结果
+    {
+        pthread_mutex_lock(&j.mtx);
+        while(!chunks[i].done)
+            pthread_cond_wait(&j.cond, &j.mtx);
+        pthread_mutex_unlock(&j.mtx);
+
+        if(chunks[i].out.len)
+            fwrite(chunks[i].out.p, 1, chunks[i].out.len, stdout);
+        total += chunks[i].n;
+        free(chunks[i].out.p);
+
+        pthread_mutex_lock(&j.mtx);
+        j.printed++;
+        pthread_cond_broadcast(&j.cond);
+        pthread_mutex_unlock(&j.mtx);
+    }
+
+    for(k = 0; k < threads; k++)
+        pthread_join(th[k], NULL);
+    pthread_mutex_destroy(&j.mtx);
+    pthread_cond_destroy(&j.cond);
+    for(k = 0; k < nfile; k++)
+        if(maps[k])
+            munmap((void*)maps[k], sizes[k]);
+    free(maps);
+    free(chunks);
+    free(th);
+    return total;
+}
+
+/* 输出跟踪缓冲区中完整的记录; idle 时 (这一轮没有新内容) 最后一条记录也视为完整 */
+static void _qEmit(const QFilter* f, QBuf* pend, bool idle)
+{
+    QBuf out = {NULL, 0, 0};
+    const char* end = pend->p + pend->len;
+    const char* cut;
+    const char* r;
+    size_t tlen;
+
+    if(!pend->len)  return;
+    cut = end;
+    while(cut > pend->p && cut[-1] != '\n')  // 不完整的一行留到下次
+        cut--;
+    if(!idle && cut > pend->p)              // 最后一条记录可能还有后续的行, 等下一条记录开始或没有新内容时再输出
+    {
+        r = _qLineStart(cut - 1, pend->p);
+        while(r > pend->p && !_qTime(r, cut, &tlen))
+            r = _qLineStart(r - 1, pend->p);
+        cut = r;
+    }
+    if(cut == pend->p)
+        return;
+
+    _qScan(f, pend->p, cut, &out);
+    if(out.len)
+    {
+        fwrite(out.p, 1, out.len, stdout);
+        fflush(stdout);
+    }
+    free(out.p);
+    memmove(pend->p, cut, end - cut);
+    pend->len = end - cut;
+}
+
+/**
+ * @brief _qFollow - 跟踪文件新写入的内容, 不会返回
+ * @param sizes 各文件已查询的大小, 从此处开始跟踪
+ * @note  文件的 inode 变化 (被轮转) 或变小 (被清空) 时, 从头读取新文件
+ */
+static void _qFollow(const QFilter* f, char* const* paths, int nfile, size_t* sizes, ino_t* inos)
+{
+    struct timespec ts = {Q_POLL_MS / 1000, Q_POLL_MS % 1000 * 1000000};
+    QBuf*  pend = (QBuf*)calloc(nfile, sizeof(QBuf));
+    char   buf[64 << 10];
+    struct stat st;
+    ssize_t n;
+    bool   idle;
+    int    k, fd;
+
+    if(!pend)
+    {
+        fprintf(stderr, "logq: out of memory\n");
+        exit(1);
+    }
+    for(;;)
+    {
+        nanosleep(&ts, NULL);
+        for(k = 0; k < nfile; k++)
+        {
+            if(stat(paths[k], &st))
+                continue;
+            if(st.st_ino != inos[k] || (size_t)st.st_size < sizes[k])
+            {
+                _qEmit(f, &pend[k], true);
+                inos[k]  = st.st_ino;
+                sizes[k] = 0;
+            }
+            idle = true;
+            if((size_t)st.st_size > sizes[k] && (fd = open(paths[k], O_RDONLY | O_CLOEXEC)) >= 0)
+            {
+                while((n = pread(fd, buf, sizeof(buf), sizes[k])) > 0)
+                {
+                    _qPut(&pend[k], buf, n);
+                    sizes[k] += n;
+                    idle = false;
+                }
+                close(fd);
+            }
+            _qEmit(f, &pend[k], idle);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QFilter f;
+    size_t* sizes;
+    ino_t*  inos;
+    size_t  total;
+    int     opt, threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool    follow = false;
+
+    memset(&f, 0, sizeof(f));
+    while(-1 != (opt = getopt(argc, argv, "s:e:n:p:j:cfh")))
+    {
+        switch(opt)
+        {
+            case 's':   f.from = optarg;    f.flen = strlen(optarg);    break;
+            case 'e':   f.to   = optarg;    f.tlen = strlen(optarg);    break;
+            case 'n':   f.name = optarg;    f.nlen = strlen(optarg);    break;
+            case 'p':   f.pat  = optarg;    f.plen = strlen(optarg);    break;
+            case 'j':   threads = atoi(optarg);     break;
+            case 'c':   f.count = true;             break;
+            case 'f':   follow = true;              break;
+            default:
+                fprintf(stderr, "usage: %s [-s from] [-e to] [-n name] [-p substring] [-j threads] [-c] [-f] <file>...\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc || (f.from && (f.flen < 4 || f.flen > Q_TSMAX)) || (f.to && (f.tlen < 4 || f.tlen > Q_TSMAX)))
+    {
+        fprintf(stderr, "usage: %s [-s from] [-e to] [-n name] [-p substring] [-j threads] [-c] [-f] <file>...\n", argv[0]);
+        return 1;
+    }
+    if(follow && f.count)
+    {
+        fprintf(stderr, "%s: -c and -f cannot be used together\n", argv[0]);
+        return 1;
+    }
+    if(f.pat && !f.plen)
+        f.pat = NULL;
+    if(threads < 1)
+        threads = 1;
+
+    sizes = (size_t*)malloc(sizeof(size_t) * (argc - optind));
+    inos  = (ino_t*)malloc(sizeof(ino_t) * (argc - optind));
+    if(!sizes || !inos)
+        return 1;
+
+    total = _qSearch(&f, argv + optind, argc - optind, threads, sizes, inos);
+    if(f.count)
+        printf("%zu\n", total);
+    fflush(stdout);
+    if(follow)
+        _qFollow(&f, argv + optind, argc - optind, sizes, inos);
+
+    free(sizes);
+    free(inos);
+    return 0;
+}
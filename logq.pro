@@ -0,0 +1,12 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+LIBS += -pthread
+
+SOURCES += logq.c \
+    log.c
+
+HEADERS += \
+    log.h